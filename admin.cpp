@@ -66,6 +66,11 @@ int main(int argc, char **argv)
 		cout << "e. Update way/relation bboxes" << endl;
 		cout << "g. Upgrade/downgrade db schema" << endl;
 		cout << "h. Create/drop bbox indices" << endl;
+		cout << "i. Copy map data from this host" << endl;
+		cout << "j. Check integrity in parallel" << endl;
+		cout << "k. Cluster nodes and ways by location" << endl;
+		cout << "l. Create/drop/prune change log" << endl;
+		cout << "m. Create/drop tag indices" << endl;
 
 		cout << endl << "q. Quit" << endl;
 
@@ -102,8 +107,24 @@ int main(int argc, char **argv)
 
 		if(inputStr == "3")
 		{
+			cout << "Number of parallel connections (1 to copy in a single transaction)?" << endl;
+			std::string numWorkersStr;
+			cin >> numWorkersStr;
+			int numWorkers = atoi(numWorkersStr.c_str());
+
 			std::shared_ptr<class PgAdmin> admin = pgMap.GetAdmin();
-			bool ok = admin->CopyMapData(verbose, config["csv_absolute_path"], errStr);
+			bool ok = true;
+			if(numWorkers > 1)
+			{
+				cout << "Stage as unlogged tables (1/0)?" << endl;
+				std::string unloggedStr;
+				cin >> unloggedStr;
+
+				ok = admin->CopyMapDataParallel(verbose, config["csv_absolute_path"], numWorkers, 
+					atoi(unloggedStr.c_str()), errStr);
+			}
+			else
+				ok = admin->CopyMapData(verbose, config["csv_absolute_path"], errStr);
 
 			if(ok)
 				cout << "All done!" << endl;
@@ -114,8 +135,27 @@ int main(int argc, char **argv)
 
 		if(inputStr == "4")
 		{
+			cout << "Number of parallel connections (1 to build in a single transaction)?" << endl;
+			std::string numWorkersStr;
+			cin >> numWorkersStr;
+			int numWorkers = atoi(numWorkersStr.c_str());
+
 			std::shared_ptr<class PgAdmin> admin = pgMap.GetAdmin();
-			bool ok = admin->CreateMapIndices(verbose, errStr);
+			bool ok = true;
+			if(numWorkers > 1)
+			{
+				cout << "maintenance_work_mem for each connection (e.g. 2GB)?" << endl;
+				std::string maintenanceWorkMem;
+				cin >> maintenanceWorkMem;
+				cout << "Parallel maintenance workers for each index?" << endl;
+				std::string parallelWorkersStr;
+				cin >> parallelWorkersStr;
+
+				ok = admin->CreateMapIndicesParallel(verbose, numWorkers, maintenanceWorkMem, 
+					atoi(parallelWorkersStr.c_str()), errStr);
+			}
+			else
+				ok = admin->CreateMapIndices(verbose, errStr);
 
 			if(ok)
 				cout << "All done!" << endl;
@@ -225,6 +265,22 @@ int main(int argc, char **argv)
 
 		if(inputStr == "9")
 		{
+			cout << "Number of parallel connections (1 to generate in a single transaction)?" << endl;
+			std::string numWorkersStr;
+			cin >> numWorkersStr;
+			int numWorkers = atoi(numWorkersStr.c_str());
+
+			if(numWorkers > 1)
+			{
+				std::shared_ptr<class PgAdmin> admin = pgMap.GetAdmin();
+				bool ok = admin->GenerateUsernameTableParallel(verbose, numWorkers, errStr);
+				if(ok)
+					cout << "All done!" << endl;
+				else
+					cout << errStr.errStr << endl;
+				continue;
+			}
+
 			std::shared_ptr<class PgAdmin> admin = pgMap.GetAdmin("EXCLUSIVE");
 			bool ok = admin->GenerateUsernameTable(verbose, errStr);
 
@@ -300,6 +356,54 @@ int main(int argc, char **argv)
 			continue;
 		}
 
+		if(inputStr == "j")
+		{
+			cout << "Number of parallel connections?" << endl;
+			std::string numWorkersStr;
+			cin >> numWorkersStr;
+			int numWorkers = atoi(numWorkersStr.c_str());
+
+			std::shared_ptr<class PgAdmin> admin = pgMap.GetAdmin();
+			std::vector<class DbIntegrityResult> results;
+			bool ok = admin->CheckIntegrityParallel(verbose, numWorkers, 10, results, errStr);
+			if(!ok)
+			{
+				cout << errStr.errStr << endl;
+				continue;
+			}
+
+			for(size_t i=0; i<results.size(); i++)
+			{
+				const class DbIntegrityResult &result = results[i];
+				cout << result.name << ": " << result.count << endl;
+				for(size_t j=0; j<result.sampleIds.size(); j++)
+				{
+					cout << "   " << result.sampleIds[j];
+					if(result.sampleRefs[j] != 0)
+						cout << " -> " << result.sampleRefs[j];
+					cout << endl;
+				}
+			}
+			cout << "All done!" << endl;
+			continue;
+		}
+
+		if(inputStr == "k")
+		{
+			cout << "Number of parallel connections?" << endl;
+			std::string numWorkersStr;
+			cin >> numWorkersStr;
+			int numWorkers = atoi(numWorkersStr.c_str());
+
+			std::shared_ptr<class PgAdmin> admin = pgMap.GetAdmin();
+			bool ok = admin->ClusterSpatially(verbose, numWorkers, errStr);
+			if(ok)
+				cout << "All done!" << endl;
+			else
+				cout << errStr.errStr << endl;
+			continue;
+		}
+
 		if(inputStr == "e")
 		{
 			cout << "Update static tables (1/0)?" << endl;
@@ -326,7 +430,10 @@ int main(int argc, char **argv)
 
 			std::shared_ptr<class PgAdmin> admin = pgMap.GetAdmin();
 			bool ok = admin->CreateMapTables(verbose, atoi(schemaVer.c_str()), false, errStr);
-			admin->Commit();
+			if(ok)
+				admin->Commit();
+			else
+				admin->Abort();
 
 			if(ok)
 				cout << "All done!" << endl;
@@ -356,6 +463,83 @@ int main(int argc, char **argv)
 			continue;
 		}
 
+		if(inputStr == "l")
+		{
+			cout << "Create, delete or prune (c/d/p)?" << endl;
+			std::string action;
+			cin >> action;
+			bool ok = true;
+
+			std::shared_ptr<class PgAdmin> admin = pgMap.GetAdmin();
+			if(action == "c")
+				ok = admin->CreateChangeLog(verbose, errStr);
+			else if(action == "d") 
+				ok = admin->DropChangeLog(verbose, errStr);
+			else if(action == "p")
+			{
+				cout << "Remove entries before timestamp?" << endl;
+				std::string beforeStr;
+				cin >> beforeStr;
+				ok = admin->PruneChangeLog(verbose, atol(beforeStr.c_str()), errStr);
+			}
+			admin->Commit();
+
+			if(ok)
+				cout << "All done!" << endl;
+			else
+				cout << errStr.errStr << endl;
+			continue;
+		}
+
+		if(inputStr == "m")
+		{
+			cout << "Create or delete (c/d)?" << endl;
+			std::string action;
+			cin >> action;
+			bool ok = true;
+
+			std::shared_ptr<class PgAdmin> admin = pgMap.GetAdmin();
+			if(action == "c")
+			{
+				cout << "Popular keys to index separately (comma separated, or - for none)?" << endl;
+				std::string keysStr;
+				cin >> keysStr;
+				std::vector<std::string> popularKeys;
+				if(keysStr != "-")
+					popularKeys = split(keysStr, ',');
+				ok = admin->CreateTagIndices(verbose, popularKeys, errStr);
+			}
+			else if(action == "d") 
+				ok = admin->DropTagIndices(verbose, errStr);
+			admin->Commit();
+
+			if(ok)
+				cout << "All done!" << endl;
+			else
+				cout << errStr.errStr << endl;
+			continue;
+		}
+
+		if(inputStr == "i")
+		{
+			cout << "Number of parallel connections?" << endl;
+			std::string numWorkersStr;
+			cin >> numWorkersStr;
+			cout << "Decompression threads per connection?" << endl;
+			std::string decodeThreadsStr;
+			cin >> decodeThreadsStr;
+
+			std::shared_ptr<class PgAdmin> admin = pgMap.GetAdmin();
+			bool ok = admin->CopyMapDataFromClient(verbose, config["csv_absolute_path"], 
+				atoi(numWorkersStr.c_str()), atoi(decodeThreadsStr.c_str()), errStr);
+
+			if(ok)
+				cout << "All done!" << endl;
+			else
+				cout << errStr.errStr << endl;
+			continue;
+		}
+
 		if(inputStr == "q")
 		{
 			running = false;
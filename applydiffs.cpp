@@ -16,6 +16,12 @@ int main(int argc, char **argv)
 		("help", "produce help message")
 		("in", po::value<string>(), "path to diffs, or diff file name")
 		("verbose", po::value<int>(), "verbosity level (default is 1)")
+		("batch", po::value<int>(), "number of diff files to apply before updating parents and bboxes (default is 1)")
+		("checkpoint-files", po::value<int>(), "commit after this many diff files (default is 0, commit at the end)")
+		("checkpoint-objects", po::value<int64_t>(), "commit after this many objects (default is 0, commit at the end)")
+		("no-resume", "apply all files, rather than starting after the last recorded sequence")
+		("workers", po::value<int>(), "number of connections to write objects on (default is 1)")
+		("two-phase", "commit parallel writes with two phase commit (needs max_prepared_transactions)")
 	;
 
 	po::variables_map vm;
@@ -43,7 +49,21 @@ int main(int argc, char **argv)
 
 	int verbose = 1;
 	if (vm.count("verbose"))
-		inPath = vm["in"].as<string>();
+		verbose = vm["verbose"].as<int>();
+	int batchFiles = 1;
+	if (vm.count("batch"))
+		batchFiles = vm["batch"].as<int>();
+	int checkpointFiles = 0;
+	if (vm.count("checkpoint-files"))
+		checkpointFiles = vm["checkpoint-files"].as<int>();
+	int64_t checkpointObjects = 0;
+	if (vm.count("checkpoint-objects"))
+		checkpointObjects = vm["checkpoint-objects"].as<int64_t>();
+	bool resume = vm.count("no-resume") == 0;
+	int numWorkers = 1;
+	if (vm.count("workers"))
+		numWorkers = vm["workers"].as<int>();
+	bool twoPhase = vm.count("two-phase") > 0;
 	
 	string cstr = GeneratePgConnectionString(config);
 	
@@ -51,8 +71,10 @@ int main(int argc, char **argv)
 	class PgMapError errStr;
 
 	//Apply diffs to database	
-	std::shared_ptr<class PgAdmin> admin = pgMap.GetAdmin("EXCLUSIVE");
-	bool ok = admin->ApplyDiffs(inPath, verbose, errStr);
+	//Worker connections write to the tables, so they cannot be locked exclusively in parallel mode
+	std::shared_ptr<class PgAdmin> admin = pgMap.GetAdmin(numWorkers > 1 ? "ROW EXCLUSIVE" : "EXCLUSIVE");
+	bool ok = admin->ApplyDiffs(inPath, batchFiles, checkpointFiles, checkpointObjects, 
+		resume, numWorkers, twoPhase, verbose, errStr);
 
 	if(!ok)
 	{
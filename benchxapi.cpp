@@ -0,0 +1,86 @@
+#include <iostream>
+#include "pgmap.h"
+#include "util.h"
+#include <boost/program_options.hpp>
+namespace po = boost::program_options;
+
+int main(int argc, char **argv)
+{
+	po::options_description desc("Allowed options");
+	desc.add_options()
+		("help", "produce help message")
+		("type", po::value<string>(), "object type, node, way or relation (default is node)")
+		("key", po::value<string>(), "tag key to match")
+		("value", po::value<string>(), "tag value to match (default is any value)")
+		("bbox", po::value<string>(), "bounding box (left,bottom,right,top)")
+		("repeats", po::value<int>(), "number of times each query is run, the fastest is reported (default is 3)")
+		("plan", "print the query plans")
+	;
+
+	po::variables_map vm;
+	po::store(po::parse_command_line(argc, argv, desc), vm);
+	po::notify(vm);
+
+	if (vm.count("help") or vm.count("key") == 0) {
+		cout << desc << "\n";
+		return 1;
+	}
+
+	string objType = "node";
+	if (vm.count("type"))
+		objType = vm["type"].as<string>();
+	string tagKey = vm["key"].as<string>();
+	string tagValue;
+	if (vm.count("value"))
+		tagValue = vm["value"].as<string>();
+	int repeats = 3;
+	if (vm.count("repeats"))
+		repeats = vm["repeats"].as<int>();
+	bool showPlan = vm.count("plan") > 0;
+
+	vector<double> bbox;
+	if (vm.count("bbox"))
+	{
+		vector<string> bboxvals = split(vm["bbox"].as<string>(), ',');
+		for(size_t i=0; i < bboxvals.size(); i++)
+			bbox.push_back(atof(bboxvals[i].c_str()));
+		if(bbox.size() != 4)
+		{
+			cerr << "Bbox must have 4 numbers" << endl;
+			return -1;
+		}
+	}
+
+	cout << "Reading settings from config.cfg" << endl;
+	std::map<string, string> config;
+	ReadSettingsFile("config.cfg", config);
+
+	string cstr = GeneratePgConnectionString(config);
+	class PgMap pgMap(cstr, config["dbtableprefix"], config["dbtablemodifyprefix"], config["dbtablemodifyprefix"], config["dbtabletestprefix"]);
+	if (!pgMap.Ready()) {
+		cout << "Can't open database" << endl;
+		return -1;
+	}
+
+	std::shared_ptr<class PgTransaction> transaction = pgMap.GetTransaction("ACCESS SHARE");
+
+	//The original full text match (with the GiST bbox and tsvector indices) against plain
+	//containment (with the GIN and partial key indices)
+	string names[] = {"tsvector and @>", "@> and ?"};
+	bool fullText[] = {true, false};
+	for(int i=0; i<2; i++)
+	{
+		double seconds = 0.0;
+		int64_t rows = 0;
+		string plan;
+		transaction->BenchmarkXapiQuery(objType, tagKey, tagValue, bbox, fullText[i], repeats,
+			seconds, rows, plan);
+
+		cout << names[i] << ": " << rows << " " << objType << "s in " << seconds << " s" << endl;
+		if(showPlan)
+			cout << plan << endl;
+	}
+
+	transaction->Abort();
+	return 0;
+}
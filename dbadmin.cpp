@@ -6,16 +6,26 @@
 #include "dbquery.h"
 #include "dbusername.h"
 #include "dbmeta.h"
+#include "dbparallel.h"
+#include "dbchangelog.h"
 #include "util.h"
+#include "gzipblocks.h"
 #include "cppGzip/DecodeGzip.h"
 #include "cppo5m/utils.h"
 #include <map>
 #include <set>
 #include <boost/filesystem.hpp>
 #include <fstream>
+#include <algorithm>
 using namespace std;
 using namespace boost::filesystem;
 
+#if PQXX_VERSION_MAJOR >= 7
+typedef pqxx::stream_to pqxxcopystream;
+#else
+typedef pqxx::tablewriter pqxxcopystream;
+#endif
+
 bool ClearTable(pqxx::connection &c, pqxx::transaction_base *work, const string &tableName, std::string &errStr)
 {
 	try
@@ -59,6 +69,10 @@ bool ResetActiveTables(pqxx::connection &c, pqxx::transaction_base *work,
 	ok = ClearTable(c, work, tableActivePrefix + "usernames", errStr);            if(!ok) return false;
 	ok = ClearTable(c, work, tableActivePrefix + "edit_activity", errStr);            if(!ok) return false;
 	ok = ClearTable(c, work, tableActivePrefix + "query_activity", errStr);            if(!ok) return false;
+	if(DbCheckTableExists(c, work, tableActivePrefix + "changelog"))
+	{
+		ok = ClearTable(c, work, tableActivePrefix + "changelog", errStr);          if(!ok) return false;
+	}
 
 	map<string, int64_t> nextIdMap;
 	ok = GetNextObjectIds(c, work, 
@@ -142,6 +156,46 @@ bool DbUpgradeTables0to11(pqxx::connection &c, pqxx::transaction_base *work,
 	return ok;
 }
 
+//Creates the views of objects visible in a table set, which combine the live tables with 
+//the visible objects of the parent tables that have not been replaced. With replace set, 
+//existing views are redefined in place, so views that depend on them are kept.
+//
+//Every object in the live tables has its ID in the ids table, so the two halves never 
+//share an ID. With unionAll set (schema version 15), they are simply appended rather 
+//than deduplicated by UNION. The deduplication hashed or sorted every row of a dump or 
+//bbox query; with UNION ALL, ORDER BY id becomes a merge of the two index ordered halves 
+//and conditions on id are pushed into both halves.
+bool DbCreateVisibleViews(pqxx::connection &c, pqxx::transaction_base *work, 
+	int verbose, 
+	const std::string &parentPrefix, 
+	const std::string &tablePrefix, 
+	bool replace,
+	bool unionAll,
+	std::string &errStr)
+{
+	string objTypes[] = {"node", "way", "relation"};
+	string create = replace ? "CREATE OR REPLACE VIEW " : "CREATE VIEW ";
+	string unionStr = unionAll ? " UNION ALL " : " UNION ";
+	bool ok = true;
+	for(int i=0; i<3; i++)
+	{
+		string v = c.quote_name(tablePrefix+"visible"+objTypes[i]+"s");
+		string l = c.quote_name(tablePrefix+"live"+objTypes[i]+"s");
+		string sql;
+		if(parentPrefix.size() > 0)
+		{
+			string pv = c.quote_name(parentPrefix+"visible"+objTypes[i]+"s");
+			string ids = c.quote_name(tablePrefix+objTypes[i]+"ids");
+
+			sql = create+v+" AS SELECT "+pv+".* FROM "+pv+" LEFT JOIN "+ids+" ON "+ids+".id = "+pv+".id WHERE "+ids+".id IS NULL"+unionStr+"SELECT * FROM "+l+";";
+		}
+		else
+			sql = create+v+" AS SELECT * FROM "+l+";";
+		ok = DbExec(work, sql, errStr, nullptr, verbose); if(!ok) return ok;
+	}
+	return ok;
+}
+
 bool DbUpgradeTables11to12(pqxx::connection &c, pqxx::transaction_base *work, 
 	int verbose, 
 	const std::string &parentPrefix, 
@@ -157,54 +211,7 @@ bool DbUpgradeTables11to12(pqxx::connection &c, pqxx::transaction_base *work,
 	sql = "ALTER TABLE "+c.quote_name(tablePrefix+"liverelations")+" ADD COLUMN bbox GEOMETRY(Geometry, 4326);";
 	ok = DbExec(work, sql, errStr, nullptr, verbose); if(!ok) return ok;
 
-	string vn = c.quote_name(tablePrefix+"visiblenodes");
-	string ln = c.quote_name(tablePrefix+"livenodes");
-	if(parentPrefix.size() > 0)
-	{
-		string pvn = c.quote_name(parentPrefix+"visiblenodes");
-		string nids = c.quote_name(tablePrefix+"nodeids");
-
-		sql = "CREATE VIEW "+vn+" AS SELECT "+pvn+".* FROM "+pvn+" LEFT JOIN "+nids+" ON "+nids+".id = "+pvn+".id WHERE "+nids+".id IS NULL UNION SELECT * FROM "+ln+";";
-		ok = DbExec(work, sql, errStr, nullptr, verbose); if(!ok) return ok;
-	}
-	else
-	{
-		sql = "CREATE VIEW "+vn+" AS SELECT * FROM "+ln+";";
-		ok = DbExec(work, sql, errStr, nullptr, verbose); if(!ok) return ok;
-	}
-
-	string vw = c.quote_name(tablePrefix+"visibleways");
-	string lw = c.quote_name(tablePrefix+"liveways");
-	if(parentPrefix.size() > 0)
-	{
-		string pvw = c.quote_name(parentPrefix+"visibleways");
-		string wids = c.quote_name(tablePrefix+"wayids");
-
-		sql = "CREATE VIEW "+vw+" AS SELECT "+pvw+".* FROM "+pvw+" LEFT JOIN "+wids+" ON "+wids+".id = "+pvw+".id WHERE "+wids+".id IS NULL UNION SELECT * FROM "+lw+";";
-		ok = DbExec(work, sql, errStr, nullptr, verbose); if(!ok) return ok;
-	}
-	else
-	{
-		sql = "CREATE VIEW "+vw+" AS SELECT * FROM "+lw+";";
-		ok = DbExec(work, sql, errStr, nullptr, verbose); if(!ok) return ok;
-	}
-
-	string vr = c.quote_name(tablePrefix+"visiblerelations");
-	string lr = c.quote_name(tablePrefix+"liverelations");
-	if(parentPrefix.size() > 0)
-	{
-		string pvr = c.quote_name(parentPrefix+"visiblerelations");
-		string rids = c.quote_name(tablePrefix+"relationids");
-
-		sql = "CREATE VIEW "+vr+" AS SELECT "+pvr+".* FROM "+pvr+" LEFT JOIN "+rids+" ON "+rids+".id = "+pvr+".id WHERE "+rids+".id IS NULL UNION SELECT * FROM "+lr+";";
-		ok = DbExec(work, sql, errStr, nullptr, verbose); if(!ok) return ok;
-	}
-	else
-	{
-		sql = "CREATE VIEW "+vr+" AS SELECT * FROM "+lr+";";
-		ok = DbExec(work, sql, errStr, nullptr, verbose); if(!ok) return ok;
-	}
-
+	ok = DbCreateVisibleViews(c, work, verbose, parentPrefix, tablePrefix, false, false, errStr);
 	return ok;
 }
 
@@ -244,6 +251,257 @@ bool DbUpgradeTables12to13(pqxx::connection &c, pqxx::transaction_base *work,
 	return ok;
 }
 
+//Tables partitioned by object ID range from schema version 14, and the width of each
+//range. The last range is open ended, so new objects always have somewhere to go.
+struct PartitionedTable
+{
+	const char *table;
+	int64_t rangeWidth;
+};
+
+const PartitionedTable partitionedTables[] = {
+	{"oldnodes", 1000000000},
+	{"oldways", 100000000},
+	{"oldrelations", 2000000},
+	{"livenodes", 1000000000},
+	{"liveways", 100000000},
+	{"liverelations", 2000000},
+	{"way_mems", 100000000},
+	{"relation_mems_n", 2000000},
+	{"relation_mems_w", 2000000},
+	{"relation_mems_r", 2000000}};
+
+const int minPartitionRanges = 16;
+
+//Moves a table's rows into a new table of the same name, either partitioned by ID range
+//(rangeWidth > 0) or plain. The original is left renamed with a "_rebuild" suffix, so the
+//caller can repoint the views before dropping it. Indices are not copied.
+bool DbRebuildTable(pqxx::connection &c, pqxx::transaction_base *work, 
+	int verbose, 
+	const std::string &table, 
+	int64_t rangeWidth,
+	std::string &errStr)
+{
+	string oldTable = table+"_rebuild";
+	string sql = "ALTER TABLE "+c.quote_name(table)+" RENAME TO "+c.quote_name(oldTable)+";";
+	bool ok = DbExec(work, sql, errStr, nullptr, verbose); if(!ok) return ok;
+
+	sql = "CREATE TABLE "+c.quote_name(table)+" (LIKE "+c.quote_name(oldTable)+" INCLUDING DEFAULTS)";
+	if(rangeWidth > 0)
+		sql += " PARTITION BY RANGE (id)";
+	sql += ";";
+	ok = DbExec(work, sql, errStr, nullptr, verbose); if(!ok) return ok;
+
+	if(rangeWidth > 0)
+	{
+		//Enough ranges to cover the existing objects, with room to grow
+		pqxx::result r = work->exec("SELECT MAX(id) FROM "+c.quote_name(oldTable)+";");
+		int64_t maxId = r[0][0].is_null() ? 0 : r[0][0].as<int64_t>();
+		int64_t numRanges = maxId / rangeWidth + 2;
+		if(numRanges < minPartitionRanges)
+			numRanges = minPartitionRanges;
+
+		for(int64_t i=0; i<numRanges; i++)
+		{
+			stringstream ss;
+			ss << "CREATE TABLE " << c.quote_name(table+"_p"+to_string(i)) << " PARTITION OF " << c.quote_name(table);
+			ss << " FOR VALUES FROM (";
+			if(i == 0) ss << "MINVALUE"; else ss << i * rangeWidth;
+			ss << ") TO (";
+			if(i == numRanges-1) ss << "MAXVALUE"; else ss << (i+1) * rangeWidth;
+			ss << ");";
+			ok = DbExec(work, ss.str(), errStr, nullptr, verbose); if(!ok) return ok;
+		}
+	}
+
+	sql = "INSERT INTO "+c.quote_name(table)+" SELECT * FROM "+c.quote_name(oldTable)+";";
+	ok = DbExec(work, sql, errStr, nullptr, verbose); if(!ok) return ok;
+	return ok;
+}
+
+//Definitions of the tag indices (see DbCreateTagIndices) on a table, which are not
+//rebuilt by create indices, so they are copied to the rebuilt table
+void DbGetTagIndexDefs(pqxx::connection &c, pqxx::transaction_base *work, 
+	const std::string &table,
+	std::vector<std::string> &defsOut)
+{
+	string prefix = table+"_gix_key_";
+	string sql = "SELECT indexdef FROM pg_indexes WHERE schemaname = current_schema() AND tablename = "+c.quote(table)
+		+" AND (indexname = "+c.quote(table+"_gin_tags")
+		+" OR left(indexname, "+to_string(prefix.size())+") = "+c.quote(prefix)+");";
+	pqxx::result r = work->exec(sql);
+	for (unsigned int rownum=0; rownum < r.size(); ++rownum)
+	{
+		//Indices of a partitioned table are listed as ON ONLY the parent
+		string def = r[rownum][0].as<string>();
+		size_t pos = def.find(" ON ONLY ");
+		if(pos != string::npos)
+			def.replace(pos, 9, " ON ");
+		defsOut.push_back(def);
+	}
+}
+
+void DbGetUserTriggers(pqxx::connection &c, pqxx::transaction_base *work, 
+	const std::string &table,
+	std::vector<std::string> &triggersOut)
+{
+	string sql = "SELECT tgname FROM pg_trigger WHERE tgrelid = "+c.quote(c.quote_name(table))+"::regclass AND NOT tgisinternal;";
+	pqxx::result r = work->exec(sql);
+	for (unsigned int rownum=0; rownum < r.size(); ++rownum)
+		triggersOut.push_back(r[rownum][0].as<string>());
+}
+
+//Views, other than the visible views, that would stop a table being dropped
+void DbGetDependentViews(pqxx::connection &c, pqxx::transaction_base *work, 
+	const std::string &table,
+	std::vector<std::string> &viewsOut)
+{
+	string sql = "SELECT DISTINCT v.relname FROM pg_depend AS d INNER JOIN pg_rewrite AS rw ON rw.oid = d.objid"
+		" INNER JOIN pg_class AS v ON v.oid = rw.ev_class WHERE d.classid = 'pg_rewrite'::regclass"
+		" AND d.refobjid = "+c.quote(c.quote_name(table))+"::regclass AND v.oid <> d.refobjid ORDER BY v.relname;";
+	pqxx::result r = work->exec(sql);
+	for (unsigned int rownum=0; rownum < r.size(); ++rownum)
+		viewsOut.push_back(r[rownum][0].as<string>());
+}
+
+bool DbRebuildTables(pqxx::connection &c, pqxx::transaction_base *work, 
+	int verbose, 
+	const std::string &parentPrefix, 
+	const std::string &tablePrefix, 
+	bool partitioned,
+	std::string &errStr)
+{
+	//Things that CREATE TABLE ... LIKE does not copy. The changelog triggers are put back, 
+	//with the log start unchanged, as nothing is written while the rows are copied.
+	int64_t changeLogStart = DbChangeLogStart(c, work, tablePrefix);
+	std::vector<std::string> tagIndexDefs;
+	for(size_t i=0; i<sizeof(partitionedTables)/sizeof(PartitionedTable); i++)
+	{
+		string table = tablePrefix+partitionedTables[i].table;
+
+		//Other views would be dropped with the tables, so leave them for the operator to deal with.
+		//This is checked before anything is renamed, as an admin session may not be able to roll back.
+		std::vector<std::string> allViews, views;
+		DbGetDependentViews(c, work, table, allViews);
+		for(size_t j=0; j<allViews.size(); j++)
+			if(allViews[j] != tablePrefix+"visiblenodes" and allViews[j] != tablePrefix+"visibleways"
+				and allViews[j] != tablePrefix+"visiblerelations")
+				views.push_back(allViews[j]);
+		if(views.size() > 0)
+		{
+			errStr = "Views depend on "+table+", drop them before rebuilding:";
+			for(size_t j=0; j<views.size(); j++)
+				errStr += " "+views[j];
+			return false;
+		}
+
+		DbGetTagIndexDefs(c, work, table, tagIndexDefs);
+
+		std::vector<std::string> allTriggers, triggers;
+		DbGetUserTriggers(c, work, table, allTriggers);
+		string changeLogTrigger = tablePrefix+"changelog_"+partitionedTables[i].table;
+		for(size_t j=0; j<allTriggers.size(); j++)
+			if(changeLogStart < 0 or allTriggers[j] != changeLogTrigger)
+				triggers.push_back(allTriggers[j]);
+		if(triggers.size() > 0)
+		{
+			cout << "Warning: triggers on " << table << " will be dropped:";
+			for(size_t j=0; j<triggers.size(); j++)
+				cout << " " << triggers[j];
+			cout << endl;
+		}
+	}
+
+	bool ok = true;
+	for(size_t i=0; i<sizeof(partitionedTables)/sizeof(PartitionedTable); i++)
+	{
+		const PartitionedTable &t = partitionedTables[i];
+		ok = DbRebuildTable(c, work, verbose, tablePrefix+t.table, partitioned ? t.rangeWidth : 0, errStr);
+		if(!ok) return ok;
+	}
+
+	//The views still refer to the original tables until they are redefined
+	ok = DbCreateVisibleViews(c, work, verbose, parentPrefix, tablePrefix, true, false, errStr);
+	if(!ok) return ok;
+
+	for(size_t i=0; i<sizeof(partitionedTables)/sizeof(PartitionedTable); i++)
+	{
+		string sql = "DROP TABLE "+c.quote_name(tablePrefix+partitionedTables[i].table+"_rebuild")+";";
+		ok = DbExec(work, sql, errStr, nullptr, verbose); if(!ok) return ok;
+	}
+
+	//Index names are free again now the original tables are gone
+	for(size_t i=0; i<tagIndexDefs.size(); i++)
+	{
+		ok = DbExec(work, tagIndexDefs[i]+";", errStr, nullptr, verbose); if(!ok) return ok;
+	}
+
+	if(changeLogStart >= 0)
+	{
+		ok = DbCreateChangeLog(c, work, verbose, tablePrefix, errStr); if(!ok) return ok;
+		ok = DbSetMetaValue(c, work, "changelog_start", to_string(changeLogStart), tablePrefix, errStr); if(!ok) return ok;
+	}
+
+	cout << "Indices of " << tablePrefix << " object tables were dropped, use create indices to rebuild them";
+	if(tagIndexDefs.size() > 0)
+		cout << " (" << tagIndexDefs.size() << " tag indices were recreated)";
+	cout << endl;
+	return ok;
+}
+
+bool DbUpgradeTables13to14(pqxx::connection &c, pqxx::transaction_base *work, 
+	int verbose, 
+	const std::string &parentPrefix, 
+	const std::string &tablePrefix, 
+	std::string &errStr)
+{
+	cout << "DbUpgradeTables13to14" << endl;
+
+	//Primary keys and indices on partitioned tables need PostgreSQL 11
+	int majorVer=0, minorVer=0;
+	DbGetVersion(c, work, majorVer, minorVer);
+	if(majorVer < 11)
+	{
+		errStr = "Partitioned tables require PostgreSQL 11 or later";
+		return false;
+	}
+
+	return DbRebuildTables(c, work, verbose, parentPrefix, tablePrefix, true, errStr);
+}
+
+bool DbUpgradeTables14to15(pqxx::connection &c, pqxx::transaction_base *work, 
+	int verbose, 
+	const std::string &parentPrefix, 
+	const std::string &tablePrefix, 
+	std::string &errStr)
+{
+	cout << "DbUpgradeTables14to15" << endl;
+
+	return DbCreateVisibleViews(c, work, verbose, parentPrefix, tablePrefix, true, true, errStr);
+}
+
+bool DbDowngradeTables15To14(pqxx::connection &c, pqxx::transaction_base *work, 
+	int verbose, 
+	const std::string &parentPrefix, 
+	const string &tablePrefix, 
+	std::string &errStr)
+{
+	cout << "DbDowngradeTables15To14" << endl;
+
+	return DbCreateVisibleViews(c, work, verbose, parentPrefix, tablePrefix, true, false, errStr);
+}
+
+bool DbDowngradeTables14To13(pqxx::connection &c, pqxx::transaction_base *work, 
+	int verbose, 
+	const std::string &parentPrefix, 
+	const string &tablePrefix, 
+	std::string &errStr)
+{
+	cout << "DbDowngradeTables14To13" << endl;
+
+	return DbRebuildTables(c, work, verbose, parentPrefix, tablePrefix, false, errStr);
+}
+
 bool DbDowngradeTables13To12(pqxx::connection &c, pqxx::transaction_base *work, 
 	int verbose, 
 	const string &tablePrefix, 
@@ -352,7 +610,12 @@ bool DbSetSchemaVersion(pqxx::connection &c, pqxx::transaction_base *work,
 	cout << "Starting schema version" << schemaVersion << endl;
 
 	if(latest)
-		targetVer = 13;
+	{
+		//Partitioned tables are only used where they are supported
+		int majorVer=0, minorVer=0;
+		DbGetVersion(c, work, majorVer, minorVer);
+		targetVer = majorVer >= 11 ? 15 : 13;
+	}
 	bool ok = true;
 
 	//Upgrading
@@ -395,7 +658,61 @@ bool DbSetSchemaVersion(pqxx::connection &c, pqxx::transaction_base *work,
 		schemaVersion = 13;
 	}
 
+	if(schemaVersion == 13 and targetVer>schemaVersion)
+	{
+		ok = DbUpgradeTables13to14(c, work, 
+			verbose, 
+			parentPrefix, tablePrefix, 
+			errStr);
+		if(!ok) return false;
+
+		ok = DbSetMetaValue(c, work, "schema_version", to_string(14), tablePrefix, errStr);
+		if(!ok) return false;
+		schemaVersion = 14;
+	}
+
+	if(schemaVersion == 14 and targetVer>schemaVersion)
+	{
+		ok = DbUpgradeTables14to15(c, work, 
+			verbose, 
+			parentPrefix, tablePrefix, 
+			errStr);
+		if(!ok) return false;
+
+		ok = DbSetMetaValue(c, work, "schema_version", to_string(15), tablePrefix, errStr);
+		if(!ok) return false;
+		schemaVersion = 15;
+	}
+
 	//Downgrading
+	if(targetVer < 15 and schemaVersion == 15)
+	{
+		ok = DbDowngradeTables15To14(c, work, 
+			verbose, 
+			parentPrefix, tablePrefix, 
+			errStr);
+		if(!ok) return false;
+
+		ok = DbSetMetaValue(c, work, "schema_version", to_string(14), tablePrefix, errStr);
+		if(!ok) return false;
+
+		schemaVersion = 14;
+	}
+
+	if(targetVer < 14 and schemaVersion == 14)
+	{
+		ok = DbDowngradeTables14To13(c, work, 
+			verbose, 
+			parentPrefix, tablePrefix, 
+			errStr);
+		if(!ok) return false;
+
+		ok = DbSetMetaValue(c, work, "schema_version", to_string(13), tablePrefix, errStr);
+		if(!ok) return false;
+
+		schemaVersion = 13;
+	}
+
 	if(targetVer < 13 and schemaVersion == 13)
 	{
 		ok = DbDowngradeTables13To12(c, work, 
@@ -437,43 +754,328 @@ bool DbSetSchemaVersion(pqxx::connection &c, pqxx::transaction_base *work,
 	return true;
 }
 
+//Table name, csv file name and whether the table is large enough to be worth splitting
+//across connections
+struct CopyDataTable
+{
+	const char *table;
+	const char *file;
+	bool large;
+};
+
+const CopyDataTable copyDataTables[] = {
+	{"oldnodes", "oldnodes", true},
+	{"oldways", "oldways", true},
+	{"oldrelations", "oldrelations", false},
+	{"livenodes", "livenodes", true},
+	{"liveways", "liveways", true},
+	{"liverelations", "liverelations", false},
+	{"nodeids", "nodeids", true},
+	{"wayids", "wayids", false},
+	{"relationids", "relationids", false},
+	{"way_mems", "waymems", true},
+	{"relation_mems_n", "relationmems-n", false},
+	{"relation_mems_w", "relationmems-w", false},
+	{"relation_mems_r", "relationmems-r", false}};
+
 bool DbCopyData(pqxx::connection &c, pqxx::transaction_base *work, 
 	int verbose, 
 	const string &filePrefix,
 	const string &tablePrefix, 
 	std::string &errStr)
 {
-	string sql = "COPY "+c.quote_name(tablePrefix+"oldnodes")+" FROM PROGRAM 'zcat "+filePrefix+"oldnodes.csv.gz' WITH (FORMAT 'csv', DELIMITER ',', NULL 'NULL');";
-	bool ok = DbExec(work, sql, errStr, nullptr, verbose); if(!ok) return ok;	
+	bool ok = true;
+	for(size_t i=0; i<sizeof(copyDataTables)/sizeof(CopyDataTable); i++)
+	{
+		const CopyDataTable &t = copyDataTables[i];
+		string sql = "COPY "+c.quote_name(tablePrefix+t.table)+" FROM PROGRAM 'zcat "+filePrefix+t.file+".csv.gz' WITH (FORMAT 'csv', DELIMITER ',', NULL 'NULL');";
+		ok = DbExec(work, sql, errStr, nullptr, verbose); if(!ok) return ok;	
+	}
+	return ok;	
+}
 
-	sql = "COPY "+c.quote_name(tablePrefix+"oldways")+" FROM PROGRAM 'zcat "+filePrefix+"oldways.csv.gz' WITH (FORMAT 'csv', DELIMITER ',', NULL 'NULL');";
-	ok = DbExec(work, sql, errStr, nullptr, verbose); if(!ok) return ok;	
-	sql = "COPY "+c.quote_name(tablePrefix+"oldrelations")+" FROM PROGRAM 'zcat "+filePrefix+"oldrelations.csv.gz' WITH (FORMAT 'csv', DELIMITER ',', NULL 'NULL');";
-	ok = DbExec(work, sql, errStr, nullptr, verbose); if(!ok) return ok;	
+bool DbCopyDataParallel(const std::string &connectionString,
+	pqxx::connection &c,
+	int verbose, 
+	const std::string &filePrefix,
+	const std::string &tablePrefix, 
+	int numWorkers,
+	bool unloggedStaging,
+	std::string &errStr)
+{
+	//Each connection commits independently, so a failure part way through leaves
+	//partially filled tables. Drop and recreate the tables before retrying.
+	if(numWorkers < 1)
+		numWorkers = 1;
 
-	sql = "COPY "+c.quote_name(tablePrefix+"livenodes")+" FROM PROGRAM 'zcat "+filePrefix+"livenodes.csv.gz' WITH (FORMAT 'csv', DELIMITER ',', NULL 'NULL');";
-	ok = DbExec(work, sql, errStr, nullptr, verbose); if(!ok) return ok;	
-	sql = "COPY "+c.quote_name(tablePrefix+"liveways")+" FROM PROGRAM 'zcat "+filePrefix+"liveways.csv.gz' WITH (FORMAT 'csv', DELIMITER ',', NULL 'NULL');";
-	ok = DbExec(work, sql, errStr, nullptr, verbose); if(!ok) return ok;	
-	sql = "COPY "+c.quote_name(tablePrefix+"liverelations")+" FROM PROGRAM 'zcat "+filePrefix+"liverelations.csv.gz' WITH (FORMAT 'csv', DELIMITER ',', NULL 'NULL');";
-	ok = DbExec(work, sql, errStr, nullptr, verbose); if(!ok) return ok;	
+	std::vector<class DbParallelJob> jobs;
+	for(size_t i=0; i<sizeof(copyDataTables)/sizeof(CopyDataTable); i++)
+	{
+		const CopyDataTable &t = copyDataTables[i];
+		string table = c.quote_name(tablePrefix+t.table);
+		string fina = filePrefix+t.file+".csv.gz";
+
+		//Size is only known if the csv files are also visible from this host
+		int64_t fileSize = 0;
+		boost::system::error_code ec;
+		boost::uintmax_t fs = file_size(fina, ec);
+		if(!ec)
+			fileSize = fs;
+
+		//Large tables are split between workers at gzip member boundaries, so each worker
+		//decompresses only its own members. This needs the file to be visible from this host
+		//and written with indexed members, otherwise the table is loaded in one piece.
+		std::vector<uint64_t> offsets;
+		if(t.large and numWorkers > 1)
+		{
+			std::ifstream in(fina, std::ios::binary);
+			if(!in or !DecodeGzipBlocks::MemberOffsets(in, offsets))
+				offsets.clear();
+		}
 
-	sql = "COPY "+c.quote_name(tablePrefix+"nodeids")+" FROM PROGRAM 'zcat "+filePrefix+"nodeids.csv.gz' WITH (FORMAT 'csv', DELIMITER ',', NULL 'NULL');";
-	ok = DbExec(work, sql, errStr, nullptr, verbose); if(!ok) return ok;	
-	sql = "COPY "+c.quote_name(tablePrefix+"wayids")+" FROM PROGRAM 'zcat "+filePrefix+"wayids.csv.gz' WITH (FORMAT 'csv', DELIMITER ',', NULL 'NULL');";
-	ok = DbExec(work, sql, errStr, nullptr, verbose); if(!ok) return ok;	
-	sql = "COPY "+c.quote_name(tablePrefix+"relationids")+" FROM PROGRAM 'zcat "+filePrefix+"relationids.csv.gz' WITH (FORMAT 'csv', DELIMITER ',', NULL 'NULL');";
-	ok = DbExec(work, sql, errStr, nullptr, verbose); if(!ok) return ok;	
+		if(offsets.size() < 3)
+		{
+			std::vector<std::string> sql;
+			sql.push_back("COPY "+table+" FROM PROGRAM "+c.quote("zcat "+fina)+" WITH (FORMAT 'csv', DELIMITER ',', NULL 'NULL');");
+			jobs.push_back(DbParallelJob(t.table, sql, fileSize));
+			continue;
+		}
 
-	sql = "COPY "+c.quote_name(tablePrefix+"way_mems")+" FROM PROGRAM 'zcat "+filePrefix+"waymems.csv.gz' WITH (FORMAT 'csv', DELIMITER ',', NULL 'NULL');";
-	ok = DbExec(work, sql, errStr, nullptr, verbose); if(!ok) return ok;	
-	sql = "COPY "+c.quote_name(tablePrefix+"relation_mems_n")+" FROM PROGRAM 'zcat "+filePrefix+"relationmems-n.csv.gz' WITH (FORMAT 'csv', DELIMITER ',', NULL 'NULL');";
-	ok = DbExec(work, sql, errStr, nullptr, verbose); if(!ok) return ok;	
-	sql = "COPY "+c.quote_name(tablePrefix+"relation_mems_w")+" FROM PROGRAM 'zcat "+filePrefix+"relationmems-w.csv.gz' WITH (FORMAT 'csv', DELIMITER ',', NULL 'NULL');";
-	ok = DbExec(work, sql, errStr, nullptr, verbose); if(!ok) return ok;	
-	sql = "COPY "+c.quote_name(tablePrefix+"relation_mems_r")+" FROM PROGRAM 'zcat "+filePrefix+"relationmems-r.csv.gz' WITH (FORMAT 'csv', DELIMITER ',', NULL 'NULL');";
-	ok = DbExec(work, sql, errStr, nullptr, verbose); 
-	return ok;	
+		//Contiguous runs of members of about the same compressed size
+		size_t numMembers = offsets.size() - 1;
+		size_t chunks = std::min((size_t)numWorkers, numMembers);
+		uint64_t total = offsets[numMembers];
+		size_t startMember = 0;
+		for(size_t j=0; j<chunks; j++)
+		{
+			size_t endMember = startMember + 1;
+			uint64_t target = total * (j+1) / chunks;
+			while(endMember < numMembers and offsets[endMember] < target and numMembers - endMember > chunks - j - 1)
+				endMember ++;
+			if(j == chunks - 1)
+				endMember = numMembers;
+
+			uint64_t start = offsets[startMember];
+			uint64_t len = offsets[endMember] - start;
+			stringstream program;
+			program << "tail -c +" << (start+1) << " " << fina << " | head -c " << len << " | zcat";
+			stringstream name;
+			name << t.table << " part " << (j+1) << "/" << chunks;
+
+			std::vector<std::string> sql;
+			sql.push_back("COPY "+table+" FROM PROGRAM "+c.quote(program.str())+" WITH (FORMAT 'csv', DELIMITER ',', NULL 'NULL');");
+			jobs.push_back(DbParallelJob(name.str(), sql, len));
+			startMember = endMember;
+		}
+	}
+
+	//Largest first, so the big tables don't end up running alone at the end
+	std::stable_sort(jobs.begin(), jobs.end(), [](const DbParallelJob &a, const DbParallelJob &b) {
+		return a.sizeEstimate > b.sizeEstimate;});
+
+	//Persistence is set on each partition, as partitioned tables have no storage of their own
+	std::vector<string> stageTables;
+	if(unloggedStaging)
+	{
+		pqxx::connection conn(connectionString);
+		pqxx::nontransaction w(conn);
+		for(size_t i=0; i<sizeof(copyDataTables)/sizeof(CopyDataTable); i++)
+		{
+			string table = tablePrefix+copyDataTables[i].table;
+			std::vector<string> partitions;
+			DbGetPartitions(conn, &w, table, partitions);
+			if(partitions.size() == 0)
+				partitions.push_back(table);
+			stageTables.insert(stageTables.end(), partitions.begin(), partitions.end());
+		}
+
+		std::vector<class DbParallelJob> stageJobs;
+		for(size_t i=0; i<stageTables.size(); i++)
+		{
+			std::vector<std::string> sql;
+			sql.push_back("ALTER TABLE "+c.quote_name(stageTables[i])+" SET UNLOGGED;");
+			stageJobs.push_back(DbParallelJob("unlogged "+stageTables[i], sql));
+		}
+		bool ok = DbRunParallelJobs(connectionString, 1, stageJobs, verbose, errStr);
+		if(!ok) return ok;
+	}
+
+	bool ok = DbRunParallelJobs(connectionString, numWorkers, jobs, verbose, errStr);
+	if(!ok) return ok;
+
+	if(unloggedStaging)
+	{
+		//Each table is rewritten to the WAL in one pass, which is much cheaper than
+		//logging each row as it was copied
+		std::vector<class DbParallelJob> stageJobs;
+		for(size_t i=0; i<stageTables.size(); i++)
+		{
+			std::vector<std::string> sql;
+			sql.push_back("ALTER TABLE "+c.quote_name(stageTables[i])+" SET LOGGED;");
+			stageJobs.push_back(DbParallelJob("logged "+stageTables[i], sql));
+		}
+		ok = DbRunParallelJobs(connectionString, numWorkers, stageJobs, verbose, errStr);
+	}
+	return ok;
+}
+
+void AppendCopyTextChar(std::string &out, char ch)
+{
+	switch(ch)
+	{
+	case '\\': out += "\\\\"; break;
+	case '\t': out += "\\t"; break;
+	case '\n': out += "\\n"; break;
+	case '\r': out += "\\r"; break;
+	default: out += ch;
+	}
+}
+
+void CsvToCopyText(std::string &block)
+{
+	//Convert csv lines, as written by osm2csv, to the COPY text format that stream_to expects.
+	//Unquoted NULL becomes \N. Quoted fields must not contain line breaks.
+	string out;
+	out.reserve(block.size() + block.size() / 8);
+	size_t i = 0;
+	const size_t n = block.size();
+	while(i < n)
+	{
+		if(block[i] == '"')
+		{
+			i++;
+			while(i < n)
+			{
+				char ch = block[i];
+				if(ch == '"')
+				{
+					if(i+1 < n and block[i+1] == '"')
+					{
+						out += '"';
+						i += 2;
+						continue;
+					}
+					i++;
+					break;
+				}
+				AppendCopyTextChar(out, ch);
+				i++;
+			}
+		}
+		else
+		{
+			size_t end = block.find_first_of(",\n", i);
+			if(end == string::npos) end = n;
+			if(end - i == 4 and block.compare(i, 4, "NULL") == 0)
+				out += "\\N";
+			else
+				for(size_t j=i; j<end; j++)
+					AppendCopyTextChar(out, block[j]);
+			i = end;
+		}
+
+		if(i >= n) break;
+		if(block[i] == ',')
+			out += '\t';
+		else if(block[i] == '\n')
+			out += '\n';
+		i++;
+	}
+	block.swap(out);
+}
+
+void WriteCopyTextBlock(pqxxcopystream &stream, std::string &block, size_t &rows)
+{
+	for(size_t i=0; i<block.size(); i++)
+		if(block[i] == '\n') rows++;
+	if(block.size() > 0 and block[block.size()-1] == '\n')
+		block.resize(block.size()-1);
+	if(block.size() == 0)
+		return;
+	//The stream adds the final line break. Lines within the block go through as they are.
+	stream.write_raw_line(block);
+}
+
+bool DbCopyFileFromClient(pqxx::connection &conn, class DbParallelJob &job,
+	const std::string &fina, 
+	const std::string &tableName,
+	int decodeThreads)
+{
+	std::ifstream in(fina, std::ios::binary);
+	if(!in)
+	{
+		job.errStr = "Error opening "+fina;
+		return false;
+	}
+
+	pqxx::work work(conn);
+	pqxxcopystream stream(work, tableName);
+
+	if(DecodeGzipBlocks::IsIndexed(in))
+	{
+		class DecodeGzipBlocks dec(in, decodeThreads, CsvToCopyText);
+		string block;
+		while(dec.NextBlock(block))
+			WriteCopyTextBlock(stream, block, job.rowsAffected);
+	}
+	else
+	{
+		//Plain gzip can only be decompressed sequentially, in this thread
+		class DecodeGzip dec(*in.rdbuf());
+		std::istream decStream(&dec);
+		string block, line;
+		while(std::getline(decStream, line))
+		{
+			block += line;
+			block += '\n';
+			if(block.size() < 4*1024*1024)
+				continue;
+			CsvToCopyText(block);
+			WriteCopyTextBlock(stream, block, job.rowsAffected);
+			block.clear();
+		}
+		CsvToCopyText(block);
+		WriteCopyTextBlock(stream, block, job.rowsAffected);
+	}
+
+	stream.complete();
+	work.commit();
+	return true;
+}
+
+bool DbCopyDataFromClient(const std::string &connectionString,
+	int verbose, 
+	const std::string &filePrefix,
+	const std::string &tablePrefix, 
+	int numWorkers,
+	int decodeThreads,
+	std::string &errStr)
+{
+	//Each table is copied in its own transaction, on one of numWorkers connections. Csv files
+	//written in indexed blocks by osm2csv are decompressed on decodeThreads threads per table.
+	std::vector<class DbParallelJob> jobs;
+	for(size_t i=0; i<sizeof(copyDataTables)/sizeof(CopyDataTable); i++)
+	{
+		const CopyDataTable &t = copyDataTables[i];
+		string tableName = tablePrefix+t.table;
+		string fina = filePrefix+t.file+".csv.gz";
+
+		boost::system::error_code ec;
+		boost::uintmax_t fs = file_size(fina, ec);
+		if(ec)
+		{
+			errStr = "Cannot read "+fina;
+			return false;
+		}
+
+		jobs.push_back(DbParallelJob(t.table, [fina, tableName, decodeThreads](pqxx::connection &conn, class DbParallelJob &job) {
+			return DbCopyFileFromClient(conn, job, fina, tableName, decodeThreads);}, fs));
+	}
+
+	std::stable_sort(jobs.begin(), jobs.end(), [](const DbParallelJob &a, const DbParallelJob &b) {
+		return a.sizeEstimate > b.sizeEstimate;});
+
+	return DbRunParallelJobs(connectionString, numWorkers, jobs, verbose, errStr);
 }
 
 bool DbCreateIndices(pqxx::connection &c, pqxx::transaction_base *work, 
@@ -646,6 +1248,189 @@ bool DbCreateIndices(pqxx::connection &c, pqxx::transaction_base *work,
 	return ok;
 }
 
+//Indices built by DbCreateIndicesParallel. Primary keys are built as unique indices and attached
+//afterwards, since ADD PRIMARY KEY would lock out the other index builds on the same table.
+struct IndexDef
+{
+	const char *name;
+	const char *table;
+	const char *method;
+	const char *columns;
+	bool primaryKey;
+};
+
+const IndexDef parallelIndexDefs[] = {
+	{"oldnodes_pkey", "oldnodes", "btree", "id, version", true},
+	{"oldways_pkey", "oldways", "btree", "id, version", true},
+	{"oldrelations_pkey", "oldrelations", "btree", "id, version", true},
+	{"livenodes_pkey", "livenodes", "btree", "id", true},
+	{"liveways_pkey", "liveways", "btree", "id", true},
+	{"liverelations_pkey", "liverelations", "btree", "id", true},
+	{"nodeids_pkey", "nodeids", "btree", "id", true},
+	{"wayids_pkey", "wayids", "btree", "id", true},
+	{"relationids_pkey", "relationids", "btree", "id", true},
+	{"usernames_pkey", "usernames", "btree", "uid", true},
+	{"livenodes_gix", "livenodes", "gist", "geom", false},
+	{"oldnodes_gix", "oldnodes", "gist", "geom", false},
+	{"changesets_gix", "changesets", "gist", "geom", false},
+	{"way_mems_mids", "way_mems", "btree", "member", false},
+	{"relation_mems_n_mids", "relation_mems_n", "btree", "member", false},
+	{"relation_mems_w_mids", "relation_mems_w", "btree", "member", false},
+	{"relation_mems_r_mids", "relation_mems_r", "btree", "member", false},
+	{"oldnodes_ts2", "oldnodes", "btree", "timestamp", false},
+	{"oldways_ts2", "oldways", "btree", "timestamp", false},
+	{"oldrelations_ts2", "oldrelations", "btree", "timestamp", false},
+	{"livenodes_ts", "livenodes", "btree", "timestamp", false},
+	{"liveways_ts", "liveways", "btree", "timestamp", false},
+	{"liverelations_ts", "liverelations", "btree", "timestamp", false},
+	{"oldnodes_uid2", "oldnodes", "brin", "uid", false},
+	{"oldways_uid2", "oldways", "brin", "uid", false},
+	{"oldrelations_uid2", "oldrelations", "brin", "uid", false},
+	{"livenodes_uid", "livenodes", "brin", "uid", false},
+	{"liveways_uid", "liveways", "brin", "uid", false},
+	{"liverelations_uid", "liverelations", "brin", "uid", false},
+	{"oldnodes_cs2", "oldnodes", "btree", "changeset", false},
+	{"oldways_cs2", "oldways", "btree", "changeset", false},
+	{"oldrelations_cs2", "oldrelations", "btree", "changeset", false},
+	{"livenodes_cs", "livenodes", "btree", "changeset", false},
+	{"liveways_cs", "liveways", "btree", "changeset", false},
+	{"liverelations_cs", "liverelations", "btree", "changeset", false},
+	{"changesets_uidx", "changesets", "btree", "uid", false},
+	{"changesets_open_timestampx", "changesets", "btree", "open_timestamp", false},
+	{"changesets_close_timestampx", "changesets", "btree", "close_timestamp", false},
+	{"changesets_is_openx", "changesets", "btree", "is_open", false}};
+
+void DbReportIndexProgress(pqxx::connection &conn)
+{
+	pqxx::nontransaction work(conn);
+	pqxx::result r = work.exec("SELECT index_relid::regclass AS idx, phase, blocks_done, blocks_total, tuples_done, tuples_total FROM pg_stat_progress_create_index;");
+	for (pqxx::result::const_iterator c = r.begin(); c != r.end(); ++c)
+	{
+		int64_t blocksTotal = c[3].as<int64_t>(0), tuplesTotal = c[5].as<int64_t>(0);
+		cout << "  " << c[0].as<string>("") << ": " << c[1].as<string>("");
+		if(blocksTotal > 0)
+			cout << ", blocks " << c[2].as<int64_t>(0) << "/" << blocksTotal;
+		if(tuplesTotal > 0)
+			cout << ", tuples " << c[4].as<int64_t>(0) << "/" << tuplesTotal;
+		cout << endl;
+	}
+}
+
+bool DbCreateIndicesParallel(const std::string &connectionString,
+	pqxx::connection &c, pqxx::transaction_base *work, 
+	int verbose, 
+	const std::string &tablePrefix, 
+	int numWorkers,
+	const std::string &maintenanceWorkMem,
+	int parallelMaintenanceWorkers,
+	std::string &errStr)
+{
+	int majorVer=0, minorVer=0;
+	DbGetVersion(c, work, majorVer, minorVer);
+	if(majorVer < 10)
+	{
+		errStr = "Parallel index build requires PostgreSQL 10 or later";
+		return false;
+	}
+
+	std::vector<string> jobSetup;
+	if(maintenanceWorkMem.size() > 0)
+		jobSetup.push_back("SET maintenance_work_mem = "+c.quote(maintenanceWorkMem)+";");
+	if(majorVer >= 11 and parallelMaintenanceWorkers >= 0)
+	{
+		stringstream ss;
+		ss << "SET max_parallel_maintenance_workers = " << parallelMaintenanceWorkers << ";";
+		jobSetup.push_back(ss.str());
+	}
+
+	std::vector<class DbParallelJob> jobs;
+	std::vector<string> attachPrimaryKeys;
+	std::vector<string> parentIndices;
+	std::set<string> vacuumTables;
+	for(size_t i=0; i<sizeof(parallelIndexDefs)/sizeof(IndexDef); i++)
+	{
+		const IndexDef &d = parallelIndexDefs[i];
+		string table = tablePrefix+d.table;
+		string index = tablePrefix+d.name;
+		if(d.primaryKey and DbCountPrimaryKeyCols(c, work, table) > 0)
+			continue;
+		if(!d.primaryKey and DbCheckIndexExists(c, work, index))
+			continue;
+
+		//Partitioned tables get a job for each partition. Creating the index on the parent 
+		//afterwards attaches the partition indices, rather than building them again.
+		std::vector<string> partitions;
+		DbGetPartitions(c, work, table, partitions);
+		if(partitions.size() > 0)
+		{
+			if(d.primaryKey)
+				parentIndices.push_back("ALTER TABLE "+c.quote_name(table)+" ADD PRIMARY KEY ("+d.columns+");");
+			else
+				parentIndices.push_back("CREATE INDEX "+c.quote_name(index)+" ON "+c.quote_name(table)+" USING "+d.method+" ("+d.columns+");");
+		}
+		else
+			partitions.push_back(table);
+
+		for(size_t j=0; j<partitions.size(); j++)
+		{
+			string partIndex = index + partitions[j].substr(table.size());
+			if(d.primaryKey)
+			{
+				if(DbCountPrimaryKeyCols(c, work, partitions[j]) > 0)
+					continue;
+				attachPrimaryKeys.push_back("ALTER TABLE "+c.quote_name(partitions[j])+" ADD PRIMARY KEY USING INDEX "+c.quote_name(partIndex)+";");
+			}
+			if(DbCheckIndexExists(c, work, partIndex))
+				continue;
+
+			std::vector<string> sql = jobSetup;
+			sql.push_back(string("CREATE ")+(d.primaryKey ? "UNIQUE " : "")+"INDEX "+c.quote_name(partIndex)+" ON "
+				+c.quote_name(partitions[j])+" USING "+d.method+" ("+d.columns+");");
+
+			pqxx::result r = work->exec("SELECT pg_relation_size("+c.quote(partitions[j])+");");
+			int64_t sizeEstimate = r[0][0].as<int64_t>();
+			//GiST builds are much slower than btree for the same amount of data; BRIN is quick
+			if(string(d.method) == "gist")
+			{
+				sizeEstimate *= 8;
+				vacuumTables.insert(partitions[j]);
+			}
+			else if(string(d.method) == "brin")
+				sizeEstimate /= 8;
+
+			jobs.push_back(DbParallelJob(partIndex, sql, sizeEstimate));
+		}
+	}
+
+	std::stable_sort(jobs.begin(), jobs.end(), [](const DbParallelJob &a, const DbParallelJob &b) {
+		return a.sizeEstimate > b.sizeEstimate;});
+
+	std::function<void(pqxx::connection &)> progress;
+	if(verbose >= 1 and majorVer >= 12)
+		progress = DbReportIndexProgress;
+	bool ok = DbRunParallelJobs(connectionString, numWorkers, jobs, verbose, errStr, progress);
+	if(!ok) return ok;
+
+	for(size_t i=0; i<attachPrimaryKeys.size(); i++)
+	{
+		ok = DbExec(work, attachPrimaryKeys[i], errStr, nullptr, verbose); if(!ok) return ok;
+	}
+	for(size_t i=0; i<parentIndices.size(); i++)
+	{
+		ok = DbExec(work, parentIndices[i], errStr, nullptr, verbose); if(!ok) return ok;
+	}
+
+	//Update planner statistics for the spatial columns, as the sequential version does
+	std::vector<class DbParallelJob> vacuumJobs;
+	for(auto it=vacuumTables.begin(); it!=vacuumTables.end(); it++)
+	{
+		std::vector<string> sql;
+		sql.push_back("VACUUM ANALYZE "+c.quote_name(*it)+"(geom);");
+		vacuumJobs.push_back(DbParallelJob("vacuum "+*it, sql));
+	}
+	return DbRunParallelJobs(connectionString, numWorkers, vacuumJobs, verbose, errStr);
+}
+
 bool DbCreateBboxIndices(pqxx::connection &c, pqxx::transaction_base *work, 
 	int verbose, 
 	const string &tablePrefix, 
@@ -710,6 +1495,155 @@ bool DbDropBboxIndices(pqxx::connection &c, pqxx::transaction_base *work,
 	return ok;
 }
 
+//Index names can't hold every character a key can
+string TagIndexKeyName(const std::string &key)
+{
+	string name;
+	for(size_t i=0; i<key.size(); i++)
+		name += isalnum((unsigned char)key[i]) ? key[i] : '_';
+	return name;
+}
+
+bool DbCreateTagIndices(pqxx::connection &c, pqxx::transaction_base *work, 
+	int verbose, 
+	const string &tablePrefix, 
+	const std::vector<std::string> &popularKeys,
+	std::string &errStr)
+{
+	bool ok = true;
+	string sql;
+	string ine = "IF NOT EXISTS ";
+	string objTypes[] = {"node", "way", "relation"};
+
+	for(int i=0; i<3; i++)
+	{
+		string table = tablePrefix+"live"+objTypes[i]+"s";
+		string extentCol = objTypes[i] == "node" ? "geom" : "bbox";
+
+		//Exact key=value matches with @>. jsonb_path_ops is smaller and faster than the
+		//default operator class, but doesn't support the ? operator.
+		if(!DbCheckIndexExists(c, work, table+"_gin_tags"))
+		{
+			sql = "CREATE INDEX "+ine+c.quote_name(table+"_gin_tags")+" ON "+c.quote_name(table)+" USING GIN (tags jsonb_path_ops);";
+			ok = DbExec(work, sql, errStr, nullptr, verbose); if(!ok) return ok;
+		}
+
+		//Popular keys get a spatial index of the objects that have them, which is used for
+		//queries on the key alone as well as with a value
+		for(size_t j=0; j<popularKeys.size(); j++)
+		{
+			string indexName = table+"_gix_key_"+TagIndexKeyName(popularKeys[j]);
+			if(DbCheckIndexExists(c, work, indexName))
+				continue;
+			sql = "CREATE INDEX "+ine+c.quote_name(indexName)+" ON "+c.quote_name(table)+" USING GIST ("+extentCol+") WHERE tags ? "+c.quote(popularKeys[j])+";";
+			ok = DbExec(work, sql, errStr, nullptr, verbose); if(!ok) return ok;
+		}
+
+		sql = "ANALYZE "+c.quote_name(table)+";";
+		ok = DbExec(work, sql, errStr, nullptr, verbose); if(!ok) return ok;
+	}
+
+	return ok;
+}
+
+bool DbDropTagIndices(pqxx::connection &c, pqxx::transaction_base *work, 
+	int verbose, 
+	const string &tablePrefix, 
+	std::string &errStr)
+{
+	bool ok = true;
+	string objTypes[] = {"node", "way", "relation"};
+
+	for(int i=0; i<3; i++)
+	{
+		string table = tablePrefix+"live"+objTypes[i]+"s";
+		string sql = "DROP INDEX IF EXISTS "+c.quote_name(table+"_gin_tags")+";";
+		ok = DbExec(work, sql, errStr, nullptr, verbose); if(!ok) return ok;
+
+		//Find the partial indices of each popular key
+		sql = "SELECT indexname FROM pg_indexes WHERE schemaname = 'public' AND tablename = "+c.quote(table)
+			+" AND left(indexname, "+to_string(table.size()+9)+") = "+c.quote(table+"_gix_key_")+";";
+		pqxx::result r = work->exec(sql);
+		for (unsigned int rownum=0; rownum < r.size(); ++rownum)
+		{
+			sql = "DROP INDEX IF EXISTS "+c.quote_name(r[rownum][0].as<string>())+";";
+			ok = DbExec(work, sql, errStr, nullptr, verbose); if(!ok) return ok;
+		}
+	}
+
+	return ok;
+}
+
+//Quadtile (geohash) keys of each object's location. Rewriting a table in this order puts
+//nearby objects on nearby pages, so a bbox query reads a few runs of pages rather than
+//pages scattered over the whole table.
+struct SpatialOrderDef
+{
+	const char *table;
+	const char *key;
+};
+
+const SpatialOrderDef spatialOrderDefs[] = {
+	{"livenodes", "ST_GeoHash(geom, 10)"},
+	{"liveways", "ST_GeoHash(ST_Centroid(bbox), 10)"}};
+
+bool DbClusterSpatially(const std::string &connectionString,
+	pqxx::connection &c, pqxx::transaction_base *work, 
+	int verbose, 
+	const std::string &tablePrefix, 
+	int numWorkers,
+	std::string &errStr)
+{
+	std::vector<class DbParallelJob> jobs;
+	std::vector<string> parentIndices;
+	for(size_t i=0; i<sizeof(spatialOrderDefs)/sizeof(SpatialOrderDef); i++)
+	{
+		const SpatialOrderDef &d = spatialOrderDefs[i];
+		string table = tablePrefix+d.table;
+		string index = table+"_spatial";
+
+		//Each partition is clustered on its own, as partitioned tables can't be clustered
+		//as a whole. The index on the parent then attaches the partition indices.
+		std::vector<string> partitions;
+		DbGetPartitions(c, work, table, partitions);
+		if(partitions.size() > 0)
+		{
+			if(!DbCheckIndexExists(c, work, index))
+				parentIndices.push_back("CREATE INDEX "+c.quote_name(index)+" ON "+c.quote_name(table)+" (("+d.key+"));");
+		}
+		else
+			partitions.push_back(table);
+
+		for(size_t j=0; j<partitions.size(); j++)
+		{
+			string partIndex = index + partitions[j].substr(table.size());
+			std::vector<string> sql;
+			if(!DbCheckIndexExists(c, work, partIndex))
+				sql.push_back("CREATE INDEX "+c.quote_name(partIndex)+" ON "+c.quote_name(partitions[j])+" (("+d.key+"));");
+			//Marking the index lets a later plain CLUSTER restore the order after edits
+			sql.push_back("ALTER TABLE "+c.quote_name(partitions[j])+" CLUSTER ON "+c.quote_name(partIndex)+";");
+			sql.push_back("CLUSTER "+c.quote_name(partitions[j])+";");
+			sql.push_back("ANALYZE "+c.quote_name(partitions[j])+";");
+
+			pqxx::result r = work->exec("SELECT pg_relation_size("+c.quote(partitions[j])+");");
+			jobs.push_back(DbParallelJob("cluster "+partitions[j], sql, r[0][0].as<int64_t>()));
+		}
+	}
+
+	std::stable_sort(jobs.begin(), jobs.end(), [](const DbParallelJob &a, const DbParallelJob &b) {
+		return a.sizeEstimate > b.sizeEstimate;});
+
+	bool ok = DbRunParallelJobs(connectionString, numWorkers, jobs, verbose, errStr);
+	if(!ok) return ok;
+
+	for(size_t i=0; i<parentIndices.size(); i++)
+	{
+		ok = DbExec(work, parentIndices[i], errStr, nullptr, verbose); if(!ok) return ok;
+	}
+
+	return DbSetMetaValue(c, work, "spatial_order", "geohash", tablePrefix, errStr);
+}
+
 bool DbRefreshMaxIdsOfType(pqxx::connection &c, pqxx::transaction_base *work, 
 	int verbose, 
 	const string &tablePrefix, 
@@ -820,46 +1754,42 @@ bool DbRefreshMaxChangesetUid(pqxx::connection &c, pqxx::transaction_base *work,
 	return true;
 }
 
-bool ExtractUsernamesFromTable(pqxx::connection &c, pqxx::transaction_base *work, 
-	int verbose, 
-	const std::string &tableName, 
+const char *usernameSourceTables[] = {"oldnodes", "oldways", "oldrelations", "livenodes", "liveways", "liverelations"};
+
+//Latest username of each uid in a table, worked out by the server
+std::string UsernameSelectSql(pqxx::connection &c, const std::string &tableName)
+{
+	return "SELECT DISTINCT ON (uid) uid, timestamp, username FROM "+c.quote_name(tableName)
+		+" WHERE uid IS NOT NULL AND username IS NOT NULL ORDER BY uid, timestamp DESC NULLS LAST";
+}
+
+//Merge the staged usernames into the usernames table, keeping the most recent
+void UsernameUpsertSql(pqxx::connection &c, pqxx::transaction_base *work, 
 	const std::string &tablePrefix, 
-	std::string &errStr)
+	const std::string &stageTable,
+	std::vector<std::string> &sql)
 {
-	stringstream sql;
-	sql << "SELECT uid, username FROM " << tableName << ";";
+	string usernames = c.quote_name(tablePrefix+"usernames");
+	string latest = UsernameSelectSql(c, stageTable);
+	string newer = "(u.timestamp IS NULL OR s.timestamp >= u.timestamp)";
 
-	int step = 100;
-	pqxx::icursorstream cursor( *work, sql.str(), "buildusernames", step );	
-	DbUpsertUsernamePrepare(c, work, tablePrefix);
-	set<int> foundUids;
+	int majorVer=0, minorVer=0;
+	DbGetVersion(c, work, majorVer, minorVer);
+	bool ocdnSupported = !(majorVer < 9 || (majorVer == 9 && minorVer <= 4));
 
-	while(true)
+	if(ocdnSupported and DbCountPrimaryKeyCols(c, work, tablePrefix+"usernames") > 0)
 	{
-		pqxx::result rows;
-		cursor.get(rows);
-		if ( rows.empty() )
-			break;
-
-		int uidCol = rows.column_number("uid");
-		int usernameCol = rows.column_number("username");
-
-		for (pqxx::result::const_iterator ci = rows.begin(); ci != rows.end(); ++ci) 
-		{
-			if (ci[uidCol].is_null() or ci[usernameCol].is_null())
-				continue;
-			
-			int64_t uid = ci[uidCol].as<int64_t>();
-			if(foundUids.find(uid) != foundUids.end()) continue; //Skip repeatedly inserting the same data
-			string username = ci[usernameCol].as<string>();
-			foundUids.insert(uid);
-
-			DbUpsertUsername(c, work, tablePrefix, 
-				uid, username);
-		}
+		sql.push_back("INSERT INTO "+usernames+" AS u (uid, timestamp, username) "+latest
+			+" ON CONFLICT (uid) DO UPDATE SET timestamp = EXCLUDED.timestamp, username = EXCLUDED.username"
+			+" WHERE u.timestamp IS NULL OR EXCLUDED.timestamp >= u.timestamp;");
+	}
+	else
+	{
+		sql.push_back("UPDATE "+usernames+" AS u SET timestamp = s.timestamp, username = s.username FROM ("
+			+latest+") AS s WHERE u.uid = s.uid AND "+newer+";");
+		sql.push_back("INSERT INTO "+usernames+" (uid, timestamp, username) SELECT s.uid, s.timestamp, s.username FROM ("
+			+latest+") AS s WHERE NOT EXISTS (SELECT 1 FROM "+usernames+" AS u WHERE u.uid = s.uid);");
 	}
-
-	return true;
 }
 
 bool ExtractUsernamesFromTableSet(pqxx::connection &c, pqxx::transaction_base *work, 
@@ -867,21 +1797,25 @@ bool ExtractUsernamesFromTableSet(pqxx::connection &c, pqxx::transaction_base *w
 	const std::string &tablePrefix, 
 	std::string &errStr)
 {
-	string oNodeTable = c.quote_name(tablePrefix + "oldnodes");
-	string oWayTable = c.quote_name(tablePrefix + "oldways");
-	string oRelationTable = c.quote_name(tablePrefix + "oldrelations");
-	string lNodeTable = c.quote_name(tablePrefix + "livenodes");
-	string lWayTable = c.quote_name(tablePrefix + "liveways");
-	string lRelationTable = c.quote_name(tablePrefix + "liverelations");
-
-	ExtractUsernamesFromTable(c, work, verbose, oNodeTable, tablePrefix, errStr);
-	ExtractUsernamesFromTable(c, work, verbose, oWayTable, tablePrefix, errStr);
-	ExtractUsernamesFromTable(c, work, verbose, oRelationTable, tablePrefix, errStr);
-	ExtractUsernamesFromTable(c, work, verbose, lNodeTable, tablePrefix, errStr);
-	ExtractUsernamesFromTable(c, work, verbose, lWayTable, tablePrefix, errStr);
-	ExtractUsernamesFromTable(c, work, verbose, lRelationTable, tablePrefix, errStr);
+	string stageTable = tablePrefix+"usernames_stage";
+	string sql = "CREATE TEMP TABLE "+c.quote_name(stageTable)+" (uid INTEGER, timestamp BIGINT, username TEXT);";
+	bool ok = DbExec(work, sql, errStr, nullptr, verbose); if(!ok) return ok;
 
-	return true;
+	for(size_t i=0; i<sizeof(usernameSourceTables)/sizeof(const char *); i++)
+	{
+		sql = "INSERT INTO "+c.quote_name(stageTable)+" "+UsernameSelectSql(c, tablePrefix+usernameSourceTables[i])+";";
+		ok = DbExec(work, sql, errStr, nullptr, verbose); if(!ok) return ok;
+	}
+
+	std::vector<string> upsertSql;
+	UsernameUpsertSql(c, work, tablePrefix, stageTable, upsertSql);
+	for(size_t i=0; i<upsertSql.size(); i++)
+	{
+		ok = DbExec(work, upsertSql[i], errStr, nullptr, verbose); if(!ok) return ok;
+	}
+
+	sql = "DROP TABLE "+c.quote_name(stageTable)+";";
+	return DbExec(work, sql, errStr, nullptr, verbose);
 }
 
 bool DbGenerateUsernameTable(pqxx::connection &c, pqxx::transaction_base *work, 
@@ -891,130 +1825,58 @@ bool DbGenerateUsernameTable(pqxx::connection &c, pqxx::transaction_base *work,
 	const std::string &tableTestPrefix, 
 	std::string &errStr)
 {
-	ExtractUsernamesFromTableSet(c, work, verbose, tableStaticPrefix, errStr);
-	ExtractUsernamesFromTableSet(c, work, verbose, tableModPrefix, errStr);
-	ExtractUsernamesFromTableSet(c, work, verbose, tableTestPrefix, errStr);
-
-	return true;
+	bool ok = ExtractUsernamesFromTableSet(c, work, verbose, tableStaticPrefix, errStr);
+	if(!ok) return ok;
+	ok = ExtractUsernamesFromTableSet(c, work, verbose, tableModPrefix, errStr);
+	if(!ok) return ok;
+	return ExtractUsernamesFromTableSet(c, work, verbose, tableTestPrefix, errStr);
 }
 
-bool DbApplyDiffs(pqxx::connection &c, pqxx::transaction_base *work, 
+bool DbGenerateUsernameTableParallel(const std::string &connectionString,
+	pqxx::connection &c, pqxx::transaction_base *work, 
 	int verbose, 
 	const std::string &tableStaticPrefix, 
 	const std::string &tableModPrefix, 
 	const std::string &tableTestPrefix, 
-	const std::string &diffPath, 
-	class PgCommon *pgCommon,
+	int numWorkers,
 	std::string &errStr)
 {
-	path p (diffPath);
-
-	if(is_directory(p))
-	{
-		//Recusively walk through directories
-		vector<path> result;
-		copy(directory_iterator(p), directory_iterator(),
-			back_inserter(result));
-		sort(result.begin(), result.end());
-		for (vector<path>::const_iterator it (result.begin()); it != result.end(); ++it)
-		{
-			//cout << "   " << *it << endl;
-
-			string pathStr(it->native());
-			bool ok = DbApplyDiffs(c, work, 
-				verbose, 
-				tableStaticPrefix, 
-				tableModPrefix, 
-				tableTestPrefix, 
-				pathStr, 
-				pgCommon,
-				errStr);
-			if(!ok) return false;
-		}
-	}
-	else
+	//Temporary tables are not shared between connections, so stage in unlogged tables
+	string prefixes[] = {tableStaticPrefix, tableModPrefix, tableTestPrefix};
+	std::vector<class DbParallelJob> extractJobs, upsertJobs;
+	bool ok = true;
+	for(size_t i=0; i<sizeof(prefixes)/sizeof(string); i++)
 	{
-		if (extension(diffPath) == ".gz")
-		{
-			cout << "   " << diffPath << endl;
-			std::string xmlData;
-			DecodeGzipQuickFromFilename(diffPath, xmlData);
-			
-			shared_ptr<class OsmChange> data(new class OsmChange());
-			std::stringbuf sb(xmlData);
-			LoadFromOsmChangeXml(sb, data.get());
-
-			for(size_t i=0; i<data->blocks.size(); i++)
-			{
-				cout << data->actions[i] << endl;
-				class OsmData &block = data->blocks[i];
-
-				//Set visibility flag depending on action
-				bool isCreate = data->actions[i] == "delete";
-				bool isDelete = data->actions[i] == "delete";
-				for(size_t j=0; j<block.nodes.size(); j++)
-					block.nodes[j].metaData.visible = !isDelete;
-				for(size_t j=0; j<block.ways.size(); j++)
-					block.ways[j].metaData.visible = !isDelete;
-				for(size_t j=0; j<block.relations.size(); j++)
-					block.relations[j].metaData.visible = !isDelete;
-
-				//Store objects
-				std::map<int64_t, int64_t> createdNodeIds, createdWayIds, createdRelationIds;
-
-				bool ok = ::StoreObjects(c, work, tableModPrefix, block, 
-					createdNodeIds, createdWayIds, createdRelationIds, errStr);
-				if(!ok)
-					cout << "Warning: " << errStr << endl;
-
-				std::set<int64_t> waysToUpdate, relsToUpdate;
-				for(size_t j=0; j<block.ways.size(); j++)
-				{
-					if (block.ways[j].objId <= 0) throw runtime_error("ID should not be zero or negative");
-					waysToUpdate.insert(block.ways[j].objId);
-				}
-				for(size_t j=0; j<block.relations.size(); j++)
-				{
-					if (block.relations[j].objId <= 0) throw runtime_error("ID should not be zero or negative");
-					relsToUpdate.insert(block.relations[j].objId);
-				}
+		string stageTable = prefixes[i]+"usernames_stage";
+		string sql = "DROP TABLE IF EXISTS "+c.quote_name(stageTable)+";";
+		ok = DbExec(work, sql, errStr, nullptr, verbose); if(!ok) return ok;
+		sql = "CREATE UNLOGGED TABLE "+c.quote_name(stageTable)+" (uid INTEGER, timestamp BIGINT, username TEXT);";
+		ok = DbExec(work, sql, errStr, nullptr, verbose); if(!ok) return ok;
 
-				if(!isCreate)
-				{
-					//Get affected parent objects
-					std::shared_ptr<class OsmData> affectedParents = make_shared<class OsmData>();
+		for(size_t j=0; j<sizeof(usernameSourceTables)/sizeof(const char *); j++)
+		{
+			string table = prefixes[i]+usernameSourceTables[j];
+			std::vector<string> jobSql;
+			jobSql.push_back("INSERT INTO "+c.quote_name(stageTable)+" "+UsernameSelectSql(c, table)+";");
 
-					pgCommon->GetAffectedParents2(block, affectedParents);
+			pqxx::result r = work->exec("SELECT pg_relation_size("+c.quote(table)+");");
+			extractJobs.push_back(DbParallelJob(table, jobSql, r[0][0].as<int64_t>()));
+		}
 
-					//Ensure a copy of affected parents is in the active table
-					std::map<int64_t, int64_t> unusedNodeIds, unusedWayIds, unusedRelationIds;
-					bool ok = ::StoreObjects(c, work, tableModPrefix, *affectedParents.get(), 
-						unusedNodeIds, unusedWayIds, unusedRelationIds, errStr);
+		std::vector<string> upsertSql;
+		UsernameUpsertSql(c, work, prefixes[i], stageTable, upsertSql);
+		upsertSql.push_back("DROP TABLE "+c.quote_name(stageTable)+";");
+		upsertJobs.push_back(DbParallelJob(prefixes[i]+"usernames", upsertSql));
+	}
 
-					for(size_t j=0; j<affectedParents->ways.size(); j++)
-						waysToUpdate.insert(affectedParents->ways[j].objId);
-					for(size_t j=0; j<affectedParents->relations.size(); j++)
-						relsToUpdate.insert(affectedParents->relations[j].objId);
-				}
+	std::stable_sort(extractJobs.begin(), extractJobs.end(), [](const DbParallelJob &a, const DbParallelJob &b) {
+		return a.sizeEstimate > b.sizeEstimate;});
 
-				//Update bboxes of modified and parent ways
-				int ret = ::UpdateWayBboxesById(c, work,
-					waysToUpdate,
-					0,
-					tableModPrefix, 
-					errStr);
-
-				//Update relation bboxes
-				ret = ::UpdateRelationBboxesById(c, work,
-					relsToUpdate,
-					0,
-					tableModPrefix, 
-					errStr);
-			}
-		}
-	}
+	ok = DbRunParallelJobs(connectionString, numWorkers, extractJobs, verbose, errStr);
+	if(!ok) return ok;
 
-	return true;
+	//Each table set has its own usernames table, so these can also run at the same time
+	return DbRunParallelJobs(connectionString, numWorkers, upsertJobs, verbose, errStr);
 }
 
 size_t DbCheckWaysFromCursor(pqxx::connection &c, pqxx::transaction_base *work, 
@@ -1229,49 +2091,264 @@ int DbUpdateWayBboxes(pqxx::connection &c, pqxx::transaction_base *work,
 	return 1;	
 }
 
+void ExpandBbox(std::vector<double> &bbox, const std::vector<double> &other)
+{
+	if(other.size() != 4) return;
+	if(bbox.size() != 4)
+	{
+		bbox = other;
+		return;
+	}
+	if(other[0] < bbox[0]) bbox[0] = other[0];
+	if(other[1] < bbox[1]) bbox[1] = other[1];
+	if(other[2] > bbox[2]) bbox[2] = other[2];
+	if(other[3] > bbox[3]) bbox[3] = other[3];
+}
+
+void DbLoadRelationMemberExtents(pqxx::connection &conn, pqxx::transaction_base *work,
+	const std::string &tablePrefix, 
+	const std::string &memType,
+	std::map<int64_t, vector<double> > &extents)
+{
+	//Aggregate the extent of the node or way members of each live relation in a single scan
+	string memTable = conn.quote_name(tablePrefix + "relation_mems_" + memType[0]);
+	string relTable = conn.quote_name(tablePrefix + "liverelations");
+	string objTable = conn.quote_name(tablePrefix + "visible" + memType + "s");
+	string geomCol = memType == "node" ? objTable+".geom" : objTable+".bbox";
+
+	stringstream sql;
+	sql << "SELECT " << memTable << ".id, MIN(ST_XMin(" << geomCol << ")) AS lon1, MIN(ST_YMin(" << geomCol << ")) AS lat1, ";
+	sql << "MAX(ST_XMax(" << geomCol << ")) AS lon2, MAX(ST_YMax(" << geomCol << ")) AS lat2";
+	sql << " FROM " << memTable;
+	sql << " INNER JOIN " << relTable << " ON " << relTable << ".id = " << memTable << ".id AND " << relTable << ".version = " << memTable << ".version";
+	sql << " INNER JOIN " << objTable << " ON " << objTable << ".id = " << memTable << ".member";
+	sql << " GROUP BY " << memTable << ".id;";
+
+	pqxx::icursorstream cursor( *work, sql.str(), "relmemextents", 10000 );
+
+	while(true)
+	{
+		pqxx::result rows;
+		cursor.get(rows);
+		if ( rows.empty() )
+			break;
+
+		int idCol = rows.column_number("id");
+		int lon1Col = rows.column_number("lon1");
+		int lat1Col = rows.column_number("lat1");
+		int lon2Col = rows.column_number("lon2");
+		int lat2Col = rows.column_number("lat2");
+
+		for (pqxx::result::const_iterator c = rows.begin(); c != rows.end(); ++c) {
+			if(c[lon1Col].is_null()) continue;
+			std::vector<double> bbox = {c[lon1Col].as<double>(), c[lat1Col].as<double>(), 
+				c[lon2Col].as<double>(), c[lat2Col].as<double>()};
+			ExpandBbox(extents[c[idCol].as<int64_t>()], bbox);
+		}
+	}
+}
+
+void DbLoadRelationRelationMembers(pqxx::connection &conn, pqxx::transaction_base *work,
+	const std::string &tablePrefix, 
+	std::map<int64_t, vector<int64_t> > &liveChildren,
+	std::map<int64_t, vector<double> > &extents)
+{
+	//Child relations that are live in this table set get computed in memory. Others (i.e. in the
+	//parent table set) already have a bbox, so that is merged into the extent directly.
+	string memTable = conn.quote_name(tablePrefix + "relation_mems_r");
+	string relTable = conn.quote_name(tablePrefix + "liverelations");
+	string visTable = conn.quote_name(tablePrefix + "visiblerelations");
+
+	stringstream sql;
+	sql << "SELECT " << memTable << ".id, " << memTable << ".member, childrel.id IS NOT NULL AS islive, ";
+	sql << "ST_XMin(" << visTable << ".bbox) AS lon1, ST_YMin(" << visTable << ".bbox) AS lat1, ";
+	sql << "ST_XMax(" << visTable << ".bbox) AS lon2, ST_YMax(" << visTable << ".bbox) AS lat2";
+	sql << " FROM " << memTable;
+	sql << " INNER JOIN " << relTable << " ON " << relTable << ".id = " << memTable << ".id AND " << relTable << ".version = " << memTable << ".version";
+	sql << " LEFT JOIN " << relTable << " AS childrel ON childrel.id = " << memTable << ".member";
+	sql << " LEFT JOIN " << visTable << " ON childrel.id IS NULL AND " << visTable << ".id = " << memTable << ".member;";
+
+	pqxx::icursorstream cursor( *work, sql.str(), "relrelmembers", 10000 );
+
+	while(true)
+	{
+		pqxx::result rows;
+		cursor.get(rows);
+		if ( rows.empty() )
+			break;
+
+		int idCol = rows.column_number("id");
+		int memberCol = rows.column_number("member");
+		int isLiveCol = rows.column_number("islive");
+		int lon1Col = rows.column_number("lon1");
+		int lat1Col = rows.column_number("lat1");
+		int lon2Col = rows.column_number("lon2");
+		int lat2Col = rows.column_number("lat2");
+
+		for (pqxx::result::const_iterator c = rows.begin(); c != rows.end(); ++c) {
+			int64_t objId = c[idCol].as<int64_t>();
+			if(c[isLiveCol].as<bool>())
+			{
+				liveChildren[objId].push_back(c[memberCol].as<int64_t>());
+				continue;
+			}
+			if(c[lon1Col].is_null()) continue;
+			std::vector<double> bbox = {c[lon1Col].as<double>(), c[lat1Col].as<double>(), 
+				c[lon2Col].as<double>(), c[lat2Col].as<double>()};
+			ExpandBbox(extents[objId], bbox);
+		}
+	}
+}
+
+void ComputeRelationBboxes(const std::map<int64_t, vector<int64_t> > &liveChildren,
+	std::map<int64_t, vector<double> > &bboxes, 
+	int verbose)
+{
+	//On entry, bboxes contains the extent of each relation's non-relation members. Relations
+	//are then resolved children first. Anything left over is part of (or depends on) a cycle.
+	std::map<int64_t, int64_t> pendingCount;
+	std::map<int64_t, vector<int64_t> > parents;
+	for(auto it=liveChildren.begin(); it!=liveChildren.end(); it++)
+	{
+		std::set<int64_t> uniqueChildren(it->second.begin(), it->second.end());
+		pendingCount[it->first] = uniqueChildren.size();
+		for(auto it2=uniqueChildren.begin(); it2!=uniqueChildren.end(); it2++)
+			parents[*it2].push_back(it->first);
+	}
+
+	//Children that have no relation members of their own are already final
+	std::vector<int64_t> ready;
+	for(auto it=parents.begin(); it!=parents.end(); it++)
+		if(liveChildren.find(it->first) == liveChildren.end())
+			ready.push_back(it->first);
+
+	std::set<int64_t> done;
+	while(ready.size() > 0)
+	{
+		int64_t relId = ready.back();
+		ready.pop_back();
+		if(done.find(relId) != done.end()) continue;
+		done.insert(relId);
+
+		auto ch = liveChildren.find(relId);
+		if(ch != liveChildren.end())
+			for(auto it=ch->second.begin(); it!=ch->second.end(); it++)
+			{
+				auto bb = bboxes.find(*it);
+				if(bb != bboxes.end())
+					ExpandBbox(bboxes[relId], bb->second);
+			}
+
+		auto pa = parents.find(relId);
+		if(pa == parents.end()) continue;
+		for(auto it=pa->second.begin(); it!=pa->second.end(); it++)
+		{
+			int64_t &count = pendingCount[*it];
+			count --;
+			if(count == 0)
+				ready.push_back(*it);
+		}
+	}
+
+	//Remaining relations: keep merging child bboxes until nothing changes. Bboxes
+	//only ever grow, so this converges.
+	std::vector<int64_t> remaining;
+	for(auto it=liveChildren.begin(); it!=liveChildren.end(); it++)
+		if(done.find(it->first) == done.end())
+			remaining.push_back(it->first);
+	if(verbose >= 1)
+		cout << "Relations with circular dependencies: " << remaining.size() << endl;
+
+	bool changed = remaining.size() > 0;
+	while(changed)
+	{
+		changed = false;
+		for(size_t i=0; i<remaining.size(); i++)
+		{
+			const vector<int64_t> &children = liveChildren.find(remaining[i])->second;
+			for(auto it=children.begin(); it!=children.end(); it++)
+			{
+				auto bb = bboxes.find(*it);
+				if(bb == bboxes.end()) continue;
+				std::vector<double> &target = bboxes[remaining[i]];
+				std::vector<double> before = target;
+				ExpandBbox(target, bb->second);
+				if(target != before)
+					changed = true;
+			}
+		}
+	}
+}
+
 int DbUpdateRelationBboxes(pqxx::connection &conn, pqxx::transaction_base *work,
     int verbose,
 	const std::string &tablePrefix, 
 	class PgCommon *adminObj,
 	std::string &errStr)
 {
-	string objTable = conn.quote_name(tablePrefix + "liverelations");
-	std::set<int64_t> relIds;
+	string relTable = conn.quote_name(tablePrefix + "liverelations");
+	string tmpTable = conn.quote_name(tablePrefix + "relbboxes_tmp");
 
-	for(int co=0; co<10; co++)
+	//Read membership and member extents in bulk
+	std::map<int64_t, vector<double> > bboxes;
+	std::map<int64_t, vector<int64_t> > liveChildren;
+	try
+	{
+		if(verbose >= 1) cout << "Reading node member extents" << endl;
+		DbLoadRelationMemberExtents(conn, work, tablePrefix, "node", bboxes);
+		if(verbose >= 1) cout << "Reading way member extents" << endl;
+		DbLoadRelationMemberExtents(conn, work, tablePrefix, "way", bboxes);
+		if(verbose >= 1) cout << "Reading relation members" << endl;
+		DbLoadRelationRelationMembers(conn, work, tablePrefix, liveChildren, bboxes);
+	}
+	catch (const pqxx::sql_error &e)
+	{
+		errStr = e.what();
+		return 0;
+	}
+	catch (const std::exception &e)
 	{
-		stringstream sql;
-		sql << "SELECT " << objTable << ".* FROM ";
-		sql << objTable;
-		sql << ";";
+		errStr = e.what();
+		return 0;
+	}
 
-		//cout << sql.str() << endl;
+	ComputeRelationBboxes(liveChildren, bboxes, verbose);
 
-		int step = 100;
-		pqxx::icursorstream cursor( *work, sql.str(), "relcursor", step );	
+	//Bulk write results via a temporary table
+	if(verbose >= 1) cout << "Writing " << bboxes.size() << " relation bboxes" << endl;
+	string sql = "DROP TABLE IF EXISTS "+tmpTable+";";
+	bool ok = DbExec(work, sql, errStr, nullptr, verbose); if(!ok) return 0;
+	sql = "CREATE TEMP TABLE "+tmpTable+" (id BIGINT, lon1 DOUBLE PRECISION, lat1 DOUBLE PRECISION, lon2 DOUBLE PRECISION, lat2 DOUBLE PRECISION);";
+	ok = DbExec(work, sql, errStr, nullptr, verbose); if(!ok) return 0;
 
-		while(true)
+	auto it = bboxes.begin();
+	while(it != bboxes.end())
+	{
+		stringstream ss;
+		ss.precision(9);
+		ss << "INSERT INTO " << tmpTable << " (id, lon1, lat1, lon2, lat2) VALUES ";
+		int count = 0;
+		for(; it != bboxes.end() and count < 1000; it++)
 		{
-			pqxx::result rows;
-			cursor.get(rows);
-			if ( rows.empty() )
-				break;
-
-			int idCol = rows.column_number("id");
-
-			for (pqxx::result::const_iterator c = rows.begin(); c != rows.end(); ++c) {
-				int64_t objId = c[idCol].as<int64_t>();
-				relIds.insert(objId);
-			}
+			const vector<double> &bb = it->second;
+			if(bb.size() != 4) continue;
+			if(count > 0) ss << ",";
+			ss << "(" << it->first << "," << bb[0] << "," << bb[1] << "," << bb[2] << "," << bb[3] << ")";
+			count ++;
 		}
+		if(count == 0) continue;
+		ss << ";";
+		ok = DbExec(work, ss.str(), errStr, nullptr, 0); if(!ok) return 0;
 	}
 
-	UpdateRelationBboxesById(conn, work,
-		relIds,
-		verbose,
-		tablePrefix, 
-		errStr);
+	sql = "ANALYZE "+tmpTable+";";
+	ok = DbExec(work, sql, errStr, nullptr, verbose); if(!ok) return 0;
+	sql = "UPDATE "+relTable+" SET bbox=ST_MakeEnvelope("+tmpTable+".lon1, "+tmpTable+".lat1, "+tmpTable+".lon2, "+tmpTable+".lat2, 4326) FROM "+tmpTable+" WHERE "+relTable+".id = "+tmpTable+".id;";
+	ok = DbExec(work, sql, errStr, nullptr, verbose); if(!ok) return 0;
+	sql = "UPDATE "+relTable+" SET bbox=NULL WHERE bbox IS NOT NULL AND NOT EXISTS (SELECT 1 FROM "+tmpTable+" WHERE "+tmpTable+".id = "+relTable+".id);";
+	ok = DbExec(work, sql, errStr, nullptr, verbose); if(!ok) return 0;
+	sql = "DROP TABLE "+tmpTable+";";
+	ok = DbExec(work, sql, errStr, nullptr, verbose); if(!ok) return 0;
 
 	return 1;	
 }
-
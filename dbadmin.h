@@ -22,11 +22,37 @@ bool DbCopyData(pqxx::connection &c, pqxx::transaction_base *work,
 	const std::string &tablePrefix, 
 	std::string &errStr);
 
+bool DbCopyDataParallel(const std::string &connectionString,
+	pqxx::connection &c,
+	int verbose, 
+	const std::string &filePrefix,
+	const std::string &tablePrefix, 
+	int numWorkers,
+	bool unloggedStaging,
+	std::string &errStr);
+
+bool DbCopyDataFromClient(const std::string &connectionString,
+	int verbose, 
+	const std::string &filePrefix,
+	const std::string &tablePrefix, 
+	int numWorkers,
+	int decodeThreads,
+	std::string &errStr);
+
 bool DbCreateIndices(pqxx::connection &c, pqxx::transaction_base *work, 
 	int verbose, 
 	const std::string &tablePrefix, 
 	std::string &errStr);
 
+bool DbCreateIndicesParallel(const std::string &connectionString,
+	pqxx::connection &c, pqxx::transaction_base *work, 
+	int verbose, 
+	const std::string &tablePrefix, 
+	int numWorkers,
+	const std::string &maintenanceWorkMem,
+	int parallelMaintenanceWorkers,
+	std::string &errStr);
+
 bool DbRefreshMaxIds(pqxx::connection &c, pqxx::transaction_base *work, 
 	int verbose, 
 	const std::string &tableStaticPrefix, 
@@ -48,13 +74,13 @@ bool DbGenerateUsernameTable(pqxx::connection &c, pqxx::transaction_base *work,
 	const std::string &tableTestPrefix, 
 	std::string &errStr);
 
-bool DbApplyDiffs(pqxx::connection &c, pqxx::transaction_base *work, 
+bool DbGenerateUsernameTableParallel(const std::string &connectionString,
+	pqxx::connection &c, pqxx::transaction_base *work, 
 	int verbose, 
 	const std::string &tableStaticPrefix, 
 	const std::string &tableModPrefix, 
 	const std::string &tableTestPrefix, 
-	const std::string &diffPath, 
-	class PgCommon *pgCommon,
+	int numWorkers,
 	std::string &errStr);
 
 void DbCheckNodesExistForAllWays(pqxx::connection &c, pqxx::transaction_base *work, 
@@ -88,5 +114,25 @@ bool DbDropBboxIndices(pqxx::connection &c, pqxx::transaction_base *work,
 	const std::string &tablePrefix, 
 	std::string &errStr);
 
+///GIN indices (jsonb_path_ops) on the tags of each live table, for exact tag matches with
+///@>, and partial spatial indices of the objects with each of popularKeys
+bool DbCreateTagIndices(pqxx::connection &c, pqxx::transaction_base *work, 
+	int verbose, 
+	const std::string &tablePrefix, 
+	const std::vector<std::string> &popularKeys,
+	std::string &errStr);
+
+bool DbDropTagIndices(pqxx::connection &c, pqxx::transaction_base *work, 
+	int verbose, 
+	const std::string &tablePrefix, 
+	std::string &errStr);
+
+bool DbClusterSpatially(const std::string &connectionString,
+	pqxx::connection &c, pqxx::transaction_base *work, 
+	int verbose, 
+	const std::string &tablePrefix, 
+	int numWorkers,
+	std::string &errStr);
+
 #endif //_DB_ADMIN_H
 
@@ -0,0 +1,705 @@
+#include "dbapplydiffs.h"
+#include "dbstore.h"
+#include "dbmeta.h"
+#include "dbcommon.h"
+#include "dbprepared.h"
+#include "cppGzip/DecodeGzip.h"
+#include <boost/filesystem.hpp>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <chrono>
+#include <thread>
+using namespace std;
+using namespace boost::filesystem;
+
+DiffFile::DiffFile():
+	numObjects(0),
+	parseTime(0.0)
+{
+
+}
+
+DiffFile::DiffFile(const DiffFile &obj)
+{
+	*this = obj;
+}
+
+DiffFile::~DiffFile()
+{
+
+}
+
+DiffFile& DiffFile::operator=(const DiffFile &obj)
+{
+	path = obj.path;
+	change = obj.change;
+	numObjects = obj.numObjects;
+	parseTime = obj.parseTime;
+	return *this;
+}
+
+// **********************************************
+
+DiffReader::DiffReader(const std::vector<std::string> &pathsIn, size_t queueSizeIn):
+	paths(pathsIn),
+	queueSize(queueSizeIn),
+	finished(false),
+	stopping(false)
+{
+	if(queueSize < 1)
+		queueSize = 1;
+	reader = std::thread(&DiffReader::Run, this);
+}
+
+DiffReader::~DiffReader()
+{
+	{
+		std::unique_lock<std::mutex> lock(mtx);
+		stopping = true;
+	}
+	cond.notify_all();
+	if(reader.joinable())
+		reader.join();
+}
+
+void DiffReader::Run()
+{
+	for(size_t i=0; i<paths.size(); i++)
+	{
+		class DiffFile diff;
+		diff.path = paths[i];
+		auto startTime = chrono::steady_clock::now();
+		try
+		{
+			std::filebuf fb;
+			if(fb.open(diff.path, std::ios::in | std::ios::binary) == nullptr)
+				throw runtime_error("Error opening "+diff.path);
+
+			//Decompress and parse as the data is read, rather than holding the whole file in memory
+			class DecodeGzip dec(fb);
+			diff.change = make_shared<class OsmChange>();
+			LoadFromOsmChangeXml(dec, diff.change.get());
+		}
+		catch(const std::exception &e)
+		{
+			std::unique_lock<std::mutex> lock(mtx);
+			readErrStr = diff.path + ": " + e.what();
+			finished = true;
+			cond.notify_all();
+			return;
+		}
+		diff.parseTime = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+
+		for(size_t j=0; j<diff.change->blocks.size(); j++)
+		{
+			const class OsmData &block = diff.change->blocks[j];
+			diff.numObjects += block.nodes.size() + block.ways.size() + block.relations.size();
+		}
+
+		std::unique_lock<std::mutex> lock(mtx);
+		cond.wait(lock, [this]{return stopping or queue.size() < queueSize;});
+		if(stopping)
+			return;
+		queue.push_back(diff);
+		cond.notify_all();
+	}
+
+	std::unique_lock<std::mutex> lock(mtx);
+	finished = true;
+	cond.notify_all();
+}
+
+bool DiffReader::Next(class DiffFile &out, std::string &errStr)
+{
+	std::unique_lock<std::mutex> lock(mtx);
+	cond.wait(lock, [this]{return finished or queue.size() > 0;});
+	if(queue.size() == 0)
+	{
+		errStr = readErrStr;
+		return false;
+	}
+
+	out = queue.front();
+	queue.pop_front();
+	cond.notify_all();
+	return true;
+}
+
+// **********************************************
+
+DiffBatch::DiffBatch():
+	numFiles(0),
+	numObjects(0)
+{
+
+}
+
+DiffBatch::~DiffBatch()
+{
+
+}
+
+void DiffBatch::Clear()
+{
+	nodeIds.clear();
+	wayIds.clear();
+	relationIds.clear();
+	waysToUpdate.clear();
+	relsToUpdate.clear();
+	numFiles = 0;
+	numObjects = 0;
+}
+
+// **********************************************
+
+int64_t DiffSequenceFromPath(const std::string &diffPath)
+{
+	//Replication diffs are stored as AAA/BBB/CCC.osc.gz
+	path p(diffPath);
+	string parts[3];
+	parts[2] = p.filename().string();
+	size_t dotPos = parts[2].find('.');
+	if(dotPos != string::npos)
+		parts[2] = parts[2].substr(0, dotPos);
+	p = p.parent_path();
+	parts[1] = p.filename().string();
+	p = p.parent_path();
+	parts[0] = p.filename().string();
+
+	int64_t seq = 0;
+	for(int i=0; i<3; i++)
+	{
+		if(parts[i].size() != 3 or parts[i].find_first_not_of("0123456789") != string::npos)
+			return -1;
+		seq = seq * 1000 + atoi(parts[i].c_str());
+	}
+	return seq;
+}
+
+void DbListDiffFiles(const std::string &diffPath, std::vector<std::string> &out)
+{
+	path p (diffPath);
+
+	if(is_directory(p))
+	{
+		//Recusively walk through directories
+		vector<path> result;
+		copy(directory_iterator(p), directory_iterator(),
+			back_inserter(result));
+		sort(result.begin(), result.end());
+		for (vector<path>::const_iterator it (result.begin()); it != result.end(); ++it)
+			DbListDiffFiles(it->native(), out);
+	}
+	else if (extension(diffPath) == ".gz")
+		out.push_back(diffPath);
+}
+
+//Sets the visible flag of each object and records it in the batch
+void PrepareChangeBlock(const std::string &action, class OsmData &block, class DiffBatch &batch)
+{
+	bool isCreate = action == "create";
+	bool isDelete = action == "delete";
+	for(size_t j=0; j<block.nodes.size(); j++)
+		block.nodes[j].metaData.visible = !isDelete;
+	for(size_t j=0; j<block.ways.size(); j++)
+		block.ways[j].metaData.visible = !isDelete;
+	for(size_t j=0; j<block.relations.size(); j++)
+		block.relations[j].metaData.visible = !isDelete;
+	batch.numObjects += block.nodes.size() + block.ways.size() + block.relations.size();
+
+	for(size_t j=0; j<block.ways.size(); j++)
+	{
+		if (block.ways[j].objId <= 0) throw runtime_error("ID should not be zero or negative");
+		batch.waysToUpdate.insert(block.ways[j].objId);
+	}
+	for(size_t j=0; j<block.relations.size(); j++)
+	{
+		if (block.relations[j].objId <= 0) throw runtime_error("ID should not be zero or negative");
+		batch.relsToUpdate.insert(block.relations[j].objId);
+	}
+
+	//New objects cannot have parents yet
+	if(isCreate)
+		return;
+	for(size_t j=0; j<block.nodes.size(); j++)
+		batch.nodeIds.insert(block.nodes[j].objId);
+	for(size_t j=0; j<block.ways.size(); j++)
+		batch.wayIds.insert(block.ways[j].objId);
+	for(size_t j=0; j<block.relations.size(); j++)
+		batch.relationIds.insert(block.relations[j].objId);
+}
+
+bool DbApplyOsmChange(pqxx::connection &c, pqxx::transaction_base *work,
+	int verbose,
+	const std::string &tableModPrefix,
+	class OsmChange &change,
+	class DiffBatch &batch,
+	std::string &errStr)
+{
+	for(size_t i=0; i<change.blocks.size(); i++)
+	{
+		if(verbose >= 2)
+			cout << change.actions[i] << endl;
+		class OsmData &block = change.blocks[i];
+		PrepareChangeBlock(change.actions[i], block, batch);
+
+		//Store objects
+		std::map<int64_t, int64_t> createdNodeIds, createdWayIds, createdRelationIds;
+
+		bool ok = ::StoreObjects(c, work, tableModPrefix, block,
+			createdNodeIds, createdWayIds, createdRelationIds, errStr);
+		if(!ok)
+			cout << "Warning: " << errStr << endl;
+	}
+	batch.numFiles ++;
+	return true;
+}
+
+//Rolls back the worker transactions that are still open or prepared when it goes out of scope
+class WorkerTransactions
+{
+public:
+	WorkerTransactions(std::vector<std::shared_ptr<pqxx::connection> > &connsIn):
+		conns(connsIn),
+		works(connsIn.size()),
+		inTransaction(connsIn.size(), false),
+		prepared(connsIn.size(), false),
+		gids(connsIn.size())
+	{}
+
+	virtual ~WorkerTransactions()
+	{
+		string unusedErrStr;
+		for(size_t k=0; k<works.size(); k++)
+		{
+			if(!works[k])
+				continue;
+			try
+			{
+				if(inTransaction[k])
+					DbExec(works[k].get(), "ROLLBACK;", unusedErrStr);
+				if(prepared[k])
+					DbExec(works[k].get(), "ROLLBACK PREPARED " + conns[k]->quote(gids[k]) + ";", unusedErrStr);
+			}
+			catch (const std::exception &e)
+			{
+				cout << "Warning: could not roll back worker transaction: " << e.what() << endl;
+			}
+		}
+	}
+
+	std::vector<std::shared_ptr<pqxx::connection> > &conns;
+	std::vector<std::shared_ptr<pqxx::nontransaction> > works;
+	std::vector<bool> inTransaction, prepared;
+	std::vector<string> gids;
+};
+
+//Forgets the statements prepared on the worker connections when they go out of scope
+class WorkerConnections
+{
+public:
+	virtual ~WorkerConnections()
+	{
+		for(size_t i=0; i<conns.size(); i++)
+			forget_prepared(*conns[i]);
+	}
+
+	std::vector<std::shared_ptr<pqxx::connection> > conns;
+};
+
+bool DbApplyOsmChangesParallel(std::vector<std::shared_ptr<pqxx::connection> > &workerConns,
+	int verbose,
+	const std::string &tableModPrefix,
+	std::vector<class DiffFile> &diffs,
+	class DiffBatch &batch,
+	bool twoPhase,
+	std::string &errStr)
+{
+	size_t numWorkers = workerConns.size();
+	if(numWorkers == 0)
+		throw invalid_argument("No worker connections");
+
+	//Split objects by ID, so all versions of an object are written in order by the same worker
+	std::vector<class OsmData> nodeParts(numWorkers), wayParts(numWorkers), relationParts(numWorkers);
+	for(size_t i=0; i<diffs.size(); i++)
+	{
+		class OsmChange &change = *diffs[i].change;
+		for(size_t j=0; j<change.blocks.size(); j++)
+		{
+			class OsmData &block = change.blocks[j];
+			bool placeholder = false;
+			for(size_t k=0; k<block.nodes.size(); k++)
+				placeholder = placeholder or block.nodes[k].objId <= 0;
+			for(size_t k=0; k<block.ways.size(); k++)
+				placeholder = placeholder or block.ways[k].objId <= 0;
+			for(size_t k=0; k<block.relations.size(); k++)
+				placeholder = placeholder or block.relations[k].objId <= 0;
+			if(placeholder)
+			{
+				errStr = "Placeholder IDs cannot be used when applying diffs in parallel";
+				return false;
+			}
+			PrepareChangeBlock(change.actions[j], block, batch);
+
+			for(size_t k=0; k<block.nodes.size(); k++)
+				nodeParts[block.nodes[k].objId % numWorkers].nodes.push_back(block.nodes[k]);
+			for(size_t k=0; k<block.ways.size(); k++)
+				wayParts[block.ways[k].objId % numWorkers].ways.push_back(block.ways[k]);
+			for(size_t k=0; k<block.relations.size(); k++)
+				relationParts[block.relations[k].objId % numWorkers].relations.push_back(block.relations[k]);
+		}
+		batch.numFiles ++;
+	}
+
+	//Each worker keeps one transaction open across all object types. Whatever is still open
+	//when this returns, or throws, is rolled back.
+	class WorkerTransactions workerTrans(workerConns);
+	std::vector<std::shared_ptr<pqxx::nontransaction> > &works = workerTrans.works;
+	std::vector<string> workerErrs(numWorkers);
+	bool ok = true;
+	for(size_t k=0; k<numWorkers and ok; k++)
+	{
+		works[k] = make_shared<pqxx::nontransaction>(*workerConns[k]);
+		ok = DbExec(works[k].get(), "BEGIN;", errStr);
+		workerTrans.inTransaction[k] = ok;
+	}
+
+	//Nodes, then ways, then relations. Joining the threads is the barrier between types.
+	std::vector<class OsmData> *phases[3] = {&nodeParts, &wayParts, &relationParts};
+	for(int phase=0; phase<3 and ok; phase++)
+	{
+		std::vector<class OsmData> &parts = *phases[phase];
+		std::vector<std::thread> threads;
+		for(size_t k=0; k<numWorkers; k++)
+		{
+			threads.push_back(std::thread([&, k]()
+			{
+				try
+				{
+					std::map<int64_t, int64_t> createdNodeIds, createdWayIds, createdRelationIds;
+					if(!::StoreObjects(*workerConns[k], works[k].get(), tableModPrefix, parts[k],
+						createdNodeIds, createdWayIds, createdRelationIds, workerErrs[k]) and workerErrs[k].size() == 0)
+						workerErrs[k] = "Failed to store objects";
+				}
+				catch (const std::exception &e)
+				{
+					workerErrs[k] = e.what();
+				}
+			}));
+		}
+		for(size_t k=0; k<threads.size(); k++)
+			threads[k].join();
+		for(size_t k=0; k<numWorkers; k++)
+			if(workerErrs[k].size() > 0)
+			{
+				errStr = workerErrs[k];
+				ok = false;
+				break;
+			}
+	}
+
+	//Two phase commit keeps the batch atomic even if a commit fails part way
+	if(ok and twoPhase)
+	{
+		string gidPrefix = "pgmap_" + tableModPrefix + to_string(time(nullptr)) + "_";
+		for(size_t k=0; k<numWorkers and ok; k++)
+		{
+			workerTrans.gids[k] = gidPrefix + to_string(k);
+			ok = DbExec(works[k].get(), "PREPARE TRANSACTION " + workerConns[k]->quote(workerTrans.gids[k]) + ";", errStr);
+			workerTrans.inTransaction[k] = false;
+			workerTrans.prepared[k] = ok;
+		}
+	}
+	if(!ok)
+		return false;
+
+	for(size_t k=0; k<numWorkers; k++)
+	{
+		const string &gid = workerTrans.gids[k];
+		if(twoPhase)
+		{
+			ok = DbExec(works[k].get(), "COMMIT PREPARED " + workerConns[k]->quote(gid) + ";", errStr);
+			if(!ok and k > 0)
+				errStr += " (some prepared transactions named " + gid.substr(0, gid.size()-to_string(k).size()) + "* were already committed)";
+			workerTrans.prepared[k] = false;
+		}
+		else
+		{
+			ok = DbExec(works[k].get(), "COMMIT;", errStr);
+			workerTrans.inTransaction[k] = false;
+		}
+		if(!ok) return false;
+	}
+	if(verbose >= 1)
+		cout << "Applied " << diffs.size() << " files on " << numWorkers << " connections" << endl;
+	return true;
+}
+
+bool DbFinishDiffBatch(pqxx::connection &c, pqxx::transaction_base *work,
+	int verbose,
+	const std::string &tableModPrefix,
+	class DiffBatch &batch,
+	class PgCommon *pgCommon,
+	std::string &errStr)
+{
+	//Only object IDs are needed to find parents
+	class OsmData changed;
+	for(auto it=batch.nodeIds.begin(); it!=batch.nodeIds.end(); it++)
+	{
+		class OsmNode node;
+		node.objId = *it;
+		changed.nodes.push_back(node);
+	}
+	for(auto it=batch.wayIds.begin(); it!=batch.wayIds.end(); it++)
+	{
+		class OsmWay way;
+		way.objId = *it;
+		changed.ways.push_back(way);
+	}
+	for(auto it=batch.relationIds.begin(); it!=batch.relationIds.end(); it++)
+	{
+		class OsmRelation relation;
+		relation.objId = *it;
+		changed.relations.push_back(relation);
+	}
+
+	if(changed.nodes.size() + changed.ways.size() + changed.relations.size() > 0)
+	{
+		//Get affected parent objects
+		std::shared_ptr<class OsmData> affectedParents = make_shared<class OsmData>();
+
+		pgCommon->GetAffectedParents2(changed, affectedParents);
+
+		//Ensure a copy of affected parents is in the active table
+		std::map<int64_t, int64_t> unusedNodeIds, unusedWayIds, unusedRelationIds;
+		bool ok = ::StoreObjects(c, work, tableModPrefix, *affectedParents.get(),
+			unusedNodeIds, unusedWayIds, unusedRelationIds, errStr);
+		if(!ok)
+			cout << "Warning: " << errStr << endl;
+
+		for(size_t j=0; j<affectedParents->ways.size(); j++)
+			batch.waysToUpdate.insert(affectedParents->ways[j].objId);
+		for(size_t j=0; j<affectedParents->relations.size(); j++)
+			batch.relsToUpdate.insert(affectedParents->relations[j].objId);
+		if(verbose >= 1)
+			cout << "Found " << affectedParents->ways.size() << " parent ways and " 
+				<< affectedParents->relations.size() << " parent relations" << endl;
+	}
+
+	//Update bboxes of modified and parent ways
+	::UpdateWayBboxesById(c, work,
+		batch.waysToUpdate,
+		0,
+		tableModPrefix,
+		errStr);
+
+	//Update relation bboxes
+	::UpdateRelationBboxesById(c, work,
+		batch.relsToUpdate,
+		0,
+		tableModPrefix,
+		errStr);
+
+	batch.Clear();
+	return true;
+}
+
+bool DbRecordDiffProgress(pqxx::connection &c, pqxx::transaction_base *work,
+	const std::string &tableModPrefix,
+	const std::string &diffPath,
+	std::string &errStr)
+{
+	try
+	{
+		bool ok = DbSetMetaValue(c, work, "diff_last_file", diffPath, tableModPrefix, errStr);
+		if(!ok) return false;
+		int64_t seq = DiffSequenceFromPath(diffPath);
+		if(seq < 0)
+			return true;
+		return DbSetMetaValue(c, work, "diff_sequence", to_string(seq), tableModPrefix, errStr);
+	}
+	catch (const std::exception &e)
+	{
+		errStr = e.what();
+		return false;
+	}
+}
+
+bool DbApplyDiffs(pqxx::connection &c, pqxx::transaction_base *work,
+	int verbose,
+	const std::string &connectionString,
+	const std::string &tableStaticPrefix,
+	const std::string &tableModPrefix,
+	const std::string &tableTestPrefix,
+	const std::string &diffPath,
+	int batchFiles,
+	int checkpointFiles,
+	int64_t checkpointObjects,
+	bool resume,
+	int numWorkers,
+	bool twoPhase,
+	DiffCheckpointFunc checkpoint,
+	class PgCommon *pgCommon,
+	std::string &errStr)
+{
+	if(batchFiles < 1)
+		batchFiles = 1;
+	if(numWorkers > 1 and !checkpoint)
+	{
+		//The main transaction must commit to see (and not block) the workers' writes
+		errStr = "Applying diffs in parallel needs checkpoints";
+		return false;
+	}
+	if(numWorkers > 1 and twoPhase)
+	{
+		pqxx::result r = work->exec("SHOW max_prepared_transactions;");
+		if(r.size() == 0 or r[0][0].as<int>() < numWorkers)
+		{
+			errStr = "max_prepared_transactions must be at least the number of connections to use two phase commit";
+			return false;
+		}
+	}
+
+	vector<string> allPaths, paths;
+	DbListDiffFiles(diffPath, allPaths);
+
+	//Skip diffs applied by a previous run
+	int64_t lastSequence = -1;
+	if(resume)
+	{
+		try
+		{
+			string seqStr = DbGetMetaValue(c, work, "diff_sequence", tableModPrefix, errStr);
+			lastSequence = atol(seqStr.c_str());
+		}
+		catch (const std::exception &)
+		{
+			//No diffs recorded yet
+			lastSequence = -1;
+		}
+	}
+	for(size_t i=0; i<allPaths.size(); i++)
+	{
+		int64_t seq = DiffSequenceFromPath(allPaths[i]);
+		if(lastSequence >= 0 and seq >= 0 and seq <= lastSequence)
+			continue;
+		paths.push_back(allPaths[i]);
+	}
+	if(verbose >= 1 and lastSequence >= 0)
+		cout << "Resuming after sequence " << lastSequence << ", skipping " << (allPaths.size() - paths.size()) << " files" << endl;
+
+	//Connections are closed, and their statements forgotten, however this returns
+	class WorkerConnections workers;
+	std::vector<std::shared_ptr<pqxx::connection> > &workerConns = workers.conns;
+	for(int i=0; i<numWorkers and numWorkers > 1; i++)
+		workerConns.push_back(make_shared<pqxx::connection>(connectionString));
+
+	//The next files are parsed while the current one is written to the database
+	class DiffReader reader(paths);
+	class DiffFile diff;
+	class DiffBatch batch;
+	std::vector<class DiffFile> pending;
+	string readErrStr;
+	int filesSinceCheckpoint = 0;
+	int64_t objectsSinceCheckpoint = 0;
+	bool ok = true;
+	bool more = true;
+	while(ok and more)
+	{
+		more = reader.Next(diff, readErrStr);
+		if(more)
+		{
+			filesSinceCheckpoint ++;
+			objectsSinceCheckpoint += diff.numObjects;
+		}
+		bool checkpointDue = checkpoint and ((checkpointFiles > 0 and filesSinceCheckpoint >= checkpointFiles)
+			or (checkpointObjects > 0 and objectsSinceCheckpoint >= checkpointObjects));
+
+		if(workerConns.size() > 0)
+		{
+			//Collect a batch of files, then write it on the worker connections
+			if(more)
+				pending.push_back(diff);
+			if(pending.size() == 0 or (more and pending.size() < (size_t)batchFiles and !checkpointDue))
+				continue;
+
+			auto startTime = chrono::steady_clock::now();
+			size_t numObjects = 0;
+			for(size_t i=0; i<pending.size(); i++)
+				numObjects += pending[i].numObjects;
+			ok = DbApplyOsmChangesParallel(workerConns, verbose, tableModPrefix, pending, batch, twoPhase, errStr);
+			if(!ok) break;
+			if(verbose >= 1)
+			{
+				double elapsed = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+				cout << "   " << pending.back().path << ": " << numObjects << " objects in " << elapsed << " s";
+				if(elapsed > 0.0)
+					cout << " (" << int64_t(numObjects / elapsed) << " objects/s)";
+				cout << endl;
+			}
+			diff = pending.back();
+			pending.clear();
+
+			//Start a new snapshot that includes the workers' changes
+			ok = checkpoint(work, errStr);
+			if(!ok) break;
+			checkpointDue = true;
+		}
+		else if(more)
+		{
+			auto startTime = chrono::steady_clock::now();
+
+			ok = DbApplyOsmChange(c, work,
+				verbose,
+				tableModPrefix,
+				*diff.change,
+				batch,
+				errStr);
+			if(!ok) break;
+
+			if(verbose >= 1)
+			{
+				double elapsed = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+				cout << "   " << diff.path << ": " << diff.numObjects << " objects in " << elapsed << " s";
+				if(elapsed > 0.0)
+					cout << " (" << int64_t(diff.numObjects / elapsed) << " objects/s)";
+				cout << ", parsed in " << diff.parseTime << " s" << endl;
+			}
+		}
+
+		if(batch.numFiles > 0 and (batch.numFiles >= (size_t)batchFiles or checkpointDue or !more))
+		{
+			auto startTime = chrono::steady_clock::now();
+			ok = DbFinishDiffBatch(c, work, verbose, tableModPrefix, batch, pgCommon, errStr);
+			if(!ok) break;
+			if(verbose >= 1)
+				cout << "Updated parents and bboxes in " << chrono::duration<double>(chrono::steady_clock::now() - startTime).count() << " s" << endl;
+		}
+
+		if(filesSinceCheckpoint > 0 and (checkpointDue or !more))
+		{
+			//Progress is recorded in the same transaction as the data
+			ok = DbRecordDiffProgress(c, work, tableModPrefix, diff.path, errStr);
+			if(!ok) break;
+			if(checkpointDue)
+			{
+				ok = checkpoint(work, errStr);
+				if(!ok) break;
+				if(verbose >= 1)
+					cout << "Committed " << filesSinceCheckpoint << " files, " << objectsSinceCheckpoint << " objects" << endl;
+			}
+			filesSinceCheckpoint = 0;
+			objectsSinceCheckpoint = 0;
+		}
+	}
+
+	if(!ok)
+		return false;
+	if(readErrStr.size() > 0)
+	{
+		errStr = readErrStr;
+		return false;
+	}
+	return true;
+}
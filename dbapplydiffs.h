@@ -0,0 +1,126 @@
+#ifndef _DB_APPLY_DIFFS_H
+#define _DB_APPLY_DIFFS_H
+
+#include <pqxx/pqxx> //apt install libpqxx-dev
+#include <string>
+#include <vector>
+#include <set>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include "cppo5m/OsmData.h"
+#include "pgcommon.h"
+
+///A diff file that has been decompressed and parsed
+class DiffFile
+{
+public:
+	DiffFile();
+	DiffFile(const DiffFile &obj);
+	virtual ~DiffFile();
+	DiffFile& operator=(const DiffFile &obj);
+
+	std::string path;
+	std::shared_ptr<class OsmChange> change;
+	size_t numObjects;
+	double parseTime;
+};
+
+///Decompresses and parses diff files on a background thread, keeping up to queueSize
+///files ready ahead of the thread that applies them.
+class DiffReader
+{
+public:
+	DiffReader(const std::vector<std::string> &pathsIn, size_t queueSizeIn = 4);
+	virtual ~DiffReader();
+
+	//Waits for the next file. Returns false when no files remain, or on error (errStr is then set).
+	bool Next(class DiffFile &out, std::string &errStr);
+
+protected:
+	void Run();
+
+	std::vector<std::string> paths;
+	size_t queueSize;
+	std::deque<class DiffFile> queue;
+	bool finished;
+	bool stopping;
+	std::string readErrStr;
+	std::mutex mtx;
+	std::condition_variable cond;
+	std::thread reader;
+};
+
+///Objects written by a run of diff files. Parent lookups and bbox updates are 
+///done once for the whole batch, rather than for every action block.
+class DiffBatch
+{
+public:
+	DiffBatch();
+	virtual ~DiffBatch();
+	void Clear();
+
+	//Modified or deleted objects, whose parents need to be found
+	std::set<int64_t> nodeIds, wayIds, relationIds;
+	//Objects needing their bbox recalculated
+	std::set<int64_t> waysToUpdate, relsToUpdate;
+	size_t numFiles;
+	size_t numObjects;
+};
+
+///Commits the current transaction and starts a new one, replacing work
+typedef std::function<bool(pqxx::transaction_base *&work, std::string &errStr)> DiffCheckpointFunc;
+
+///Gets the replication sequence number from a path like .../000/001/234.osc.gz, or -1
+int64_t DiffSequenceFromPath(const std::string &diffPath);
+
+///Finds .osc.gz files in sorted order, recursing into directories
+void DbListDiffFiles(const std::string &diffPath, std::vector<std::string> &out);
+
+///Writes the objects in a diff and records them in the batch
+bool DbApplyOsmChange(pqxx::connection &c, pqxx::transaction_base *work,
+	int verbose,
+	const std::string &tableModPrefix,
+	class OsmChange &change,
+	class DiffBatch &batch,
+	std::string &errStr);
+
+///Copies affected parents into the active tables and updates bboxes for the batch
+bool DbFinishDiffBatch(pqxx::connection &c, pqxx::transaction_base *work,
+	int verbose,
+	const std::string &tableModPrefix,
+	class DiffBatch &batch,
+	class PgCommon *pgCommon,
+	std::string &errStr);
+
+///Writes the objects in several diffs, split by ID over the worker connections. Each 
+///worker writes all nodes, then all ways, then all relations, in one transaction.
+bool DbApplyOsmChangesParallel(std::vector<std::shared_ptr<pqxx::connection> > &workerConns,
+	int verbose,
+	const std::string &tableModPrefix,
+	std::vector<class DiffFile> &diffs,
+	class DiffBatch &batch,
+	bool twoPhase,
+	std::string &errStr);
+
+bool DbApplyDiffs(pqxx::connection &c, pqxx::transaction_base *work,
+	int verbose,
+	const std::string &connectionString,
+	const std::string &tableStaticPrefix,
+	const std::string &tableModPrefix,
+	const std::string &tableTestPrefix,
+	const std::string &diffPath,
+	int batchFiles,
+	int checkpointFiles,
+	int64_t checkpointObjects,
+	bool resume,
+	int numWorkers,
+	bool twoPhase,
+	DiffCheckpointFunc checkpoint,
+	class PgCommon *pgCommon,
+	std::string &errStr);
+
+#endif //_DB_APPLY_DIFFS_H
@@ -0,0 +1,340 @@
+#include "dbaugmenteddiff.h"
+#include "dbdecode.h"
+#include <sstream>
+#include <memory>
+#include <ctime>
+using namespace std;
+
+AugmentedDiffXmlEncode::AugmentedDiffXmlEncode(std::streambuf &outIn):
+	out(outIn),
+	finished(false)
+{
+	Write("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+	Write("<osm version=\"0.6\" generator=\"pgmap\">\n");
+}
+
+AugmentedDiffXmlEncode::~AugmentedDiffXmlEncode()
+{
+	Finish();
+}
+
+void AugmentedDiffXmlEncode::Finish()
+{
+	if(finished)
+		return;
+	Write("</osm>\n");
+	out.pubsync();
+	finished = true;
+}
+
+void AugmentedDiffXmlEncode::StoreAction(const std::string &action,
+	const class OsmObject *oldObj, const std::vector<double> &oldBbox,
+	const class OsmObject *newObj, const std::vector<double> &newBbox)
+{
+	Write("<action type=\""+action+"\">\n");
+	if(oldObj == nullptr)
+		WriteObject(newObj, newBbox);
+	else
+	{
+		Write("<old>\n");
+		WriteObject(oldObj, oldBbox);
+		Write("</old>\n<new>\n");
+		WriteObject(newObj, newBbox);
+		Write("</new>\n");
+	}
+	Write("</action>\n");
+}
+
+string AugmentedDiffEscape(const std::string &str)
+{
+	string escaped;
+	for(size_t i=0; i<str.size(); i++)
+	{
+		switch(str[i])
+		{
+		case '&': escaped += "&amp;"; break;
+		case '<': escaped += "&lt;"; break;
+		case '>': escaped += "&gt;"; break;
+		case '"': escaped += "&quot;"; break;
+		case '\n': escaped += "&#10;"; break;
+		default: escaped += str[i];
+		}
+	}
+	return escaped;
+}
+
+void AugmentedDiffXmlEncode::WriteObject(const class OsmObject *obj, const std::vector<double> &bbox)
+{
+	const class OsmNode *node = dynamic_cast<const class OsmNode *>(obj);
+	const class OsmWay *way = dynamic_cast<const class OsmWay *>(obj);
+	const class OsmRelation *relation = dynamic_cast<const class OsmRelation *>(obj);
+	const class MetaData &metaData = obj->metaData;
+
+	time_t t = metaData.timestamp;
+	struct tm tmUtc;
+	gmtime_r(&t, &tmUtc);
+	char timestampStr[32];
+	strftime(timestampStr, sizeof(timestampStr), "%Y-%m-%dT%H:%M:%SZ", &tmUtc);
+
+	stringstream ss;
+	ss.precision(9);
+	string objType = node != nullptr ? "node" : (way != nullptr ? "way" : "relation");
+	ss << "<" << objType << " id=\"" << obj->objId << "\"";
+	if(!metaData.visible)
+		ss << " visible=\"false\"";
+	ss << " version=\"" << metaData.version << "\" timestamp=\"" << timestampStr << "\"";
+	ss << " changeset=\"" << metaData.changeset << "\" uid=\"" << metaData.uid << "\"";
+	ss << " user=\"" << AugmentedDiffEscape(metaData.username) << "\"";
+	if(node != nullptr and metaData.visible)
+		ss << " lat=\"" << node->lat << "\" lon=\"" << node->lon << "\"";
+	ss << ">\n";
+
+	if(bbox.size() == 4)
+		ss << "  <bounds minlat=\"" << bbox[1] << "\" minlon=\"" << bbox[0] << "\" maxlat=\"" << bbox[3] << "\" maxlon=\"" << bbox[2] << "\"/>\n";
+	if(way != nullptr)
+		for(size_t i=0; i<way->refs.size(); i++)
+			ss << "  <nd ref=\"" << way->refs[i] << "\"/>\n";
+	if(relation != nullptr)
+		for(size_t i=0; i<relation->refIds.size(); i++)
+			ss << "  <member type=\"" << relation->refTypeStrs[i] << "\" ref=\"" << relation->refIds[i] << "\" role=\"" << AugmentedDiffEscape(relation->refRoles[i]) << "\"/>\n";
+	for(auto it=obj->tags.begin(); it!=obj->tags.end(); it++)
+		ss << "  <tag k=\"" << AugmentedDiffEscape(it->first) << "\" v=\"" << AugmentedDiffEscape(it->second) << "\"/>\n";
+
+	ss << "</" << objType << ">\n";
+	Write(ss.str());
+}
+
+void AugmentedDiffXmlEncode::Write(const std::string &str)
+{
+	out.sputn(str.data(), str.size());
+}
+
+// **********************************************
+
+//Columns selected from a live or old table, so the two can be combined
+string AugmentedDiffColumns(const std::string &objType, bool isLive)
+{
+	string cols = "id, changeset, username, uid, timestamp, version, tags";
+	cols += isLive ? ", true AS visible" : ", visible";
+	if(objType == "node")
+		cols += ", geom";
+	else if(objType == "way")
+		cols += ", members";
+	else
+		cols += ", members, memberroles";
+	return cols;
+}
+
+std::shared_ptr<class OsmObject> DecodeAugmentedDiffRow(const pqxx::result::const_iterator &row,
+	const pqxx::result &rows, const std::string &objType, class DbUsernameLookup &usernames)
+{
+	MetaDataCols metaDataCols;
+	metaDataCols.changesetCol = rows.column_number("changeset");
+	metaDataCols.usernameCol = rows.column_number("username");
+	metaDataCols.uidCol = rows.column_number("uid");
+	metaDataCols.timestampCol = rows.column_number("timestamp");
+	metaDataCols.versionCol = rows.column_number("version");
+	metaDataCols.visibleCol = rows.column_number("visible");
+
+	std::shared_ptr<class OsmObject> obj;
+	if(objType == "node")
+	{
+		std::shared_ptr<class OsmNode> node(new class OsmNode());
+		int latCol = rows.column_number("lat");
+		int lonCol = rows.column_number("lon");
+		if(!row[latCol].is_null())
+		{
+			node->lat = row[latCol].as<double>();
+			node->lon = row[lonCol].as<double>();
+		}
+		obj = node;
+	}
+	else if(objType == "way")
+	{
+		std::shared_ptr<class OsmWay> way(new class OsmWay());
+		int membersCol = rows.column_number("members");
+		if(!row[membersCol].is_null())
+		{
+			JsonToWayMembers wayMemHandler;
+			DecodeWayMembers(row, membersCol, wayMemHandler);
+			way->refs = wayMemHandler.refs;
+		}
+		obj = way;
+	}
+	else
+	{
+		std::shared_ptr<class OsmRelation> relation(new class OsmRelation());
+		int membersCol = rows.column_number("members");
+		int membersRolesCol = rows.column_number("memberroles");
+		if(!row[membersCol].is_null() and !row[membersRolesCol].is_null())
+		{
+			JsonToRelMembers relMemHandler;
+			JsonToRelMemberRoles relMemRolesHandler;
+			DecodeRelMembers(row, membersCol, membersRolesCol, relMemHandler, relMemRolesHandler);
+			if(relMemHandler.refTypeStrs.size() != relMemHandler.refIds.size() ||
+				relMemHandler.refTypeStrs.size() != relMemRolesHandler.refRoles.size())
+				throw runtime_error("Decoded relation has inconsistent member data");
+			relation->refTypeStrs = relMemHandler.refTypeStrs;
+			relation->refIds = relMemHandler.refIds;
+			relation->refRoles = relMemRolesHandler.refRoles;
+		}
+		obj = relation;
+	}
+
+	obj->objId = row[rows.column_number("id")].as<int64_t>();
+	DecodeMetadata(row, metaDataCols, obj->metaData);
+	string username = usernames.Find(obj->metaData.uid);
+	if(username.length() > 0)
+		obj->metaData.username = username;
+
+	int tagsCol = rows.column_number("tags");
+	if(!row[tagsCol].is_null())
+	{
+		JsonToStringMap tagHandler;
+		DecodeTags(row, tagsCol, tagHandler);
+		obj->tags = tagHandler.tagMap;
+	}
+	return obj;
+}
+
+void GetAugmentedDiffObjects(pqxx::connection &c, pqxx::transaction_base *work, class DbUsernameLookup &usernames,
+	const std::string &tableStaticPrefix,
+	const std::string &tableActivePrefix,
+	const std::string &objType,
+	int64_t timestampStart, int64_t timestampEnd,
+	class IAugmentedDiffHandler &out)
+{
+	string liveCols = AugmentedDiffColumns(objType, true);
+	string oldCols = AugmentedDiffColumns(objType, false);
+	string staticLive = c.quote_name(tableStaticPrefix + "live" + objType + "s");
+	string staticOld = c.quote_name(tableStaticPrefix + "old" + objType + "s");
+	string activeLive = c.quote_name(tableActivePrefix + "live" + objType + "s");
+	string activeOld = c.quote_name(tableActivePrefix + "old" + objType + "s");
+
+	stringstream inRange;
+	inRange << " WHERE timestamp > " << timestampStart << " AND timestamp <= " << timestampEnd;
+
+	//The versions in the time range, found with the timestamp indexes
+	stringstream sql;
+	sql << "WITH changed AS (";
+	sql << "SELECT " << liveCols << " FROM " << staticLive << inRange.str();
+	sql << " UNION ALL SELECT " << oldCols << " FROM " << staticOld << inRange.str();
+	sql << " UNION ALL SELECT " << liveCols << " FROM " << activeLive << inRange.str();
+	sql << " UNION ALL SELECT " << oldCols << " FROM " << activeOld << inRange.str();
+	sql << "), ";
+
+	//Each one's latest earlier version, from the (id, version) keys. The active live table
+	//can't hold an earlier version, since it is moved to the old table when replaced. Of the
+	//other tables, only the static live table keeps a relation's own bbox.
+	string before = " WHERE id = changed.id AND version < changed.version";
+	string noBbox, prevBbox, liveBbox;
+	if(objType == "relation")
+	{
+		noBbox = ", NULL::geometry";
+		prevBbox = noBbox + " AS adiff_oldbbox";
+		liveBbox = ", bbox AS adiff_oldbbox";
+	}
+	sql << "pairs AS (";
+	sql << "SELECT 0 AS adiff_role, changed.id AS adiff_id, changed.version AS adiff_version,";
+	sql << " changed.timestamp AS adiff_timestamp, prev.* FROM changed";
+	sql << " CROSS JOIN LATERAL (SELECT * FROM (";
+	sql << "SELECT " << oldCols << prevBbox << " FROM " << activeOld << before;
+	sql << " UNION ALL SELECT " << oldCols << prevBbox << " FROM " << staticOld << before;
+	sql << " UNION ALL SELECT " << liveCols << liveBbox << " FROM " << staticLive << before;
+	sql << ") AS candidates ORDER BY version DESC LIMIT 1) AS prev";
+	sql << " UNION ALL SELECT 1 AS adiff_role, changed.id, changed.version, changed.timestamp, changed.*" << noBbox;
+	sql << " FROM changed) ";
+
+	sql << "SELECT pairs.*";
+	if(objType == "node")
+		sql << ", ST_X(geom) AS lon, ST_Y(geom) AS lat FROM pairs";
+	else
+	{
+		//New versions of ways cover the current locations of their nodes, and old versions the
+		//locations their nodes had just before the change. Relations use their current bbox, or
+		//for old versions the bbox kept with the version, if any. The extent is found once
+		//per row and its corners read from that.
+		string newExtent, oldExtent;
+		if(objType == "way")
+		{
+			string memberIds = "ARRAY(SELECT jsonb_array_elements(pairs.members))::text[]::bigint[]";
+			newExtent = "(SELECT ST_Extent(geom)::geometry FROM "+c.quote_name(tableActivePrefix + "visiblenodes")
+				+ " WHERE id = ANY("+memberIds+"))";
+
+			string nodeBefore = " WHERE id = m.id AND timestamp < pairs.adiff_timestamp";
+			oldExtent = "(SELECT ST_Extent(n.geom)::geometry FROM unnest("+memberIds+") AS m(id)"
+				" CROSS JOIN LATERAL (SELECT * FROM ("
+				"SELECT version, geom, visible FROM "+c.quote_name(tableActivePrefix + "oldnodes")+nodeBefore
+				+ " UNION ALL SELECT version, geom, visible FROM "+c.quote_name(tableStaticPrefix + "oldnodes")+nodeBefore
+				+ " UNION ALL SELECT version, geom, true FROM "+c.quote_name(tableActivePrefix + "livenodes")+nodeBefore
+				+ " UNION ALL SELECT version, geom, true FROM "+c.quote_name(tableStaticPrefix + "livenodes")+nodeBefore
+				+ ") AS candidates ORDER BY version DESC LIMIT 1) AS n WHERE n.visible)";
+		}
+		else
+		{
+			newExtent = "(SELECT bbox FROM "+c.quote_name(tableActivePrefix + "visiblerelations")+" WHERE id = pairs.id)";
+			oldExtent = "pairs.adiff_oldbbox";
+		}
+		sql << ", ST_XMin(ext.extent) AS adiff_x1, ST_YMin(ext.extent) AS adiff_y1";
+		sql << ", ST_XMax(ext.extent) AS adiff_x2, ST_YMax(ext.extent) AS adiff_y2";
+		sql << " FROM pairs CROSS JOIN LATERAL (SELECT CASE WHEN pairs.adiff_role = 1";
+		sql << " THEN " << newExtent << " ELSE " << oldExtent << " END AS extent) AS ext";
+	}
+	sql << " ORDER BY adiff_id, adiff_version, adiff_role;";
+
+	pqxx::icursorstream cursor(*work, sql.str(), objType+"adiff", 1000);
+	std::shared_ptr<class OsmObject> oldObj;
+	std::vector<double> oldBbox;
+	std::vector<double> emptyBbox;
+	while(true)
+	{
+		pqxx::result rows;
+		cursor.get(rows);
+		if(rows.empty())
+			break;
+
+		int roleCol = rows.column_number("adiff_role");
+		int x1Col = -1;
+		if(objType != "node")
+			x1Col = rows.column_number("adiff_x1");
+
+		for (pqxx::result::const_iterator row = rows.begin(); row != rows.end(); ++row)
+		{
+			std::shared_ptr<class OsmObject> obj = DecodeAugmentedDiffRow(row, rows, objType, usernames);
+			std::vector<double> bbox;
+			if(x1Col >= 0 and !row[x1Col].is_null())
+				bbox = {row[x1Col].as<double>(), row[x1Col+1].as<double>(), row[x1Col+2].as<double>(), row[x1Col+3].as<double>()};
+			if(!obj->metaData.visible)
+				bbox.clear();
+
+			//A predecessor comes just before the version that replaced it
+			if(row[roleCol].as<int>() == 0)
+			{
+				oldObj = obj;
+				oldBbox = bbox;
+				continue;
+			}
+
+			if(oldObj and oldObj->objId == obj->objId and oldObj->metaData.version < obj->metaData.version)
+			{
+				string action = obj->metaData.visible ? "modify" : "delete";
+				out.StoreAction(action, oldObj.get(), oldBbox, obj.get(), bbox);
+			}
+			else
+				out.StoreAction(obj->metaData.visible ? "create" : "delete", nullptr, emptyBbox, obj.get(), bbox);
+			oldObj.reset();
+		}
+	}
+}
+
+void GetAugmentedDiffStream(pqxx::connection &c, pqxx::transaction_base *work, class DbUsernameLookup &usernames,
+	const std::string &tableStaticPrefix,
+	const std::string &tableActivePrefix,
+	int64_t timestampStart, int64_t timestampEnd,
+	class IAugmentedDiffHandler &out)
+{
+	string objTypes[] = {"node", "way", "relation"};
+	for(int i=0; i<3; i++)
+		GetAugmentedDiffObjects(c, work, usernames, tableStaticPrefix, tableActivePrefix,
+			objTypes[i], timestampStart, timestampEnd, out);
+}
@@ -0,0 +1,57 @@
+#ifndef _DB_AUGMENTED_DIFF_H
+#define _DB_AUGMENTED_DIFF_H
+
+#include <pqxx/pqxx>
+#include <string>
+#include <vector>
+#include <streambuf>
+#include "dbusername.h"
+#include "cppo5m/OsmData.h"
+
+///Receives each changed object version with the version before it
+class IAugmentedDiffHandler
+{
+public:
+	virtual ~IAugmentedDiffHandler() {};
+
+	///action is create, modify or delete. oldObj is null for a create. Bboxes are x1, y1,
+	///x2, y2, or empty for nodes and where the extent is not known. oldBbox is the extent
+	///of the old version itself, never one taken from current data.
+	virtual void StoreAction(const std::string &action,
+		const class OsmObject *oldObj, const std::vector<double> &oldBbox,
+		const class OsmObject *newObj, const std::vector<double> &newBbox) = 0;
+};
+
+///Writes an augmented diff in the Overpass adiff XML format, with the bbox of each way
+///and relation as a bounds element
+class AugmentedDiffXmlEncode : public IAugmentedDiffHandler
+{
+public:
+	AugmentedDiffXmlEncode(std::streambuf &outIn);
+	virtual ~AugmentedDiffXmlEncode();
+
+	void StoreAction(const std::string &action,
+		const class OsmObject *oldObj, const std::vector<double> &oldBbox,
+		const class OsmObject *newObj, const std::vector<double> &newBbox);
+	void Finish();
+
+protected:
+	void WriteObject(const class OsmObject *obj, const std::vector<double> &bbox);
+	void Write(const std::string &str);
+
+	std::streambuf &out;
+	bool finished;
+};
+
+///Pairs each object version with a timestamp after timestampStart, up to and including
+///timestampEnd, with its previous version and passes them to out. Each object type is read
+///with one query that finds the changed versions with the timestamp indexes and their
+///predecessors with the (id, version) keys of the old and live tables, so the pairs
+///stream from a single cursor. Types are written in turn, each in ID then version order.
+void GetAugmentedDiffStream(pqxx::connection &c, pqxx::transaction_base *work, class DbUsernameLookup &usernames,
+	const std::string &tableStaticPrefix,
+	const std::string &tableActivePrefix,
+	int64_t timestampStart, int64_t timestampEnd,
+	class IAugmentedDiffHandler &out);
+
+#endif //_DB_AUGMENTED_DIFF_H
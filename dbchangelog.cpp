@@ -0,0 +1,268 @@
+#include "dbchangelog.h"
+#include "dbcommon.h"
+#include "dbmeta.h"
+#include <iostream>
+#include <sstream>
+#include <ctime>
+using namespace std;
+
+#if PQXX_VERSION_MAJOR >= 6
+#define pqxxrow pqxx::row
+#else
+#define pqxxrow pqxx::result::tuple
+#endif 
+
+ChangeLogEntry::ChangeLogEntry():
+	objId(0),
+	version(0),
+	timestamp(0),
+	visible(true)
+{
+
+}
+
+ChangeLogEntry::~ChangeLogEntry()
+{
+
+}
+
+ChangeLogEntry::ChangeLogEntry( const ChangeLogEntry &obj)
+{
+	*this = obj;
+}
+
+ChangeLogEntry& ChangeLogEntry::operator=(const ChangeLogEntry &arg)
+{
+	objType = arg.objType;
+	objId = arg.objId;
+	version = arg.version;
+	timestamp = arg.timestamp;
+	visible = arg.visible;
+	bbox = arg.bbox;
+	return *this;
+}
+
+// **********************************************
+
+//Envelope covering two geometries, either of which may be null
+string ChangeLogMergeExtent(const string &a, const string &b)
+{
+	return "CASE WHEN "+a+" IS NULL THEN ST_Envelope("+b+") WHEN "+b+" IS NULL THEN ST_Envelope("+a+")"
+		+ " ELSE ST_Envelope(ST_Collect("+a+", "+b+")) END";
+}
+
+bool DbChangeLogTriggersExist(pqxx::connection &c, pqxx::transaction_base *work,
+	const std::string &tablePrefix)
+{
+	string objTypes[] = {"node", "way", "relation"};
+	string tableTypes[] = {"live", "old"};
+	stringstream sql;
+	sql << "SELECT COUNT(*) FROM pg_trigger WHERE NOT tgisinternal AND (";
+	for(int i=0; i<3; i++)
+		for(int j=0; j<2; j++)
+		{
+			if(i > 0 or j > 0)
+				sql << " OR ";
+			string table = tablePrefix+tableTypes[j]+objTypes[i]+"s";
+			sql << "(tgrelid = to_regclass(" << c.quote(c.quote_name(table)) << ") AND tgname = ";
+			sql << c.quote(tablePrefix+"changelog_"+tableTypes[j]+objTypes[i]+"s") << ")";
+		}
+	sql << ");";
+	pqxx::result r = work->exec(sql.str());
+	return r[0][0].as<int>() == 6;
+}
+
+bool DbCreateChangeLog(pqxx::connection &c, pqxx::transaction_base *work,
+	int verbose,
+	const std::string &tablePrefix,
+	std::string &errStr)
+{
+	//Anything written while a trigger was missing is not in the log
+	bool complete = DbChangeLogTriggersExist(c, work, tablePrefix);
+
+	string logTable = c.quote_name(tablePrefix+"changelog");
+	string sql = "CREATE TABLE IF NOT EXISTS "+logTable+" (objtype VARCHAR(8), id BIGINT, version INTEGER, timestamp BIGINT, visible BOOLEAN, bbox GEOMETRY(Geometry, 4326), PRIMARY KEY(objtype, id, version));";
+	bool ok = DbExec(work, sql, errStr, nullptr, verbose); if(!ok) return ok;
+
+	//Consumers read a time range, so this is the only index that is needed apart from the key
+	sql = "CREATE INDEX IF NOT EXISTS "+c.quote_name(tablePrefix+"changelog_ts")+" ON "+logTable+" (timestamp);";
+	ok = DbExec(work, sql, errStr, nullptr, verbose); if(!ok) return ok;
+
+	string objTypes[] = {"node", "way", "relation"};
+	for(int i=0; i<3; i++)
+	{
+		const string &objType = objTypes[i];
+		string typeVal = c.quote(objType);
+		string liveTable = c.quote_name(tablePrefix+"live"+objType+"s");
+		string oldTable = c.quote_name(tablePrefix+"old"+objType+"s");
+		string extentCol = objType == "node" ? "geom" : "bbox";
+
+		//New versions in the live table cover where the object was and where it is now. A later
+		//update of a way or relation bbox (without a new version) widens that version's entry.
+		string liveFunc = c.quote_name(tablePrefix+"changelog_live"+objType+"s");
+		stringstream ss;
+		ss << "CREATE OR REPLACE FUNCTION " << liveFunc << "() RETURNS trigger AS $$\n";
+		ss << "DECLARE\n";
+		ss << "	extent GEOMETRY;\n";
+		ss << "BEGIN\n";
+		ss << "	IF TG_OP = 'INSERT' THEN\n";
+		ss << "		extent := ST_Envelope(NEW." << extentCol << ");\n";
+		ss << "	ELSIF NEW.version <> OLD.version THEN\n";
+		ss << "		extent := " << ChangeLogMergeExtent("OLD."+extentCol, "NEW."+extentCol) << ";\n";
+		ss << "	ELSE\n";
+		ss << "		IF NEW." << extentCol << " IS DISTINCT FROM OLD." << extentCol << " THEN\n";
+		ss << "			UPDATE " << logTable << " SET bbox = " << ChangeLogMergeExtent("bbox", "NEW."+extentCol);
+		ss << " WHERE objtype = " << typeVal << " AND id = NEW.id AND version = NEW.version;\n";
+		ss << "		END IF;\n";
+		ss << "		RETURN NULL;\n";
+		ss << "	END IF;\n";
+		ss << "	INSERT INTO " << logTable << " (objtype, id, version, timestamp, visible, bbox)";
+		ss << " VALUES (" << typeVal << ", NEW.id, NEW.version, NEW.timestamp, true, extent) ON CONFLICT DO NOTHING;\n";
+		ss << "	RETURN NULL;\n";
+		ss << "END;\n";
+		ss << "$$ LANGUAGE plpgsql;";
+		ok = DbExec(work, ss.str(), errStr, nullptr, verbose); if(!ok) return ok;
+
+		//Superseded versions are copied to the old table as visible, so only deletions are
+		//recorded from it. Their extent is that of the previous version, if it is known.
+		string prevExtent = "(SELECT bbox FROM "+logTable+" WHERE objtype = "+typeVal
+			+" AND id = NEW.id AND version < NEW.version ORDER BY version DESC LIMIT 1)";
+		if(objType == "node")
+			prevExtent = "COALESCE("+prevExtent+", (SELECT geom FROM "+oldTable
+				+" WHERE id = NEW.id AND version < NEW.version ORDER BY version DESC LIMIT 1))";
+		string oldFunc = c.quote_name(tablePrefix+"changelog_old"+objType+"s");
+		ss.str("");
+		ss << "CREATE OR REPLACE FUNCTION " << oldFunc << "() RETURNS trigger AS $$\n";
+		ss << "BEGIN\n";
+		ss << "	INSERT INTO " << logTable << " (objtype, id, version, timestamp, visible, bbox)";
+		ss << " VALUES (" << typeVal << ", NEW.id, NEW.version, NEW.timestamp, false, " << prevExtent << ") ON CONFLICT DO NOTHING;\n";
+		ss << "	RETURN NULL;\n";
+		ss << "END;\n";
+		ss << "$$ LANGUAGE plpgsql;";
+		ok = DbExec(work, ss.str(), errStr, nullptr, verbose); if(!ok) return ok;
+
+		string liveTrigger = c.quote_name(tablePrefix+"changelog_live"+objType+"s");
+		sql = "DROP TRIGGER IF EXISTS "+liveTrigger+" ON "+liveTable+";";
+		ok = DbExec(work, sql, errStr, nullptr, verbose); if(!ok) return ok;
+		sql = "CREATE TRIGGER "+liveTrigger+" AFTER INSERT OR UPDATE ON "+liveTable
+			+" FOR EACH ROW EXECUTE PROCEDURE "+liveFunc+"();";
+		ok = DbExec(work, sql, errStr, nullptr, verbose); if(!ok) return ok;
+
+		string oldTrigger = c.quote_name(tablePrefix+"changelog_old"+objType+"s");
+		sql = "DROP TRIGGER IF EXISTS "+oldTrigger+" ON "+oldTable+";";
+		ok = DbExec(work, sql, errStr, nullptr, verbose); if(!ok) return ok;
+		sql = "CREATE TRIGGER "+oldTrigger+" AFTER INSERT ON "+oldTable
+			+" FOR EACH ROW WHEN (NOT NEW.visible) EXECUTE PROCEDURE "+oldFunc+"();";
+		ok = DbExec(work, sql, errStr, nullptr, verbose); if(!ok) return ok;
+	}
+
+	//Writes before now were not recorded
+	bool hasStart = false;
+	try
+	{
+		DbGetMetaValue(c, work, "changelog_start", tablePrefix, errStr);
+		hasStart = true;
+	}
+	catch (const std::exception &)
+	{
+		hasStart = false;
+	}
+	if(!hasStart or !complete)
+		ok = DbSetMetaValue(c, work, "changelog_start", to_string((int64_t)time(nullptr)), tablePrefix, errStr);
+	return ok;
+}
+
+bool DbDropChangeLog(pqxx::connection &c, pqxx::transaction_base *work,
+	int verbose,
+	const std::string &tablePrefix,
+	std::string &errStr)
+{
+	bool ok = true;
+	string objTypes[] = {"node", "way", "relation"};
+	string tableTypes[] = {"live", "old"};
+	for(int i=0; i<3; i++)
+		for(int j=0; j<2; j++)
+		{
+			string name = tablePrefix+"changelog_"+tableTypes[j]+objTypes[i]+"s";
+			string sql = "DROP TRIGGER IF EXISTS "+c.quote_name(name)+" ON "+c.quote_name(tablePrefix+tableTypes[j]+objTypes[i]+"s")+";";
+			ok = DbExec(work, sql, errStr, nullptr, verbose); if(!ok) return ok;
+			sql = "DROP FUNCTION IF EXISTS "+c.quote_name(name)+"();";
+			ok = DbExec(work, sql, errStr, nullptr, verbose); if(!ok) return ok;
+		}
+
+	string sql = "DROP TABLE IF EXISTS "+c.quote_name(tablePrefix+"changelog")+";";
+	ok = DbExec(work, sql, errStr, nullptr, verbose); if(!ok) return ok;
+	sql = "DELETE FROM "+c.quote_name(tablePrefix+"meta")+" WHERE key = 'changelog_start';";
+	return DbExec(work, sql, errStr, nullptr, verbose);
+}
+
+bool DbPruneChangeLog(pqxx::connection &c, pqxx::transaction_base *work,
+	int verbose,
+	const std::string &tablePrefix,
+	int64_t beforeTimestamp,
+	std::string &errStr)
+{
+	int64_t logStart = DbChangeLogStart(c, work, tablePrefix);
+	if(logStart < 0)
+	{
+		errStr = "No changelog in this table set";
+		return false;
+	}
+
+	string sql = "DELETE FROM "+c.quote_name(tablePrefix+"changelog")+" WHERE timestamp < "+to_string(beforeTimestamp)+";";
+	size_t rowsAffected = 0;
+	bool ok = DbExec(work, sql, errStr, &rowsAffected, verbose); if(!ok) return ok;
+	if(verbose >= 1)
+		cout << "Removed " << rowsAffected << " changelog entries" << endl;
+
+	//Ranges that end before the remaining entries can no longer be read from the log
+	if(beforeTimestamp - 1 > logStart)
+		ok = DbSetMetaValue(c, work, "changelog_start", to_string(beforeTimestamp - 1), tablePrefix, errStr);
+	return ok;
+}
+
+int64_t DbChangeLogStart(pqxx::connection &c, pqxx::transaction_base *work,
+	const std::string &tablePrefix)
+{
+	if(!DbCheckTableExists(c, work, tablePrefix+"changelog"))
+		return -1;
+	//Without all of its triggers, the log misses changes
+	if(!DbChangeLogTriggersExist(c, work, tablePrefix))
+		return -1;
+	string errStr;
+	try
+	{
+		return atol(DbGetMetaValue(c, work, "changelog_start", tablePrefix, errStr).c_str());
+	}
+	catch (const std::exception &)
+	{
+		return -1;
+	}
+}
+
+void DbGetChangeLog(pqxx::connection &c, pqxx::transaction_base *work,
+	const std::string &tablePrefix,
+	int64_t timestampStart, int64_t timestampEnd,
+	std::vector<class ChangeLogEntry> &entriesOut)
+{
+	stringstream sql;
+	sql << "SELECT objtype, id, version, timestamp, visible, ST_XMin(bbox) AS x1, ST_YMin(bbox) AS y1,";
+	sql << " ST_XMax(bbox) AS x2, ST_YMax(bbox) AS y2 FROM " << c.quote_name(tablePrefix+"changelog");
+	sql << " WHERE timestamp > " << timestampStart << " AND timestamp <= " << timestampEnd;
+	sql << " ORDER BY timestamp, objtype, id, version;";
+
+	pqxx::result r = work->exec(sql.str());
+	for (unsigned int rownum=0; rownum < r.size(); ++rownum)
+	{
+		const pqxxrow row = r[rownum];
+		class ChangeLogEntry entry;
+		entry.objType = row["objtype"].as<string>();
+		entry.objId = row["id"].as<int64_t>();
+		entry.version = row["version"].as<int64_t>();
+		entry.timestamp = row["timestamp"].as<int64_t>();
+		entry.visible = row["visible"].as<bool>();
+		if(!row["x1"].is_null())
+			entry.bbox = {row["x1"].as<double>(), row["y1"].as<double>(), row["x2"].as<double>(), row["y2"].as<double>()};
+		entriesOut.push_back(entry);
+	}
+}
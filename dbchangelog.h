@@ -0,0 +1,64 @@
+#ifndef _DB_CHANGE_LOG_H
+#define _DB_CHANGE_LOG_H
+
+#include <pqxx/pqxx> //apt install libpqxx-dev
+#include <string>
+#include <vector>
+
+///One version of an object that was written to the active tables
+class ChangeLogEntry
+{
+public:
+	std::string objType;
+	int64_t objId;
+	int64_t version;
+	int64_t timestamp;
+	bool visible;
+	//x1, y1, x2, y2 of the object before and after the change, empty if not known
+	std::vector<double> bbox;
+
+	ChangeLogEntry();
+	virtual ~ChangeLogEntry();
+
+	ChangeLogEntry( const ChangeLogEntry &obj);
+	ChangeLogEntry& operator=(const ChangeLogEntry &arg);
+};
+
+///Creates the changelog table of a table set, with triggers on its live and old tables
+///that record every object version written from then on. If the log exists but a trigger
+///was missing, the log is treated as starting now. Bboxes of ways and relations
+///are filled in when they are updated later in the same transaction.
+bool DbCreateChangeLog(pqxx::connection &c, pqxx::transaction_base *work,
+	int verbose,
+	const std::string &tablePrefix,
+	std::string &errStr);
+
+bool DbDropChangeLog(pqxx::connection &c, pqxx::transaction_base *work,
+	int verbose,
+	const std::string &tablePrefix,
+	std::string &errStr);
+
+///Removes entries with timestamps before beforeTimestamp
+bool DbPruneChangeLog(pqxx::connection &c, pqxx::transaction_base *work,
+	int verbose,
+	const std::string &tablePrefix,
+	int64_t beforeTimestamp,
+	std::string &errStr);
+
+///True if every trigger that fills the changelog is in place
+bool DbChangeLogTriggersExist(pqxx::connection &c, pqxx::transaction_base *work,
+	const std::string &tablePrefix);
+
+///The earliest timestamp the changelog is complete from, or -1 if there is no changelog
+///or any of its triggers are missing
+int64_t DbChangeLogStart(pqxx::connection &c, pqxx::transaction_base *work,
+	const std::string &tablePrefix);
+
+///Reads the entries with timestamps after timestampStart, up to and including
+///timestampEnd, in timestamp order
+void DbGetChangeLog(pqxx::connection &c, pqxx::transaction_base *work,
+	const std::string &tablePrefix,
+	int64_t timestampStart, int64_t timestampEnd,
+	std::vector<class ChangeLogEntry> &entriesOut);
+
+#endif //_DB_CHANGE_LOG_H
@@ -1,5 +1,6 @@
 #include "dbcommon.h"
 #include <iostream>
+#include <sstream>
 using namespace std;
 
 #if PQXX_VERSION_MAJOR >= 6
@@ -65,7 +66,7 @@ bool DbCheckIndexExists(pqxx::connection &c, pqxx::transaction_base *work,
 
 	string sql = "SELECT c.relname FROM pg_class c JOIN pg_namespace n";
 	sql += " ON n.oid = c.relnamespace WHERE n.nspname = 'public'";
-	sql += " AND c.relkind='i' AND c.relname="+c.quote(indexName)+";";
+	sql += " AND c.relkind IN ('i', 'I') AND c.relname="+c.quote(indexName)+";";
 
 	pqxx::result r = work->exec(sql);
 	return r.size() > 0;
@@ -84,6 +85,35 @@ bool DbCheckTableExists(pqxx::connection &c, pqxx::transaction_base *work,
 	return r.size() > 0;
 }
 
+void DbGetPartitions(pqxx::connection &c, pqxx::transaction_base *work, 
+	const string &tableName, std::vector<std::string> &partitionsOut)
+{
+	string sql = "SELECT child.relname FROM pg_inherits AS i";
+	sql += " INNER JOIN pg_class AS parent ON parent.oid = i.inhparent";
+	sql += " INNER JOIN pg_class AS child ON child.oid = i.inhrelid";
+	sql += " INNER JOIN pg_namespace AS n ON n.oid = parent.relnamespace";
+	sql += " WHERE n.nspname = 'public' AND parent.relkind = 'p' AND parent.relname = "+c.quote(tableName);
+	sql += " ORDER BY child.relname;";
+
+	pqxx::result r = work->exec(sql);
+	for (unsigned int rownum=0; rownum < r.size(); ++rownum)
+		partitionsOut.push_back(r[rownum][0].as<string>());
+}
+
+string DbIdListCondition(const string &column, const std::vector<int64_t> &ids)
+{
+	stringstream ss;
+	ss << column << " = ANY(ARRAY[";
+	for(size_t i=0; i<ids.size(); i++)
+	{
+		if(i > 0)
+			ss << ",";
+		ss << ids[i];
+	}
+	ss << "]::BIGINT[])";
+	return ss.str();
+}
+
 void DbGetVersion(pqxx::connection &c, pqxx::transaction_base *work, int &majorVerOut, int &minorVerOut)
 {
 	string sql = "SELECT current_setting('server_version_num');";
@@ -45,6 +45,14 @@ bool DbCheckIndexExists(pqxx::connection &c, pqxx::transaction_base *work,
 bool DbCheckTableExists(pqxx::connection &c, pqxx::transaction_base *work, 
 	const std::string &tableName);
 
+//Lists the partitions of a partitioned table. Empty if the table is not partitioned.
+void DbGetPartitions(pqxx::connection &c, pqxx::transaction_base *work, 
+	const std::string &tableName, std::vector<std::string> &partitionsOut);
+
+//Matches a column against a list of IDs as a single array comparison, which the planner 
+//can use to skip ID range partitions that hold none of them.
+std::string DbIdListCondition(const std::string &column, const std::vector<int64_t> &ids);
+
 void DbGetVersion(pqxx::connection &c, pqxx::transaction_base *work, int &majorVerOut, int &minorVerOut);
 
 #endif //_DB_COMMON_H
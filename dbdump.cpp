@@ -1,107 +1,247 @@
 #include "dbdump.h"
 #include "dbdecode.h"
 
-/**
-* Dump visible nodes. Only current
-* nodes are dumped, not old (non-visible) nodes.
-*/
-void DumpNodes(pqxx::connection &c, pqxx::transaction_base *work, class DbUsernameLookup &usernames, 
-	const string &tablePrefix, 
-	bool order,
-	std::shared_ptr<IDataStreamHandler> enc)
+DumpCursorSource::DumpCursorSource(pqxx::transaction_base *work, class DbUsernameLookup &usernames,
+		const std::string &objType, const std::string &sql, const std::string &cursorName):
+	usernames(usernames),
+	objType(objType),
+	cursor(*work, sql, cursorName, 1000),
+	cursorDone(false),
+	buffer(new class OsmData()),
+	bufferPos(0)
 {
-	string vNodeTable = c.quote_name(tablePrefix + "visiblenodes");
-	string excludeTable;
-
-	//Discourage sequential scans of tables, since they are not necessary and we want to avoid doing a sort
-	work->exec("set enable_seqscan to off;");
-
-	/*
-		                                                    QUERY PLAN                                                        
-	--------------------------------------------------------------------------------------------------------------------------
-	 Merge Anti Join  (cost=1.01..50174008.28 rows=1365191502 width=8)
-	   Merge Cond: (planet_livenodes.id = planet_mod_nodeids.id)
-	   ->  Index Only Scan using planet_livenodes_pkey on planet_livenodes  (cost=0.58..35528317.86 rows=1368180352 width=8)
-	   ->  Index Only Scan using planet_mod_nodeids_pkey on planet_mod_nodeids  (cost=0.43..11707757.01 rows=2988850 width=8)
-	(4 rows)
-	*/
 
-	stringstream sql;
-	sql << "SELECT "<< vNodeTable << ".*, ST_X(geom) as lon, ST_Y(geom) AS lat FROM ";
-	sql << vNodeTable;
-	if(excludeTable.size() > 0)
+}
+
+DumpCursorSource::~DumpCursorSource()
+{
+
+}
+
+//Reads the next batch from the cursor once the buffer is used up
+bool DumpCursorSource::FillBuffer()
+{
+	while(bufferPos >= buffer->nodes.size() + buffer->ways.size() + buffer->relations.size())
 	{
-		sql << " LEFT JOIN "<<excludeTable<<" ON "<<vNodeTable<<".id = "<<excludeTable<<".id";
-		sql << " WHERE "<<excludeTable<<".id IS NULL";
+		if(cursorDone)
+			return false;
+		buffer.reset(new class OsmData());
+		bufferPos = 0;
+		int count = 0;
+		if(objType == "node")
+			count = NodeResultsToEncoder(cursor, usernames, buffer);
+		else if(objType == "way")
+			count = WayResultsToEncoder(cursor, usernames, buffer);
+		else
+		{
+			set<int64_t> empty;
+			count = RelationBatchToEncoder(cursor, usernames, empty, buffer);
+		}
+		if(count == 0)
+			cursorDone = true;
 	}
-	if(order)
-		sql << " ORDER BY " << vNodeTable << ".id";
-	sql << ";";
-	//cout << sql.str() << endl;
+	return true;
+}
 
-	pqxx::icursorstream cursor( *work, sql.str(), "nodecursor", 1000 );	
+const class OsmObject *DumpCursorSource::PeekNext()
+{
+	if(!FillBuffer())
+		return nullptr;
+	if(objType == "node")
+		return &buffer->nodes[bufferPos];
+	if(objType == "way")
+		return &buffer->ways[bufferPos];
+	return &buffer->relations[bufferPos];
+}
 
-	int count = 1;
-	while(count > 0)
-		count = NodeResultsToEncoder(cursor, usernames, enc);
+int64_t DumpCursorSource::NextId()
+{
+	const class OsmObject *obj = PeekNext();
+	if(obj == nullptr)
+		return -1;
+	return obj->objId;
 }
 
-void DumpWays(pqxx::connection &c, pqxx::transaction_base *work, class DbUsernameLookup &usernames, 
-	const string &tablePrefix, 
-	bool order,
+const std::string &DumpCursorSource::GetObjType() const
+{
+	return objType;
+}
+
+void DumpCursorSource::WriteNext(std::shared_ptr<IDataStreamHandler> enc)
+{
+	if(!FillBuffer())
+		return;
+	if(objType == "node")
+	{
+		const class OsmNode &node = buffer->nodes[bufferPos];
+		enc->StoreNode(node.objId, node.metaData, node.tags, node.lat, node.lon);
+	}
+	else if(objType == "way")
+	{
+		const class OsmWay &way = buffer->ways[bufferPos];
+		enc->StoreWay(way.objId, way.metaData, way.tags, way.refs);
+	}
+	else
+	{
+		const class OsmRelation &relation = buffer->relations[bufferPos];
+		enc->StoreRelation(relation.objId, relation.metaData, relation.tags, 
+			relation.refTypeStrs, relation.refIds, relation.refRoles);
+	}
+	bufferPos ++;
+}
+
+void DumpCursorSource::SkipNext()
+{
+	if(FillBuffer())
+		bufferPos ++;
+}
+
+int64_t DumpMergeSources(std::vector<std::shared_ptr<class DumpCursorSource> > &sources,
 	std::shared_ptr<IDataStreamHandler> enc)
 {
-	string wayTable = c.quote_name(tablePrefix + "visibleways");
-	string excludeTable;
+	int64_t count = 0;
+	while(true)
+	{
+		//Only a few sources are merged, so a linear search for the lowest ID is enough
+		int64_t lowestId = -1;
+		int lowest = -1;
+		for(size_t i=0; i<sources.size(); i++)
+		{
+			int64_t nextId = sources[i]->NextId();
+			if(nextId == -1)
+				continue;
+			if(lowest == -1 or nextId <= lowestId)
+			{
+				lowestId = nextId;
+				lowest = i;
+			}
+		}
+		if(lowest == -1)
+			break;
+
+		for(size_t i=0; i<sources.size(); i++)
+			if((int)i != lowest and sources[i]->NextId() == lowestId)
+				sources[i]->SkipNext();
+		sources[lowest]->WriteNext(enc);
+		count ++;
+	}
+	return count;
+}
 
-	//Discourage sequential scans of tables, since they are not necessary and we want to avoid doing a sort
-	work->exec("set enable_seqscan to off;");
+/**
+* Dump visible objects of one type. In order, each table set is read with its own
+* index scan and the scans are merged here, rather than sorting the visible view.
+*/
+void DumpObjects(pqxx::connection &c, pqxx::transaction_base *work, class DbUsernameLookup &usernames, 
+	const string &tableStaticPrefix, 
+	const string &tableActivePrefix, 
+	const string &objType,
+	bool order,
+	std::shared_ptr<IDataStreamHandler> enc)
+{
+	string geomCols;
+	if(objType == "node")
+		geomCols = ", ST_X(geom) as lon, ST_Y(geom) AS lat";
 
-	stringstream sql;
-	sql << "SELECT " << wayTable << ".* FROM ";
-	sql << wayTable;
-	if(excludeTable.size() > 0)
+	std::vector<std::shared_ptr<class DumpCursorSource> > sources;
+	if(!order)
 	{
-		sql << " LEFT JOIN "<<excludeTable<<" ON "<<wayTable<<".id = "<<excludeTable<<".id";
-		sql << " WHERE "<<excludeTable<<".id IS NULL";
+		string visibleTable = c.quote_name(tableActivePrefix + "visible" + objType + "s");
+		string sql = "SELECT " + visibleTable + ".*" + geomCols + " FROM " + visibleTable + ";";
+		sources.push_back(make_shared<class DumpCursorSource>(work, usernames, objType, sql, objType+"cursor"));
+	}
+	else
+	{
+		/*
+			                                                    QUERY PLAN                                                        
+		--------------------------------------------------------------------------------------------------------------------------
+		 Merge Anti Join  (cost=1.01..50174008.28 rows=1365191502 width=8)
+		   Merge Cond: (planet_livenodes.id = planet_mod_nodeids.id)
+		   ->  Index Only Scan using planet_livenodes_pkey on planet_livenodes  (cost=0.58..35528317.86 rows=1368180352 width=8)
+		   ->  Index Only Scan using planet_mod_nodeids_pkey on planet_mod_nodeids  (cost=0.43..11707757.01 rows=2988850 width=8)
+		(4 rows)
+		*/
+		string activeLive = c.quote_name(tableActivePrefix + "live" + objType + "s");
+		if(tableStaticPrefix.size() > 0 and tableStaticPrefix != tableActivePrefix)
+		{
+			string staticLive = c.quote_name(tableStaticPrefix + "live" + objType + "s");
+			string excludeTable = c.quote_name(tableActivePrefix + objType + "ids");
+			stringstream sql;
+			sql << "SELECT " << staticLive << ".*" << geomCols << " FROM " << staticLive;
+			sql << " LEFT JOIN " << excludeTable << " ON " << staticLive << ".id = " << excludeTable << ".id";
+			sql << " WHERE " << excludeTable << ".id IS NULL";
+			sql << " ORDER BY " << staticLive << ".id;";
+			sources.push_back(make_shared<class DumpCursorSource>(work, usernames, objType, sql.str(), "static"+objType+"cursor"));
+		}
+
+		stringstream sql;
+		sql << "SELECT " << activeLive << ".*" << geomCols << " FROM " << activeLive;
+		sql << " ORDER BY " << activeLive << ".id;";
+		sources.push_back(make_shared<class DumpCursorSource>(work, usernames, objType, sql.str(), "active"+objType+"cursor"));
 	}
-	if(order)
-		sql << " ORDER BY " << wayTable << ".id";
-	sql << ";";
 
-	pqxx::icursorstream cursor( *work, sql.str(), "waycursor", 1000 );	
+	DumpMergeSources(sources, enc);
+}
 
-	int count = 1;
-	while (count > 0)
-		count = WayResultsToEncoder(cursor, usernames, enc);
+void DumpNodes(pqxx::connection &c, pqxx::transaction_base *work, class DbUsernameLookup &usernames, 
+	const string &tableStaticPrefix, 
+	const string &tableActivePrefix, 
+	bool order,
+	std::shared_ptr<IDataStreamHandler> enc)
+{
+	DumpObjects(c, work, usernames, tableStaticPrefix, tableActivePrefix, "node", order, enc);
+}
+
+void DumpWays(pqxx::connection &c, pqxx::transaction_base *work, class DbUsernameLookup &usernames, 
+	const string &tableStaticPrefix, 
+	const string &tableActivePrefix, 
+	bool order,
+	std::shared_ptr<IDataStreamHandler> enc)
+{
+	DumpObjects(c, work, usernames, tableStaticPrefix, tableActivePrefix, "way", order, enc);
 }
 
 void DumpRelations(pqxx::connection &c, pqxx::transaction_base *work, class DbUsernameLookup &usernames, 
-	const string &tablePrefix, 
+	const string &tableStaticPrefix, 
+	const string &tableActivePrefix, 
 	bool order,
 	std::shared_ptr<IDataStreamHandler> enc)
 {
-	string relationTable = c.quote_name(tablePrefix + "visiblerelations");
-	string excludeTable;
+	DumpObjects(c, work, usernames, tableStaticPrefix, tableActivePrefix, "relation", order, enc);
+}
 
-	//Discourage sequential scans of tables, since they are not necessary and we want to avoid doing a sort
-	work->exec("set enable_seqscan to off;");
+/**
+* Dump visible objects of one type with IDs from startId up to (but not including) 
+* endId, in ID order.
+*/
+void DumpObjectRange(pqxx::connection &c, pqxx::transaction_base *work, class DbUsernameLookup &usernames, 
+	const string &tablePrefix, 
+	const std::string &objType,
+	int64_t startId, int64_t endId,
+	std::shared_ptr<IDataStreamHandler> enc)
+{
+	string objTable = c.quote_name(tablePrefix + "visible" + objType + "s");
 
 	stringstream sql;
-	sql << "SELECT " << relationTable << ".* FROM ";
-	sql << relationTable;
-	if(excludeTable.size() > 0)
-	{
-		sql << " LEFT JOIN "<<excludeTable<<" ON "<<relationTable<<".id = "<<excludeTable<<".id";
-		sql << " WHERE "<<excludeTable<<".id IS NULL";
-	}
-	if(order)
-		sql << " ORDER BY " << relationTable << ".id";
-	sql << ";";
+	sql << "SELECT " << objTable << ".*";
+	if(objType == "node")
+		sql << ", ST_X(geom) as lon, ST_Y(geom) AS lat";
+	sql << " FROM " << objTable;
+	sql << " WHERE " << objTable << ".id >= " << startId << " AND " << objTable << ".id < " << endId;
+	sql << " ORDER BY " << objTable << ".id;";
 
-	pqxx::icursorstream cursor( *work, sql.str(), "relationcursor", 1000 );	
+	pqxx::icursorstream cursor( *work, sql.str(), "rangecursor", 1000 );	
 
-	set<int64_t> empty;
-	RelationResultsToEncoder(cursor, usernames, empty, enc);
+	int count = 1;
+	if(objType == "node")
+		while(count > 0)
+			count = NodeResultsToEncoder(cursor, usernames, enc);
+	if(objType == "way")
+		while(count > 0)
+			count = WayResultsToEncoder(cursor, usernames, enc);
+	if(objType == "relation")
+	{
+		set<int64_t> empty;
+		RelationResultsToEncoder(cursor, usernames, empty, enc);
+	}
 }
-
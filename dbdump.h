@@ -7,17 +7,64 @@
 #include "cppo5m/o5m.h"
 #include "cppo5m/OsmData.h"
 
+///Reads objects of one type from a cursor, a batch at a time, so they can be merged
+///with other sources
+class DumpCursorSource
+{
+public:
+	DumpCursorSource(pqxx::transaction_base *work, class DbUsernameLookup &usernames,
+		const std::string &objType, const std::string &sql, const std::string &cursorName);
+	virtual ~DumpCursorSource();
+
+	///The next object, or nullptr at the end of the cursor. It is valid until the source moves on.
+	const class OsmObject *PeekNext();
+	///ID of the next object, or -1 at the end of the cursor
+	int64_t NextId();
+	const std::string &GetObjType() const;
+	void WriteNext(std::shared_ptr<IDataStreamHandler> enc);
+	void SkipNext();
+
+protected:
+	bool FillBuffer();
+
+	class DbUsernameLookup &usernames;
+	std::string objType;
+	pqxx::icursorstream cursor;
+	bool cursorDone;
+	std::shared_ptr<class OsmData> buffer;
+	size_t bufferPos;
+};
+
+///Writes the objects of sources that are each in ID order to enc, in ID order. Where
+///sources have the same ID, only the object from the last of them is written.
+int64_t DumpMergeSources(std::vector<std::shared_ptr<class DumpCursorSource> > &sources,
+	std::shared_ptr<IDataStreamHandler> enc);
+
+void DumpObjects(pqxx::connection &c, pqxx::transaction_base *work, class DbUsernameLookup &usernames, 
+	const std::string &tableStaticPrefix, 
+	const std::string &tableActivePrefix, 
+	const std::string &objType,
+	bool order,
+	std::shared_ptr<IDataStreamHandler> enc);
 void DumpNodes(pqxx::connection &c, pqxx::transaction_base *work, class DbUsernameLookup &usernames, 
-	const std::string &tablePrefix, 
+	const std::string &tableStaticPrefix, 
+	const std::string &tableActivePrefix, 
 	bool order,
 	std::shared_ptr<IDataStreamHandler> enc);
 void DumpWays(pqxx::connection &c, pqxx::transaction_base *work, class DbUsernameLookup &usernames, 
-	const std::string &tablePrefix, 
+	const std::string &tableStaticPrefix, 
+	const std::string &tableActivePrefix, 
 	bool order,
 	std::shared_ptr<IDataStreamHandler> enc);
 void DumpRelations(pqxx::connection &c, pqxx::transaction_base *work, class DbUsernameLookup &usernames, 
-	const std::string &tablePrefix, 
+	const std::string &tableStaticPrefix, 
+	const std::string &tableActivePrefix, 
 	bool order,
 	std::shared_ptr<IDataStreamHandler> enc);
+void DumpObjectRange(pqxx::connection &c, pqxx::transaction_base *work, class DbUsernameLookup &usernames, 
+	const std::string &tablePrefix, 
+	const std::string &objType,
+	int64_t startId, int64_t endId,
+	std::shared_ptr<IDataStreamHandler> enc);
 
 #endif //_DB_DUMP_H
@@ -0,0 +1,194 @@
+#include "dbdumpincremental.h"
+#include "dbdump.h"
+#include <sstream>
+#include <stdexcept>
+using namespace std;
+
+static const char *mergeObjTypes[] = {"", "node", "way", "relation"};
+
+DumpMergeChanges::DumpMergeChanges(pqxx::connection &c, pqxx::transaction_base *work, class DbUsernameLookup &usernames,
+		const std::string &tableStaticPrefix,
+		const std::string &tableActivePrefix,
+		int64_t sinceTimestamp,
+		std::shared_ptr<IDataStreamHandler> enc):
+	numUnchanged(0),
+	numChanged(0),
+	c(c),
+	work(work),
+	usernames(usernames),
+	tableStaticPrefix(tableStaticPrefix),
+	tableActivePrefix(tableActivePrefix),
+	sinceTimestamp(sinceTimestamp),
+	enc(enc),
+	finished(false),
+	typeNum(0),
+	lastId(0),
+	changedPos(0)
+{
+
+}
+
+DumpMergeChanges::~DumpMergeChanges()
+{
+
+}
+
+bool DumpMergeChanges::Sync()
+{
+	return false;
+}
+
+bool DumpMergeChanges::Reset()
+{
+	//Sections of the output are started when the object type changes
+	return false;
+}
+
+bool DumpMergeChanges::Finish()
+{
+	if(finished)
+		return false;
+	AdvanceToType(3);
+	FlushType();
+	enc->Finish();
+	finished = true;
+	return false;
+}
+
+bool DumpMergeChanges::StoreIsDiff(bool isDiff)
+{
+	if(isDiff)
+		throw runtime_error("Previous dump is a diff");
+	return false;
+}
+
+bool DumpMergeChanges::StoreBounds(double x1, double y1, double x2, double y2)
+{
+	return enc->StoreBounds(x1, y1, x2, y2);
+}
+
+bool DumpMergeChanges::StoreNode(int64_t objId, const class MetaData &metaData,
+	const TagMap &tags, double lat, double lon)
+{
+	if(StartObject(1, objId))
+		return false;
+	numUnchanged ++;
+	return enc->StoreNode(objId, metaData, tags, lat, lon);
+}
+
+bool DumpMergeChanges::StoreWay(int64_t objId, const class MetaData &metaData,
+	const TagMap &tags, const std::vector<int64_t> &refs)
+{
+	if(StartObject(2, objId))
+		return false;
+	numUnchanged ++;
+	return enc->StoreWay(objId, metaData, tags, refs);
+}
+
+bool DumpMergeChanges::StoreRelation(int64_t objId, const class MetaData &metaData, const TagMap &tags,
+	const std::vector<std::string> &refTypeStrs, const std::vector<int64_t> &refIds,
+	const std::vector<std::string> &refRoles)
+{
+	if(StartObject(3, objId))
+		return false;
+	numUnchanged ++;
+	return enc->StoreRelation(objId, metaData, tags, refTypeStrs, refIds, refRoles);
+}
+
+/**
+* Writes changed objects that come before objId, and returns true if the previous
+* version of objId should be skipped because the object has changed.
+*/
+bool DumpMergeChanges::StartObject(int objTypeNum, int64_t objId)
+{
+	if(finished)
+		throw runtime_error("Merge already finished");
+	if(objTypeNum < typeNum or (objTypeNum == typeNum and objId <= lastId))
+		throw runtime_error("Previous dump is not in type and ID order");
+	AdvanceToType(objTypeNum);
+	lastId = objId;
+
+	int64_t nextId = NextChangedId();
+	while(nextId != -1 and nextId < objId)
+	{
+		WriteNextChanged();
+		nextId = NextChangedId();
+	}
+
+	while(changedPos < changedIds.size() and changedIds[changedPos] < objId)
+		changedPos ++;
+	return changedPos < changedIds.size() and changedIds[changedPos] == objId;
+}
+
+void DumpMergeChanges::AdvanceToType(int objTypeNum)
+{
+	while(typeNum < objTypeNum)
+	{
+		if(typeNum > 0)
+		{
+			FlushType();
+			enc->Reset();
+		}
+		typeNum ++;
+		OpenType();
+	}
+}
+
+void DumpMergeChanges::OpenType()
+{
+	string objType = mergeObjTypes[typeNum];
+	stringstream changedSql;
+	const string *prefixes[] = {&tableStaticPrefix, &tableActivePrefix};
+	for(int i=0; i<2; i++)
+	{
+		string liveTable = c.quote_name(*prefixes[i] + "live" + objType + "s");
+		string oldTable = c.quote_name(*prefixes[i] + "old" + objType + "s");
+		if(i > 0)
+			changedSql << " UNION ";
+		changedSql << "SELECT id FROM " << liveTable << " WHERE timestamp >= " << sinceTimestamp;
+		changedSql << " UNION SELECT id FROM " << oldTable << " WHERE timestamp >= " << sinceTimestamp;
+	}
+
+	//Any version written since the previous dump means its copy of the object is stale
+	changedIds.clear();
+	changedPos = 0;
+	lastId = 0;
+	pqxx::result r = work->exec("SELECT id FROM (" + changedSql.str() + ") AS changed ORDER BY id;");
+	changedIds.reserve(r.size());
+	for(size_t i=0; i<r.size(); i++)
+		changedIds.push_back(r[i][0].as<int64_t>());
+
+	string visibleTable = c.quote_name(tableActivePrefix + "visible" + objType + "s");
+	stringstream sql;
+	sql << "SELECT " << visibleTable << ".*";
+	if(objType == "node")
+		sql << ", ST_X(geom) as lon, ST_Y(geom) AS lat";
+	sql << " FROM " << visibleTable;
+	sql << " WHERE " << visibleTable << ".id IN (" << changedSql.str() << ")";
+	sql << " ORDER BY " << visibleTable << ".id;";
+
+	source.reset();
+	source.reset(new class DumpCursorSource(work, usernames, objType, sql.str(), "changed" + objType + "cursor"));
+}
+
+void DumpMergeChanges::FlushType()
+{
+	while(NextChangedId() != -1)
+		WriteNextChanged();
+	source.reset();
+}
+
+//ID of the next changed object, or -1 if there are no more of this type
+int64_t DumpMergeChanges::NextChangedId()
+{
+	if(!source)
+		return -1;
+	return source->NextId();
+}
+
+void DumpMergeChanges::WriteNextChanged()
+{
+	source->WriteNext(enc);
+	numChanged ++;
+}
+
@@ -0,0 +1,67 @@
+#ifndef _DB_DUMP_INCREMENTAL_H
+#define _DB_DUMP_INCREMENTAL_H
+
+#include <pqxx/pqxx> //apt install libpqxx-dev
+#include <string>
+#include <vector>
+#include <memory>
+#include "dbusername.h"
+#include "cppo5m/OsmData.h"
+
+///Takes a previous dump as a stream in ID order (nodes, then ways, then relations) and
+///writes it to enc, with objects changed since sinceTimestamp replaced by their current
+///visible version, or dropped if they have been deleted. Changed objects are found with
+///the timestamp indexes on the live and old tables, so only they are read from the database.
+class DumpMergeChanges : public IDataStreamHandler
+{
+public:
+	DumpMergeChanges(pqxx::connection &c, pqxx::transaction_base *work, class DbUsernameLookup &usernames,
+		const std::string &tableStaticPrefix,
+		const std::string &tableActivePrefix,
+		int64_t sinceTimestamp,
+		std::shared_ptr<IDataStreamHandler> enc);
+	virtual ~DumpMergeChanges();
+
+	virtual bool Sync();
+	virtual bool Reset();
+	virtual bool Finish();
+
+	virtual bool StoreIsDiff(bool isDiff);
+	virtual bool StoreBounds(double x1, double y1, double x2, double y2);
+	virtual bool StoreNode(int64_t objId, const class MetaData &metaData,
+		const TagMap &tags, double lat, double lon);
+	virtual bool StoreWay(int64_t objId, const class MetaData &metaData,
+		const TagMap &tags, const std::vector<int64_t> &refs);
+	virtual bool StoreRelation(int64_t objId, const class MetaData &metaData, const TagMap &tags,
+		const std::vector<std::string> &refTypeStrs, const std::vector<int64_t> &refIds,
+		const std::vector<std::string> &refRoles);
+
+	//Counts of objects written
+	int64_t numUnchanged, numChanged;
+
+protected:
+	bool StartObject(int typeNum, int64_t objId);
+	void AdvanceToType(int typeNum);
+	void OpenType();
+	void FlushType();
+	int64_t NextChangedId();
+	void WriteNextChanged();
+
+	pqxx::connection &c;
+	pqxx::transaction_base *work;
+	class DbUsernameLookup &usernames;
+	std::string tableStaticPrefix, tableActivePrefix;
+	int64_t sinceTimestamp;
+	std::shared_ptr<IDataStreamHandler> enc;
+	bool finished;
+
+	//Type being merged: 0 before any objects, then 1 nodes, 2 ways and 3 relations
+	int typeNum;
+	int64_t lastId;
+	std::vector<int64_t> changedIds;
+	size_t changedPos;
+
+	std::shared_ptr<class DumpCursorSource> source;
+};
+
+#endif //_DB_DUMP_INCREMENTAL_H
@@ -0,0 +1,478 @@
+#include "dbdumpparallel.h"
+#include "dbdump.h"
+#include "dbparallel.h"
+#include "dbusername.h"
+#include <rapidjson/writer.h> //rapidjson-dev
+#include <rapidjson/stringbuffer.h>
+#include <iostream>
+#include <sstream>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+using namespace std;
+
+DumpRange::DumpRange():
+	startId(0),
+	endId(0),
+	numObjects(0)
+{
+
+}
+
+DumpRange::DumpRange(const std::string &objType, int64_t startId, int64_t endId):
+	objType(objType),
+	startId(startId),
+	endId(endId),
+	numObjects(0)
+{
+
+}
+
+DumpRange::DumpRange(const DumpRange &obj)
+{
+	*this = obj;
+}
+
+DumpRange::~DumpRange()
+{
+
+}
+
+DumpRange& DumpRange::operator=(const DumpRange &obj)
+{
+	objType = obj.objType;
+	startId = obj.startId;
+	endId = obj.endId;
+	numObjects = obj.numObjects;
+	bbox = obj.bbox;
+	return *this;
+}
+
+// **********************************************
+
+//Blocks of objects from each range, passed from the workers to the thread writing the
+//output. Ranges are started in order and the writer takes them in order, so the range
+//being written is always running and the writer never waits on a stalled worker.
+class DumpRangeQueue
+{
+public:
+	DumpRangeQueue(size_t numRanges, size_t maxBlocksIn):
+		blocks(numRanges),
+		finished(numRanges, false),
+		maxBlocks(maxBlocksIn),
+		abandoned(false)
+	{
+
+	}
+
+	//Waits for space in the range's queue. Returns false if the dump was abandoned.
+	bool Push(size_t range, std::shared_ptr<class OsmData> block)
+	{
+		std::unique_lock<std::mutex> lock(mtx);
+		cond.wait(lock, [&]{ return blocks[range].size() < maxBlocks or abandoned; });
+		if(abandoned)
+			return false;
+		blocks[range].push_back(block);
+		cond.notify_all();
+		return true;
+	}
+
+	void Finish(size_t range)
+	{
+		std::unique_lock<std::mutex> lock(mtx);
+		finished[range] = true;
+		cond.notify_all();
+	}
+
+	void Abandon()
+	{
+		std::unique_lock<std::mutex> lock(mtx);
+		abandoned = true;
+		cond.notify_all();
+	}
+
+	//Waits for the next block of the range. Returns false when the range is complete, or
+	//the dump was abandoned.
+	bool Pop(size_t range, std::shared_ptr<class OsmData> &block)
+	{
+		std::unique_lock<std::mutex> lock(mtx);
+		cond.wait(lock, [&]{ return blocks[range].size() > 0 or finished[range] or abandoned; });
+		if(abandoned or blocks[range].size() == 0)
+			return false;
+		block = blocks[range].front();
+		blocks[range].pop_front();
+		cond.notify_all();
+		return true;
+	}
+
+protected:
+	std::vector<std::deque<std::shared_ptr<class OsmData> > > blocks;
+	std::vector<bool> finished;
+	size_t maxBlocks;
+	bool abandoned;
+	std::mutex mtx;
+	std::condition_variable cond;
+};
+
+//Collects the objects of a range into blocks for the writer
+class DumpBlockBuffer : public IDataStreamHandler
+{
+public:
+	DumpBlockBuffer(class DumpRangeQueue &queueIn, size_t rangeIn, size_t blockSizeIn):
+		queue(queueIn),
+		range(rangeIn),
+		blockSize(blockSizeIn),
+		blockObjects(0),
+		block(new class OsmData())
+	{
+
+	}
+
+	bool Finish()
+	{
+		if(blockObjects > 0)
+			Send();
+		return false;
+	}
+
+	bool StoreNode(int64_t objId, const class MetaData &metaData,
+		const TagMap &tags, double lat, double lon)
+	{
+		block->StoreNode(objId, metaData, tags, lat, lon);
+		return Stored();
+	}
+
+	bool StoreWay(int64_t objId, const class MetaData &metaData,
+		const TagMap &tags, const std::vector<int64_t> &refs)
+	{
+		block->StoreWay(objId, metaData, tags, refs);
+		return Stored();
+	}
+
+	bool StoreRelation(int64_t objId, const class MetaData &metaData, const TagMap &tags,
+		const std::vector<std::string> &refTypeStrs, const std::vector<int64_t> &refIds,
+		const std::vector<std::string> &refRoles)
+	{
+		block->StoreRelation(objId, metaData, tags, refTypeStrs, refIds, refRoles);
+		return Stored();
+	}
+
+protected:
+	bool Stored()
+	{
+		blockObjects ++;
+		if(blockObjects >= blockSize)
+			Send();
+		return false;
+	}
+
+	void Send()
+	{
+		if(!queue.Push(range, block))
+			throw runtime_error("Dump abandoned");
+		block.reset(new class OsmData());
+		blockObjects = 0;
+	}
+
+	class DumpRangeQueue &queue;
+	size_t range;
+	size_t blockSize;
+	size_t blockObjects;
+	std::shared_ptr<class OsmData> block;
+};
+
+//Counts the objects passed to an encoder
+class DumpCounter : public IDataStreamHandler
+{
+public:
+	DumpCounter(std::shared_ptr<IDataStreamHandler> encIn):
+		enc(encIn),
+		count(0)
+	{
+
+	}
+
+	bool Finish()
+	{
+		return enc->Finish();
+	}
+
+	bool StoreNode(int64_t objId, const class MetaData &metaData,
+		const TagMap &tags, double lat, double lon)
+	{
+		count ++;
+		return enc->StoreNode(objId, metaData, tags, lat, lon);
+	}
+
+	bool StoreWay(int64_t objId, const class MetaData &metaData,
+		const TagMap &tags, const std::vector<int64_t> &refs)
+	{
+		count ++;
+		return enc->StoreWay(objId, metaData, tags, refs);
+	}
+
+	bool StoreRelation(int64_t objId, const class MetaData &metaData, const TagMap &tags,
+		const std::vector<std::string> &refTypeStrs, const std::vector<int64_t> &refIds,
+		const std::vector<std::string> &refRoles)
+	{
+		count ++;
+		return enc->StoreRelation(objId, metaData, tags, refTypeStrs, refIds, refRoles);
+	}
+
+	std::shared_ptr<IDataStreamHandler> enc;
+	int64_t count;
+};
+
+// **********************************************
+
+void DumpTableIdRange(pqxx::connection &c, pqxx::transaction_base *work,
+	const std::string &table, int64_t &minId, int64_t &maxId, bool &found)
+{
+	pqxx::result r = work->exec("SELECT MIN(id), MAX(id) FROM "+c.quote_name(table)+";");
+	if(r.size() == 0 or r[0][0].is_null())
+		return;
+	int64_t tableMin = r[0][0].as<int64_t>();
+	int64_t tableMax = r[0][1].as<int64_t>();
+	if(!found or tableMin < minId)
+		minId = tableMin;
+	if(!found or tableMax > maxId)
+		maxId = tableMax;
+	found = true;
+}
+
+void DumpSplitRanges(pqxx::connection &c, pqxx::transaction_base *work,
+	const std::string &tableStaticPrefix,
+	const std::string &tableActivePrefix,
+	bool nodes, bool ways, bool relations,
+	int numRangesPerType,
+	std::vector<class DumpRange> &rangesOut)
+{
+	if(numRangesPerType < 1)
+		numRangesPerType = 1;
+	std::vector<string> objTypes;
+	if(nodes) objTypes.push_back("node");
+	if(ways) objTypes.push_back("way");
+	if(relations) objTypes.push_back("relation");
+
+	for(size_t i=0; i<objTypes.size(); i++)
+	{
+		//The visible objects are a subset of the live tables, which are indexed by ID
+		int64_t minId = 0, maxId = 0;
+		bool found = false;
+		DumpTableIdRange(c, work, tableStaticPrefix+"live"+objTypes[i]+"s", minId, maxId, found);
+		DumpTableIdRange(c, work, tableActivePrefix+"live"+objTypes[i]+"s", minId, maxId, found);
+		if(!found)
+			continue;
+
+		int64_t width = (maxId - minId) / numRangesPerType + 1;
+		for(int64_t startId = minId; startId <= maxId; startId += width)
+			rangesOut.push_back(DumpRange(objTypes[i], startId, startId + width));
+	}
+}
+
+//Sets up a worker connection to read the same snapshot as the coordinating transaction
+std::shared_ptr<pqxx::transaction_base> DumpWorkerTransaction(pqxx::connection &conn, const std::string &snapshot)
+{
+	std::shared_ptr<pqxx::transaction_base> w(new pqxx::transaction<pqxx::repeatable_read>(conn));
+	w->exec("SET TRANSACTION SNAPSHOT "+w->quote(snapshot)+";");
+	return w;
+}
+
+bool DumpParallel(const std::string &connectionString,
+	pqxx::connection &c, pqxx::transaction_base *work,
+	int verbose,
+	const std::string &tableStaticPrefix,
+	const std::string &tableActivePrefix,
+	int numWorkers,
+	std::vector<class DumpRange> &ranges,
+	std::shared_ptr<IDataStreamHandler> enc,
+	std::string &errStr)
+{
+	pqxx::result r = work->exec("SELECT pg_export_snapshot();");
+	string snapshot = r[0][0].as<string>();
+
+	//Each worker holds up to this many blocks ahead of the writer
+	class DumpRangeQueue queue(ranges.size(), 8);
+	std::vector<class DbParallelJob> jobs;
+	for(size_t i=0; i<ranges.size(); i++)
+	{
+		stringstream name;
+		name << ranges[i].objType << "s " << ranges[i].startId << "-" << (ranges[i].endId-1);
+		jobs.push_back(DbParallelJob(name.str(), [&, i](pqxx::connection &conn, class DbParallelJob &job)
+		{
+			class DumpRange &range = ranges[i];
+			try
+			{
+				std::shared_ptr<pqxx::transaction_base> w = DumpWorkerTransaction(conn, snapshot);
+				class DbUsernameLookup usernames(conn, w.get(), tableStaticPrefix, tableActivePrefix);
+				std::shared_ptr<class DumpBlockBuffer> buffer(new class DumpBlockBuffer(queue, i, 10000));
+				std::shared_ptr<class DumpCounter> counter(new class DumpCounter(buffer));
+
+				DumpObjectRange(conn, w.get(), usernames, tableActivePrefix, range.objType,
+					range.startId, range.endId, counter);
+				counter->Finish();
+				range.numObjects = counter->count;
+				job.rowsAffected = counter->count;
+			}
+			catch (...)
+			{
+				//Let the writer stop rather than wait for this range
+				queue.Abandon();
+				throw;
+			}
+			queue.Finish(i);
+			return true;
+		}, 0));
+	}
+
+	//Workers run in the background while this thread writes out the ranges in order
+	bool jobsOk = true;
+	string jobsErrStr;
+	std::thread jobThread([&]()
+	{
+		jobsOk = DbRunParallelJobs(connectionString, numWorkers, jobs, verbose, jobsErrStr);
+		if(!jobsOk)
+			queue.Abandon();
+	});
+
+	enc->StoreIsDiff(false);
+	bool ok = true;
+	try
+	{
+		for(size_t i=0; i<ranges.size() and ok; i++)
+		{
+			if(i > 0 and ranges[i].objType != ranges[i-1].objType)
+				enc->Reset();
+
+			std::shared_ptr<class OsmData> block;
+			while(queue.Pop(i, block))
+				block->StreamTo(*enc, false);
+		}
+		enc->Finish();
+	}
+	catch (const std::exception &e)
+	{
+		queue.Abandon();
+		errStr = e.what();
+		ok = false;
+	}
+	jobThread.join();
+
+	if(!ok) return ok;
+	if(!jobsOk)
+	{
+		errStr = jobsErrStr;
+		return false;
+	}
+	return true;
+}
+
+bool DumpParallelFragments(const std::string &connectionString,
+	pqxx::connection &c, pqxx::transaction_base *work,
+	int verbose,
+	const std::string &tableStaticPrefix,
+	const std::string &tableActivePrefix,
+	int numWorkers,
+	std::vector<class DumpRange> &ranges,
+	DumpFragmentFunc fragmentFunc,
+	std::string &errStr)
+{
+	pqxx::result r = work->exec("SELECT pg_export_snapshot();");
+	string snapshot = r[0][0].as<string>();
+
+	std::mutex fragmentMutex;
+	std::vector<class DbParallelJob> jobs;
+	for(size_t i=0; i<ranges.size(); i++)
+	{
+		stringstream name;
+		name << ranges[i].objType << "s " << ranges[i].startId << "-" << (ranges[i].endId-1);
+		jobs.push_back(DbParallelJob(name.str(), [&, i](pqxx::connection &conn, class DbParallelJob &job)
+		{
+			class DumpRange &range = ranges[i];
+			std::shared_ptr<IDataStreamHandler> enc;
+			{
+				std::lock_guard<std::mutex> guard(fragmentMutex);
+				enc = fragmentFunc(range, i);
+			}
+			std::shared_ptr<pqxx::transaction_base> w = DumpWorkerTransaction(conn, snapshot);
+			class DbUsernameLookup usernames(conn, w.get(), tableStaticPrefix, tableActivePrefix);
+			std::shared_ptr<class DumpCounter> counter(new class DumpCounter(enc));
+
+			enc->StoreIsDiff(false);
+			DumpRangeBounds(conn, w.get(), tableActivePrefix, range);
+			if(range.bbox.size() == 4)
+				enc->StoreBounds(range.bbox[0], range.bbox[1], range.bbox[2], range.bbox[3]);
+			DumpObjectRange(conn, w.get(), usernames, tableActivePrefix, range.objType,
+				range.startId, range.endId, counter);
+			counter->Finish();
+			range.numObjects = counter->count;
+			job.rowsAffected = counter->count;
+			return true;
+		}, 0));
+	}
+
+	return DbRunParallelJobs(connectionString, numWorkers, jobs, verbose, errStr);
+}
+
+
+void DumpRangeBounds(pqxx::connection &c, pqxx::transaction_base *work,
+	const std::string &tablePrefix,
+	class DumpRange &range)
+{
+	string objTable = c.quote_name(tablePrefix + "visible" + range.objType + "s");
+	string geomCol = range.objType == "node" ? "geom" : "bbox";
+
+	stringstream sql;
+	sql << "SELECT ST_XMin(e), ST_YMin(e), ST_XMax(e), ST_YMax(e) FROM (SELECT ST_Extent(" << geomCol << ") AS e";
+	sql << " FROM " << objTable;
+	sql << " WHERE " << objTable << ".id >= " << range.startId << " AND " << objTable << ".id < " << range.endId;
+	sql << ") AS extent;";
+
+	range.bbox.clear();
+	pqxx::result r = work->exec(sql.str());
+	if(r.size() == 0 or r[0][0].is_null())
+		return;
+	for(int i=0; i<4; i++)
+		range.bbox.push_back(r[0][i].as<double>());
+}
+
+void EncodeDumpManifest(const std::vector<class DumpRange> &ranges,
+	const std::vector<std::string> &filenames,
+	std::string &out)
+{
+	rapidjson::StringBuffer buffer;
+	rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+	writer.StartObject();
+	writer.Key("fragments");
+	writer.StartArray();
+	for(size_t i=0; i<ranges.size(); i++)
+	{
+		const class DumpRange &range = ranges[i];
+		writer.StartObject();
+		writer.Key("file");
+		writer.String(i < filenames.size() ? filenames[i].c_str() : "");
+		writer.Key("type");
+		writer.String(range.objType.c_str());
+		writer.Key("start_id");
+		writer.Int64(range.startId);
+		writer.Key("end_id");
+		writer.Int64(range.endId);
+		writer.Key("objects");
+		writer.Int64(range.numObjects);
+		writer.Key("bbox");
+		if(range.bbox.size() == 4)
+		{
+			writer.StartArray();
+			for(size_t j=0; j<range.bbox.size(); j++)
+				writer.Double(range.bbox[j]);
+			writer.EndArray();
+		}
+		else
+			writer.Null();
+		writer.EndObject();
+	}
+	writer.EndArray();
+	writer.EndObject();
+	out = buffer.GetString();
+}
@@ -0,0 +1,81 @@
+#ifndef _DB_DUMP_PARALLEL_H
+#define _DB_DUMP_PARALLEL_H
+
+#include <pqxx/pqxx> //apt install libpqxx-dev
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include "cppo5m/OsmData.h"
+
+///Visible objects of one type with IDs from startId up to (but not including) endId
+class DumpRange
+{
+public:
+	DumpRange();
+	DumpRange(const std::string &objType, int64_t startId, int64_t endId);
+	DumpRange(const DumpRange &obj);
+	virtual ~DumpRange();
+	DumpRange& operator=(const DumpRange &obj);
+
+	std::string objType;
+	//Objects with startId <= id < endId, so endId is exclusive
+	int64_t startId, endId;
+
+	//Filled in when the range has been dumped. The bbox is x1, y1, x2, y2 and is only
+	//found when ranges are written separately; it is empty if no object has a location.
+	int64_t numObjects;
+	std::vector<double> bbox;
+};
+
+///Gives the encoder a range is written to, when each range is written separately. The
+///encoder is finished and released once the range is complete.
+typedef std::function<std::shared_ptr<IDataStreamHandler>(const class DumpRange &range, size_t rangeNum)> DumpFragmentFunc;
+
+///Splits the IDs of visible objects into numRangesPerType ranges of each selected type, in ID order
+void DumpSplitRanges(pqxx::connection &c, pqxx::transaction_base *work,
+	const std::string &tableStaticPrefix,
+	const std::string &tableActivePrefix,
+	bool nodes, bool ways, bool relations,
+	int numRangesPerType,
+	std::vector<class DumpRange> &rangesOut);
+
+///Dumps the ranges on numWorkers connections, which all see the snapshot of work (a
+///repeatable read transaction). Objects are written to enc in ID order, with nodes,
+///ways and relations in separate sections.
+bool DumpParallel(const std::string &connectionString,
+	pqxx::connection &c, pqxx::transaction_base *work,
+	int verbose,
+	const std::string &tableStaticPrefix,
+	const std::string &tableActivePrefix,
+	int numWorkers,
+	std::vector<class DumpRange> &ranges,
+	std::shared_ptr<IDataStreamHandler> enc,
+	std::string &errStr);
+
+///As DumpParallel, but each range is written to its own encoder, which is given the
+///range's bounds before any objects
+bool DumpParallelFragments(const std::string &connectionString,
+	pqxx::connection &c, pqxx::transaction_base *work,
+	int verbose,
+	const std::string &tableStaticPrefix,
+	const std::string &tableActivePrefix,
+	int numWorkers,
+	std::vector<class DumpRange> &ranges,
+	DumpFragmentFunc fragmentFunc,
+	std::string &errStr);
+
+///Finds the extent of the visible objects in the range, from node locations or way and
+///relation bboxes
+void DumpRangeBounds(pqxx::connection &c, pqxx::transaction_base *work,
+	const std::string &tablePrefix,
+	class DumpRange &range);
+
+///Lists the fragments written by DumpParallelFragments, with the file name of each range
+///given in the same order, as JSON. Each range has start_id (inclusive) and end_id 
+///(exclusive), as in DumpRange.
+void EncodeDumpManifest(const std::vector<class DumpRange> &ranges,
+	const std::vector<std::string> &filenames,
+	std::string &out);
+
+#endif //_DB_DUMP_PARALLEL_H
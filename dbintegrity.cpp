@@ -0,0 +1,199 @@
+#include "dbintegrity.h"
+#include "dbparallel.h"
+#include <iostream>
+#include <sstream>
+#include <functional>
+using namespace std;
+
+DbIntegrityResult::DbIntegrityResult():
+	count(0)
+{
+
+}
+
+DbIntegrityResult::~DbIntegrityResult()
+{
+
+}
+
+DbIntegrityResult::DbIntegrityResult( const DbIntegrityResult &obj)
+{
+	*this = obj;
+}
+
+DbIntegrityResult& DbIntegrityResult::operator=(const DbIntegrityResult &arg)
+{
+	name = arg.name;
+	count = arg.count;
+	sampleIds = arg.sampleIds;
+	sampleRefs = arg.sampleRefs;
+	return *this;
+}
+
+// **********************************************
+
+//A check split into ID ranges. The query returns id and ref columns for each problem found.
+class IntegrityCheck
+{
+public:
+	std::string name;
+	std::string rangeTable;
+	std::function<std::string(int64_t, int64_t)> query;
+};
+
+void AddMissingWayNodeChecks(pqxx::connection &c,
+	const std::string &tablePrefix,
+	const std::string &excludeTablePrefix,
+	const std::string &nodeActivePrefix,
+	std::vector<class IntegrityCheck> &checks)
+{
+	string wayMems = c.quote_name(tablePrefix+"way_mems");
+	string ways = c.quote_name(tablePrefix+"liveways");
+	string nodes = c.quote_name(nodeActivePrefix+"visiblenodes");
+	string excludeJoin, excludeWhere;
+	if(excludeTablePrefix.size() > 0)
+	{
+		//Ignore ways replaced by a newer version in the active tables
+		excludeJoin = " LEFT JOIN "+c.quote_name(excludeTablePrefix+"wayids")+" AS x ON x.id = w.id";
+		excludeWhere = " AND x.id IS NULL";
+	}
+
+	class IntegrityCheck check;
+	check.name = tablePrefix+"liveways referencing missing nodes";
+	check.rangeTable = tablePrefix+"liveways";
+	check.query = [=](int64_t lo, int64_t hi) {
+		stringstream sql;
+		sql << "SELECT wm.id AS id, wm.member AS ref FROM " << wayMems << " AS wm";
+		sql << " INNER JOIN " << ways << " AS w ON w.id = wm.id AND w.version = wm.version";
+		sql << excludeJoin;
+		sql << " LEFT JOIN " << nodes << " AS n ON n.id = wm.member";
+		sql << " WHERE w.id >= " << lo << " AND w.id < " << hi << excludeWhere << " AND n.id IS NULL";
+		return sql.str();
+	};
+	checks.push_back(check);
+
+	check.name = tablePrefix+"liveways with too few nodes";
+	check.query = [=](int64_t lo, int64_t hi) {
+		stringstream sql;
+		sql << "SELECT w.id AS id, NULL::BIGINT AS ref FROM " << ways << " AS w";
+		sql << excludeJoin;
+		sql << " WHERE w.id >= " << lo << " AND w.id < " << hi << excludeWhere;
+		sql << " AND json_array_length(w.members::JSON) < 2";
+		return sql.str();
+	};
+	checks.push_back(check);
+}
+
+void AddObjectIdTableCheck(pqxx::connection &c,
+	const std::string &tablePrefix,
+	const std::string &edition,
+	const std::string &objType,
+	std::vector<class IntegrityCheck> &checks)
+{
+	string objTable = c.quote_name(tablePrefix + edition + objType + "s");
+	string idTable = c.quote_name(tablePrefix + objType + "ids");
+
+	class IntegrityCheck check;
+	check.name = tablePrefix + edition + objType + "s missing from " + tablePrefix + objType + "ids";
+	check.rangeTable = tablePrefix + edition + objType + "s";
+	check.query = [=](int64_t lo, int64_t hi) {
+		stringstream sql;
+		sql << "SELECT o.id AS id, NULL::BIGINT AS ref FROM " << objTable << " AS o";
+		sql << " LEFT JOIN " << idTable << " AS x ON x.id = o.id";
+		sql << " WHERE o.id >= " << lo << " AND o.id < " << hi << " AND x.id IS NULL";
+		return sql.str();
+	};
+	checks.push_back(check);
+}
+
+bool DbCheckIntegrityParallel(const std::string &connectionString,
+	pqxx::connection &c, pqxx::transaction_base *work,
+	int verbose,
+	const std::string &tableStaticPrefix,
+	const std::string &tableModPrefix,
+	int numWorkers,
+	int maxSamples,
+	std::vector<class DbIntegrityResult> &results,
+	std::string &errStr)
+{
+	std::vector<class IntegrityCheck> checks;
+	AddMissingWayNodeChecks(c, tableStaticPrefix, tableModPrefix, tableModPrefix, checks);
+	AddMissingWayNodeChecks(c, tableModPrefix, "", tableModPrefix, checks);
+
+	string prefixes[] = {tableModPrefix, tableStaticPrefix};
+	string editions[] = {"live", "old"};
+	string objTypes[] = {"node", "way", "relation"};
+	for(int i=0; i<2; i++)
+		for(int j=0; j<2; j++)
+			for(int k=0; k<3; k++)
+				AddObjectIdTableCheck(c, prefixes[i], editions[j], objTypes[k], checks);
+
+	//Split each check into ranges of object ID, so the work spreads over the connections
+	int rangesPerCheck = numWorkers * 4;
+	if(rangesPerCheck < 1)
+		rangesPerCheck = 1;
+	std::vector<class DbParallelJob> jobs;
+	std::vector<class DbIntegrityResult> partials;
+	std::vector<size_t> partialCheck;
+	for(size_t i=0; i<checks.size(); i++)
+	{
+		pqxx::result r = work->exec("SELECT MIN(id), MAX(id) FROM "+c.quote_name(checks[i].rangeTable)+";");
+		if(r.size() == 0 or r[0][0].is_null())
+			continue;
+		int64_t minId = r[0][0].as<int64_t>();
+		int64_t maxId = r[0][1].as<int64_t>();
+		int64_t width = (maxId - minId) / rangesPerCheck + 1;
+
+		for(int64_t lo = minId; lo <= maxId; lo += width)
+		{
+			stringstream sql;
+			sql << "SELECT id, ref, COUNT(*) OVER () AS total FROM (" << checks[i].query(lo, lo + width);
+			sql << ") AS q LIMIT " << (maxSamples > 0 ? maxSamples : 1) << ";";
+			string sqlStr = sql.str();
+
+			size_t partialNum = partials.size();
+			partials.push_back(DbIntegrityResult());
+			partialCheck.push_back(i);
+			stringstream name;
+			name << checks[i].name << " " << lo << "-" << (lo + width - 1);
+
+			jobs.push_back(DbParallelJob(name.str(), [sqlStr, partialNum, maxSamples, &partials](pqxx::connection &conn, class DbParallelJob &job)
+			{
+				pqxx::nontransaction w(conn);
+				pqxx::result rows = w.exec(sqlStr);
+				class DbIntegrityResult &partial = partials[partialNum];
+				for(size_t j=0; j<rows.size(); j++)
+				{
+					partial.count = rows[j][2].as<int64_t>();
+					if((int)j >= maxSamples)
+						continue;
+					partial.sampleIds.push_back(rows[j][0].as<int64_t>());
+					partial.sampleRefs.push_back(rows[j][1].is_null() ? 0 : rows[j][1].as<int64_t>());
+				}
+				job.rowsAffected = partial.count;
+				return true;
+			}, width));
+		}
+	}
+
+	bool ok = DbRunParallelJobs(connectionString, numWorkers, jobs, verbose, errStr);
+	if(!ok) return ok;
+
+	//Combine the ranges of each check
+	results.clear();
+	results.resize(checks.size());
+	for(size_t i=0; i<checks.size(); i++)
+		results[i].name = checks[i].name;
+	for(size_t i=0; i<partials.size(); i++)
+	{
+		class DbIntegrityResult &result = results[partialCheck[i]];
+		result.count += partials[i].count;
+		for(size_t j=0; j<partials[i].sampleIds.size() and (int)result.sampleIds.size() < maxSamples; j++)
+		{
+			result.sampleIds.push_back(partials[i].sampleIds[j]);
+			result.sampleRefs.push_back(partials[i].sampleRefs[j]);
+		}
+	}
+	return true;
+}
+
@@ -0,0 +1,35 @@
+#ifndef _DB_INTEGRITY_H
+#define _DB_INTEGRITY_H
+
+#include <pqxx/pqxx>
+#include <string>
+#include <vector>
+
+///The outcome of one kind of integrity check, over all ID ranges
+class DbIntegrityResult
+{
+public:
+	std::string name;
+	int64_t count;
+	//Some of the offending object IDs, and what each refers to (if applicable)
+	std::vector<int64_t> sampleIds;
+	std::vector<int64_t> sampleRefs;
+
+	DbIntegrityResult();
+	virtual ~DbIntegrityResult();
+
+	DbIntegrityResult( const DbIntegrityResult &obj);
+	DbIntegrityResult& operator=(const DbIntegrityResult &arg);
+};
+
+bool DbCheckIntegrityParallel(const std::string &connectionString,
+	pqxx::connection &c, pqxx::transaction_base *work,
+	int verbose,
+	const std::string &tableStaticPrefix,
+	const std::string &tableModPrefix,
+	int numWorkers,
+	int maxSamples,
+	std::vector<class DbIntegrityResult> &results,
+	std::string &errStr);
+
+#endif //_DB_INTEGRITY_H
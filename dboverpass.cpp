@@ -4,6 +4,7 @@
 #include <rapidjson/stringbuffer.h>
 #include <rapidjson/writer.h> //rapidjson-dev
 #include "dbquery.h"
+#include <chrono>
 
 /*
 Example queries :
@@ -16,25 +17,18 @@ SELECT id, tags FROM planet_static_livenodes WHERE tags @> '{"natural":"peak"}':
 
 */
 
-std::string DbXapiQueryGenerateSql(pqxx::connection &c, pqxx::transaction_base *work, 
-	const std::string &tablePrefix, 
+//Condition on a visible table that matches the tag and bbox, or empty to match everything
+std::string DbXapiQueryGenerateCondition(pqxx::connection &c, pqxx::transaction_base *work, 
 	const std::string &objType,
 	const std::string &tagKey,
 	const std::string &tagValue,
-	const std::vector<double> &bbox)
+	const std::vector<double> &bbox,
+	bool fullText)
 {
-	string objTable = c.quote_name(tablePrefix+"visible"+objType+"s");
-
-	string sql = "SELECT *";
-
-	if(objType == "node")
-		sql += ", ST_X(geom) as lon, ST_Y(geom) AS lat";
-
-	sql += " FROM "+ objTable;
-
+	string sql;
 	if(tagKey.size() > 0 or bbox.size() == 4)
 	{
-		sql += " WHERE (";
+		sql += "(";
 
 		if(tagKey.size() > 0)
 		{
@@ -48,11 +42,18 @@ std::string DbXapiQueryGenerateSql(pqxx::connection &c, pqxx::transaction_base *
 				writer.String(tagValue.c_str(), tagValue.size(), true);
 				writer.EndObject(1);
 
-				sql += "jsonb_to_tsvector('english', tags, '\"all\"') @@ to_tsquery('english', "+work->quote(tagKey)+") AND jsonb_to_tsvector('english', tags, '\"all\"') @@ to_tsquery('english', "+work->quote(tagValue)+") AND tags @> "+work->quote(buffer.GetString())+"::jsonb";
+				//Containment is exact and uses the jsonb_path_ops GIN index, which the planner can
+				//combine with the spatial index in a BitmapAnd
+				if(fullText)
+					sql += "jsonb_to_tsvector('english', tags, '\"all\"') @@ to_tsquery('english', "+work->quote(tagKey)+") AND jsonb_to_tsvector('english', tags, '\"all\"') @@ to_tsquery('english', "+work->quote(tagValue)+") AND ";
+				sql += "tags @> "+work->quote(buffer.GetString())+"::jsonb";
 			}
 			else
 			{
-				sql += "jsonb_to_tsvector('english', tags, '\"all\"') @@ to_tsquery('english', "+work->quote(tagKey)+") AND tags ? "+work->quote(tagKey);
+				//Uses a partial index for the key, if it is one of the popular keys
+				if(fullText)
+					sql += "jsonb_to_tsvector('english', tags, '\"all\"') @@ to_tsquery('english', "+work->quote(tagKey)+") AND ";
+				sql += "tags ? "+work->quote(tagKey);
 			}
 		}
 
@@ -72,12 +73,145 @@ std::string DbXapiQueryGenerateSql(pqxx::connection &c, pqxx::transaction_base *
 
 		sql += ")";
 	}
+	return sql;
+}
+
+std::string DbXapiQueryGenerateSql(pqxx::connection &c, pqxx::transaction_base *work, 
+	const std::string &tablePrefix, 
+	const std::string &objType,
+	const std::string &tagKey,
+	const std::string &tagValue,
+	const std::vector<double> &bbox,
+	bool fullText)
+{
+	string objTable = c.quote_name(tablePrefix+"visible"+objType+"s");
+
+	string sql = "SELECT *";
+
+	if(objType == "node")
+		sql += ", ST_X(geom) as lon, ST_Y(geom) AS lat";
+
+	sql += " FROM "+ objTable;
+
+	string cond = DbXapiQueryGenerateCondition(c, work, objType, tagKey, tagValue, bbox, fullText);
+	if(cond.size() > 0)
+		sql += " WHERE "+cond;
 
 	sql += ";";
 
 	return sql;
 }
 
+//Member IDs of memType of the relations whose IDs are in relationIds
+std::string DbXapiRelationMembersSql(pqxx::connection &c, const std::string &tablePrefix, 
+	const std::string &relationIds, const std::string &memType)
+{
+	return "SELECT (mem->>1)::BIGINT FROM "+relationIds+" INNER JOIN "+c.quote_name(tablePrefix+"visiblerelations")
+		+" AS rel ON rel.id = "+relationIds+".id, jsonb_array_elements(rel.members) AS mem WHERE mem->>0 = "+c.quote(memType);
+}
+
+//Finds the IDs of the visible objects needed to complete the objects that match the query
+//and stores them in the temporary tables xapi_closure_relations, xapi_closure_ways and 
+//xapi_closure_nodes. Matching relations are followed through their child relations by a 
+//recursive CTE, which stops at relations already found, so loops in the relation graph end.
+//The members come from the members column of the visible views, so the closure covers 
+//every table set. Each table is filled once, from the table before it.
+void DbXapiQueryCreateClosure(pqxx::connection &c, pqxx::transaction_base *work, 
+	const std::string &tablePrefix, 
+	const std::string &objType,
+	const std::string &tagKey,
+	const std::string &tagValue,
+	const std::vector<double> &bbox)
+{
+	bool all = objType == "*";
+	work->exec("DROP TABLE IF EXISTS pg_temp.xapi_closure_relations, pg_temp.xapi_closure_ways, pg_temp.xapi_closure_nodes;");
+
+	stringstream sql;
+	sql << "CREATE TEMP TABLE xapi_closure_relations AS WITH RECURSIVE relation_closure(id) AS (";
+	if(objType == "relation" or all)
+	{
+		string cond = DbXapiQueryGenerateCondition(c, work, "relation", tagKey, tagValue, bbox, false);
+		sql << "SELECT id FROM " << c.quote_name(tablePrefix+"visiblerelations");
+		if(cond.size() > 0)
+			sql << " WHERE " << cond;
+	}
+	else
+		sql << "SELECT NULL::BIGINT WHERE false";
+	sql << " UNION " << DbXapiRelationMembersSql(c, tablePrefix, "relation_closure", "relation");
+	sql << ") SELECT id FROM relation_closure;";
+	work->exec(sql.str());
+
+	sql.str("");
+	sql << "CREATE TEMP TABLE xapi_closure_ways AS ";
+	if(objType == "way" or all)
+	{
+		string cond = DbXapiQueryGenerateCondition(c, work, "way", tagKey, tagValue, bbox, false);
+		sql << "SELECT id FROM " << c.quote_name(tablePrefix+"visibleways");
+		if(cond.size() > 0)
+			sql << " WHERE " << cond;
+		sql << " UNION ";
+	}
+	sql << DbXapiRelationMembersSql(c, tablePrefix, "xapi_closure_relations", "way") << ";";
+	work->exec(sql.str());
+
+	sql.str("");
+	sql << "CREATE TEMP TABLE xapi_closure_nodes AS ";
+	if(all)
+	{
+		string cond = DbXapiQueryGenerateCondition(c, work, "node", tagKey, tagValue, bbox, false);
+		sql << "SELECT id FROM " << c.quote_name(tablePrefix+"visiblenodes");
+		if(cond.size() > 0)
+			sql << " WHERE " << cond;
+		sql << " UNION ";
+	}
+	sql << "SELECT mem::BIGINT FROM xapi_closure_ways INNER JOIN " << c.quote_name(tablePrefix+"visibleways");
+	sql << " AS way ON way.id = xapi_closure_ways.id, jsonb_array_elements_text(way.members) AS mem";
+	sql << " UNION " << DbXapiRelationMembersSql(c, tablePrefix, "xapi_closure_relations", "node") << ";";
+	work->exec(sql.str());
+
+	//So the planner knows how many IDs it is joining
+	work->exec("ANALYZE pg_temp.xapi_closure_relations, pg_temp.xapi_closure_ways, pg_temp.xapi_closure_nodes;");
+}
+
+void DbXapiQueryBenchmark(pqxx::connection &c, pqxx::transaction_base *work, 
+	const std::string &tablePrefix, 
+	const std::string &objType,
+	const std::string &tagKey,
+	const std::string &tagValue,
+	const std::vector<double> &bbox, 
+	bool fullText,
+	int repeats,
+	double &secondsOut,
+	int64_t &rowsOut,
+	std::string &planOut)
+{
+	string sql = DbXapiQueryGenerateSql(c, work, 
+		tablePrefix, 
+		objType,
+		tagKey,
+		tagValue,
+		bbox, 
+		fullText);
+	sql = sql.substr(0, sql.size()-1); //Remove semicolon
+
+	planOut = "";
+	pqxx::result r = work->exec("EXPLAIN "+sql+";");
+	for (unsigned int rownum=0; rownum < r.size(); ++rownum)
+		planOut += r[rownum][0].as<string>() + "\n";
+
+	//The fastest run is kept, so the first run can fill the cache
+	secondsOut = -1.0;
+	rowsOut = 0;
+	for(int i=0; i<repeats; i++)
+	{
+		auto startTime = std::chrono::steady_clock::now();
+		r = work->exec("SELECT COUNT(*) FROM ("+sql+") AS q;");
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime;
+		rowsOut = r[0][0].as<int64_t>();
+		if(secondsOut < 0.0 or elapsed.count() < secondsOut)
+			secondsOut = elapsed.count();
+	}
+}
 
 void DbXapiQueryIdVisible(pqxx::connection &c, pqxx::transaction_base *work, 
 	const std::string &tablePrefix, 
@@ -92,7 +226,8 @@ void DbXapiQueryIdVisible(pqxx::connection &c, pqxx::transaction_base *work,
 		objType,
 		tagKey,
 		tagValue,
-		bbox);
+		bbox, 
+		false);
 
 	cout << sql << endl;
 
@@ -121,7 +256,8 @@ void DbXapiQueryObjVisible(pqxx::connection &c, pqxx::transaction_base *work,
 		objType,
 		tagKey,
 		tagValue,
-		bbox);
+		bbox, 
+		false);
 
 	cout << sql << endl;
 
@@ -150,145 +286,57 @@ void DbXapiQueryVisible(pqxx::connection &c, pqxx::transaction_base *work,
 	const std::vector<double> &bbox, 
 	std::shared_ptr<IDataStreamHandler> enc)
 {
-	std::set<int64_t> relationIdsSet, wayIdsSet, nodeIdsSet;
-
-	if(objType == "relation" or objType == "*")
+	if(objType == "node")
 	{
-		std::shared_ptr<class OsmData> relationObjs(new class OsmData());
+		//Nodes are complete already
 		DbXapiQueryObjVisible(c, work, 
 			usernames, 
 			tablePrefix, 
-			"relation",
+			"node",
 			tagKey,
 			tagValue,
 			bbox, 
-			relationObjs);
-
-		//Get object Ids needed to complete relations
-		for(size_t i=0; i<relationObjs->relations.size(); i++)
-		{
-			OsmRelation &rel = relationObjs->relations[i];
-			for(size_t j=0; j<rel.refTypeStrs.size(); j++)
-			{	
-				const std::string &refType = rel.refTypeStrs[j];
-				if(refType == "node")
-					nodeIdsSet.insert(rel.refIds[j]);
-				else if(refType == "way")
-					wayIdsSet.insert(rel.refIds[j]);
-				else if(refType == "relation")
-					relationIdsSet.insert(rel.refIds[j]);
-			}
-		}
-		relationObjs.reset();
-
-		//Recursively get child relations
-		std::set<int64_t> pendingRelationIds = relationIdsSet;
-		int depth = 0;
-		while(pendingRelationIds.size() > 0 and depth < 10)
-		{
-			std::set<int64_t>::const_iterator it = pendingRelationIds.begin();
-			std::shared_ptr<class OsmData> childRelationObjs(new class OsmData());
-			while(it != pendingRelationIds.end())
-				GetVisibleObjectsById(c, work, 
-					usernames, 
-					tablePrefix, 
-					"relation",
-					pendingRelationIds, it, 
-					1000, childRelationObjs);
-
-			pendingRelationIds.clear();
-			for(size_t i=0; i<childRelationObjs->relations.size(); i++)
-			{
-				OsmRelation &rel = childRelationObjs->relations[i];
-				for(size_t j=0; j<rel.refTypeStrs.size(); j++)
-				{	
-					const std::string &refType = rel.refTypeStrs[j];
-					if(refType == "node")
-						nodeIdsSet.insert(rel.refIds[j]);
-					else if(refType == "way")
-						wayIdsSet.insert(rel.refIds[j]);
-					else if(refType == "relation")
-					{
-						if (relationIdsSet.find(rel.refIds[j]) == relationIdsSet.end())
-						{
-							relationIdsSet.insert(rel.refIds[j]);
-							pendingRelationIds.insert(rel.refIds[j]);
-						}					
-					}
-				}
-			}
-
-			depth += 1;
-		}
+			enc);
+		return;
 	}
 
-	if(objType == "way" or objType == "*")
-	{
-		//Get way IDs
-		std::shared_ptr<class OsmData> wayObjs(new class OsmData());
-		DbXapiQueryObjVisible(c, work, 
-			usernames, 
-			tablePrefix, 
-			"way",
-			tagKey,
-			tagValue,
-			bbox, 
-			wayObjs);
-
-		//Get nodes to complete ways
-		for(size_t i=0; i<wayObjs->ways.size(); i++)
-		{
-			OsmWay &way = wayObjs->ways[i];
-			wayIdsSet.insert(way.objId);
-			for(size_t j=0; j<way.refs.size(); j++)
-			{	
-				nodeIdsSet.insert(way.refs[j]);
-			}
-		}
-	}
+	//The closure is found by the server once, then each type is streamed from it, so each 
+	//object is decoded once and only one cursor block is held in memory.
+	DbXapiQueryCreateClosure(c, work, 
+		tablePrefix, 
+		objType,
+		tagKey,
+		tagValue,
+		bbox);
 
-	if(objType == "node" or objType == "*")
+	string outTypes[] = {"node", "way", "relation"};
+	for(int i=0; i<3; i++)
 	{
-		std::shared_ptr<class OsmData> nodeObjs(new class OsmData());
-		DbXapiQueryObjVisible(c, work, 
-			usernames, 
-			tablePrefix, 
-			"node",
-			tagKey,
-			tagValue,
-			bbox, 
-			nodeObjs);
-
-		if(objType == "*")
+		//Nothing a way query needs is a relation
+		if(objType == "way" and outTypes[i] == "relation")
+			continue;
+
+		string outTable = c.quote_name(tablePrefix+"visible"+outTypes[i]+"s");
+		string sql = "SELECT "+outTable+".*";
+		if(outTypes[i] == "node")
+			sql += ", ST_X(geom) as lon, ST_Y(geom) AS lat";
+		sql += " FROM "+outTable+" WHERE id IN (SELECT id FROM pg_temp.xapi_closure_"+outTypes[i]+"s) ORDER BY id;";
+
+		pqxx::icursorstream cursor( *work, sql, "xapiclosure", 1000 );
+
+		int count = 1;
+		if(outTypes[i] == "node")
+			while(count > 0)
+				count = NodeResultsToEncoder(cursor, usernames, enc);
+		else if(outTypes[i] == "way")
+			while(count > 0)
+				count = WayResultsToEncoder(cursor, usernames, enc);
+		else
 		{
-			//Merge node ids with previously found data
-			for(size_t i=0; i<nodeObjs->nodes.size(); i++)
-			{
-				OsmNode &node = nodeObjs->nodes[i];
-				nodeIdsSet.insert(node.objId);
-			}
+			std::set<int64_t> skipIds;
+			RelationResultsToEncoder(cursor, usernames, skipIds, enc);
 		}
-		else
-			nodeObjs->StreamTo(*enc);
 	}
 
-	//Output final objects
-	std::set<int64_t>::const_iterator it = nodeIdsSet.begin();
-	while(it != nodeIdsSet.end())
-		GetVisibleObjectsById(c, work, usernames,
-			tablePrefix, "node", nodeIdsSet, 
-			it, 1000, enc);
-
-	it = wayIdsSet.begin();
-	while(it != wayIdsSet.end())
-		GetVisibleObjectsById(c, work, usernames,
-			tablePrefix, "way", wayIdsSet, 
-			it, 1000, enc);
-
-	it = relationIdsSet.begin();
-	while(it != relationIdsSet.end())
-		GetVisibleObjectsById(c, work, usernames,
-			tablePrefix, "relation", relationIdsSet, 
-			it, 1000, enc);
+	work->exec("DROP TABLE pg_temp.xapi_closure_relations, pg_temp.xapi_closure_ways, pg_temp.xapi_closure_nodes;");
 }
-
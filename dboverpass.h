@@ -6,7 +6,9 @@
 #include "cppo5m/OsmData.h"
 #include "dbusername.h"
 
-//Returns complete objects
+//Returns complete objects: matching relations with their child relations and members, and 
+//matching ways with their nodes. The closure is resolved by the database and each object 
+//is streamed to enc once, nodes then ways then relations, each in ID order.
 void DbXapiQueryVisible(pqxx::connection &c, pqxx::transaction_base *work, 
 	class DbUsernameLookup &usernames, 
 	const std::string &tablePrefix, 
@@ -26,4 +28,19 @@ void DbXapiQueryObjVisible(pqxx::connection &c, pqxx::transaction_base *work,
 	const std::vector<double> &bbox, 
 	std::shared_ptr<IDataStreamHandler> enc);
 
+//Times the query for one object type with either way of matching tags: tags @> and ?
+//alone, or with the jsonb_to_tsvector full text match as well. Returns the fastest of
+//the repeats and the query plan.
+void DbXapiQueryBenchmark(pqxx::connection &c, pqxx::transaction_base *work, 
+	const std::string &tablePrefix, 
+	const std::string &objType,
+	const std::string &tagKey,
+	const std::string &tagValue,
+	const std::vector<double> &bbox, 
+	bool fullText,
+	int repeats,
+	double &secondsOut,
+	int64_t &rowsOut,
+	std::string &planOut);
+
 #endif //_DB_OVERPASS_H
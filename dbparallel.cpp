@@ -0,0 +1,238 @@
+#include "dbparallel.h"
+#include "dbcommon.h"
+#include <iostream>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+using namespace std;
+
+DbParallelJob::DbParallelJob():
+	sizeEstimate(0),
+	ok(false),
+	rowsAffected(0),
+	elapsed(0.0)
+{
+
+}
+
+DbParallelJob::DbParallelJob(const std::string &name, const std::vector<std::string> &sql, int64_t sizeEstimate):
+	name(name),
+	sql(sql),
+	sizeEstimate(sizeEstimate),
+	ok(false),
+	rowsAffected(0),
+	elapsed(0.0)
+{
+
+}
+
+DbParallelJob::DbParallelJob(const std::string &name, std::function<bool(pqxx::connection &, class DbParallelJob &)> func, 
+	int64_t sizeEstimate):
+	name(name),
+	func(func),
+	sizeEstimate(sizeEstimate),
+	ok(false),
+	rowsAffected(0),
+	elapsed(0.0)
+{
+
+}
+
+DbParallelJob::DbParallelJob(const DbParallelJob &obj)
+{
+	*this = obj;
+}
+
+DbParallelJob::~DbParallelJob()
+{
+
+}
+
+DbParallelJob& DbParallelJob::operator=(const DbParallelJob &obj)
+{
+	name = obj.name;
+	sql = obj.sql;
+	func = obj.func;
+	sizeEstimate = obj.sizeEstimate;
+	ok = obj.ok;
+	errStr = obj.errStr;
+	rowsAffected = obj.rowsAffected;
+	elapsed = obj.elapsed;
+	return *this;
+}
+
+// ************************************************
+
+void DbParallelWorker(const std::string &connectionString,
+	std::vector<class DbParallelJob> &jobs,
+	std::atomic<size_t> &nextJob,
+	std::atomic<size_t> &jobsDone,
+	std::atomic<bool> &failed,
+	std::mutex &outputMutex,
+	int verbose)
+{
+	std::shared_ptr<pqxx::connection> conn;
+	try
+	{
+		conn.reset(new pqxx::connection(connectionString));
+	}
+	catch (const std::exception &e)
+	{
+		lock_guard<mutex> guard(outputMutex);
+		cout << "Worker could not connect to database: " << e.what() << endl;
+		failed = true;
+		return;
+	}
+
+	while(!failed)
+	{
+		size_t i = nextJob++;
+		if(i >= jobs.size())
+			break;
+		class DbParallelJob &job = jobs[i];
+
+		auto startTime = chrono::steady_clock::now();
+		job.ok = true;
+		if(job.func)
+		{
+			try
+			{
+				job.ok = job.func(*conn, job);
+			}
+			catch (const std::exception &e)
+			{
+				job.errStr = e.what();
+				job.ok = false;
+			}
+		}
+		else
+		{
+			//A broken connection throws from outside DbExec
+			try
+			{
+				pqxx::nontransaction work(*conn);
+				for(size_t j=0; j<job.sql.size() and job.ok; j++)
+				{
+					size_t rows = 0;
+					if(verbose >= 2)
+					{
+						lock_guard<mutex> guard(outputMutex);
+						cout << job.sql[j] << endl;
+					}
+					job.ok = DbExec(&work, job.sql[j], job.errStr, &rows, 0);
+					job.rowsAffected += rows;
+				}
+			}
+			catch (const std::exception &e)
+			{
+				job.errStr = e.what();
+				job.ok = false;
+			}
+		}
+		job.elapsed = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+		size_t done = ++jobsDone;
+
+		if(!job.ok)
+			failed = true;
+
+		if(verbose >= 1 or !job.ok)
+		{
+			lock_guard<mutex> guard(outputMutex);
+			cout << "[" << done << "/" << jobs.size() << "] " << job.name;
+			if(job.ok)
+			{
+				cout << ": " << job.rowsAffected << " rows in " << job.elapsed << " s";
+				if(job.elapsed > 0.0 and job.rowsAffected > 0)
+					cout << " (" << int64_t(job.rowsAffected / job.elapsed) << " rows/s)";
+				cout << endl;
+			}
+			else
+				cout << " failed: " << job.errStr << endl;
+		}
+	}
+}
+
+void DbParallelProgress(const std::string &connectionString,
+	std::function<void(pqxx::connection &)> progress,
+	int progressInterval,
+	std::atomic<bool> &finished,
+	std::mutex &outputMutex)
+{
+	try
+	{
+		pqxx::connection conn(connectionString);
+		auto lastReport = chrono::steady_clock::now();
+		while(!finished)
+		{
+			this_thread::sleep_for(chrono::milliseconds(200));
+			if(chrono::steady_clock::now() - lastReport < chrono::seconds(progressInterval))
+				continue;
+			lastReport = chrono::steady_clock::now();
+			lock_guard<mutex> guard(outputMutex);
+			progress(conn);
+		}
+	}
+	catch (const std::exception &e)
+	{
+		//Progress reporting is best effort
+		lock_guard<mutex> guard(outputMutex);
+		cout << "Progress reporting stopped: " << e.what() << endl;
+	}
+}
+
+bool DbRunParallelJobs(const std::string &connectionString,
+	int numWorkers,
+	std::vector<class DbParallelJob> &jobs,
+	int verbose,
+	std::string &errStr,
+	std::function<void(pqxx::connection &)> progress,
+	int progressInterval)
+{
+	if(numWorkers < 1)
+		numWorkers = 1;
+	if((size_t)numWorkers > jobs.size())
+		numWorkers = jobs.size();
+
+	std::atomic<size_t> nextJob(0), jobsDone(0);
+	std::atomic<bool> failed(false), finished(false);
+	std::mutex outputMutex;
+	auto startTime = chrono::steady_clock::now();
+
+	std::thread progressThread;
+	if(progress)
+		progressThread = std::thread(DbParallelProgress, std::cref(connectionString), progress, progressInterval,
+			std::ref(finished), std::ref(outputMutex));
+
+	std::vector<std::thread> workers;
+	for(int i=0; i<numWorkers; i++)
+		workers.push_back(std::thread(DbParallelWorker, std::cref(connectionString), std::ref(jobs), 
+			std::ref(nextJob), std::ref(jobsDone), std::ref(failed), std::ref(outputMutex), verbose));
+	for(size_t i=0; i<workers.size(); i++)
+		workers[i].join();
+	finished = true;
+	if(progressThread.joinable())
+		progressThread.join();
+
+	if(verbose >= 1)
+	{
+		double elapsed = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+		cout << jobsDone << " jobs on " << numWorkers << " connections in " << elapsed << " s" << endl;
+	}
+
+	for(size_t i=0; i<jobs.size(); i++)
+	{
+		if(!jobs[i].ok and jobs[i].errStr.size() > 0)
+		{
+			errStr = jobs[i].name + ": " + jobs[i].errStr;
+			return false;
+		}
+	}
+	if(failed)
+	{
+		if(errStr.size() == 0)
+			errStr = "Parallel job worker failed";
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,45 @@
+#ifndef _DB_PARALLEL_H
+#define _DB_PARALLEL_H
+
+#include <pqxx/pqxx> //apt install libpqxx-dev
+#include <string>
+#include <vector>
+#include <functional>
+
+///A unit of work run on one of a pool of database connections
+class DbParallelJob
+{
+public:
+	DbParallelJob();
+	DbParallelJob(const std::string &name, const std::vector<std::string> &sql, int64_t sizeEstimate = 0);
+	DbParallelJob(const std::string &name, std::function<bool(pqxx::connection &, class DbParallelJob &)> func, 
+		int64_t sizeEstimate = 0);
+	DbParallelJob(const DbParallelJob &obj);
+	virtual ~DbParallelJob();
+	DbParallelJob& operator=(const DbParallelJob &obj);
+
+	std::string name;
+	std::vector<std::string> sql;
+	//If set, this is called instead of running the sql statements
+	std::function<bool(pqxx::connection &, class DbParallelJob &)> func;
+	int64_t sizeEstimate;
+
+	//Filled in when the job has run
+	bool ok;
+	std::string errStr;
+	size_t rowsAffected;
+	double elapsed;
+};
+
+///Runs jobs on numWorkers connections, each sql statement in autocommit mode. Jobs are started in
+///the order given. Once a job fails, no further jobs are started. If a progress function is
+///given, it is called every progressInterval seconds on a separate connection while jobs run.
+bool DbRunParallelJobs(const std::string &connectionString,
+	int numWorkers,
+	std::vector<class DbParallelJob> &jobs,
+	int verbose,
+	std::string &errStr,
+	std::function<void(pqxx::connection &)> progress = nullptr,
+	int progressInterval = 60);
+
+#endif //_DB_PARALLEL_H
@@ -2,15 +2,20 @@
 #include "dbcommon.h"
 #include <iostream>
 #include <map>
+#include <mutex>
 using namespace std;
 
-std::map<std::string, std::string> keyToSql;
+//Statements are prepared per connection. Several connections may be in use on different threads.
+std::map<const pqxx::connection *, std::map<std::string, std::string> > keyToSql;
+std::mutex keyToSqlMutex;
 
 void prepare_deduplicated(pqxx::connection &c, std::string key, std::string sql)
 {
 	//cout << "prepare " << key << " " << sql << endl;
-	auto existing = keyToSql.find(key);
-	if (existing != keyToSql.end())
+	std::lock_guard<std::mutex> lock(keyToSqlMutex);
+	std::map<std::string, std::string> &connKeyToSql = keyToSql[&c];
+	auto existing = connKeyToSql.find(key);
+	if (existing != connKeyToSql.end())
 	{
 		if (existing->second != sql)
 			throw runtime_error("SQL statement in prepared statement has changed");
@@ -19,6 +24,12 @@ void prepare_deduplicated(pqxx::connection &c, std::string key, std::string sql)
 
 	c.prepare(key, sql);
 
-	keyToSql[key] = sql;
+	connKeyToSql[key] = sql;
+}
+
+void forget_prepared(pqxx::connection &c)
+{
+	std::lock_guard<std::mutex> lock(keyToSqlMutex);
+	keyToSql.erase(&c);
 }
 
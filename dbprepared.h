@@ -5,4 +5,7 @@
 
 void prepare_deduplicated(pqxx::connection &c, std::string key, std::string sql);
 
+//Call before closing a connection, so a new connection at the same address starts afresh
+void forget_prepared(pqxx::connection &c);
+
 #endif //_DB_PREPARED_H
@@ -0,0 +1,159 @@
+#include "dbpublish.h"
+#include "dbmeta.h"
+#include "dbreplicate.h"
+#include "dbaugmenteddiff.h"
+#include "cppGzip/EncodeGzip.h"
+#include "cppo5m/osmxml.h"
+#include <boost/filesystem.hpp>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <ctime>
+using namespace std;
+namespace fs = boost::filesystem;
+
+std::string ReplicationSequencePath(int64_t sequence)
+{
+	stringstream out;
+	out << std::setfill('0') << std::setw(3) << (sequence / 1000000) << "/";
+	out << std::setfill('0') << std::setw(3) << ((sequence / 1000) % 1000) << "/";
+	out << std::setfill('0') << std::setw(3) << (sequence % 1000);
+	return out.str();
+}
+
+std::string EncodeReplicationState(int64_t sequence, int64_t timestamp)
+{
+	time_t t = timestamp;
+	struct tm tmUtc;
+	gmtime_r(&t, &tmUtc);
+
+	//Colons are escaped, as in a Java properties file
+	char buff[100];
+	stringstream out;
+	strftime(buff, sizeof(buff), "#%a %b %d %H:%M:%S UTC %Y", &tmUtc);
+	out << buff << "\n";
+	out << "sequenceNumber=" << sequence << "\n";
+	strftime(buff, sizeof(buff), "%Y-%m-%dT%H\\:%M\\:%SZ", &tmUtc);
+	out << "timestamp=" << buff << "\n";
+	return out.str();
+}
+
+bool DbGetReplicationState(pqxx::connection &c, pqxx::transaction_base *work,
+	const std::string &tablePrefix,
+	int64_t &sequenceOut, int64_t &timestampOut)
+{
+	string errStr;
+	try
+	{
+		sequenceOut = atol(DbGetMetaValue(c, work, "replication_sequence", tablePrefix, errStr).c_str());
+		timestampOut = atol(DbGetMetaValue(c, work, "replication_timestamp", tablePrefix, errStr).c_str());
+	}
+	catch (const std::exception &)
+	{
+		//Nothing published yet
+		return false;
+	}
+	return true;
+}
+
+bool DbSetReplicationState(pqxx::connection &c, pqxx::transaction_base *work,
+	const std::string &tablePrefix,
+	int64_t sequence, int64_t timestamp,
+	std::string &errStr)
+{
+	try
+	{
+		bool ok = DbSetMetaValue(c, work, "replication_sequence", to_string(sequence), tablePrefix, errStr);
+		if(!ok) return false;
+		return DbSetMetaValue(c, work, "replication_timestamp", to_string(timestamp), tablePrefix, errStr);
+	}
+	catch (const std::exception &e)
+	{
+		errStr = e.what();
+		return false;
+	}
+}
+
+//Writes a file under a temporary name, then renames it, so readers never see part of it
+bool WriteReplicationFile(const fs::path &pth, const std::string &content, std::string &errStr)
+{
+	fs::path tmpPth = pth;
+	tmpPth += ".tmp";
+	std::ofstream out(tmpPth.string(), std::ios::binary);
+	out << content;
+	out.close();
+	if(!out)
+	{
+		errStr = "Error writing " + tmpPth.string();
+		return false;
+	}
+	fs::rename(tmpPth, pth);
+	return true;
+}
+
+bool PublishReplicationDiff(pqxx::connection &c, pqxx::transaction_base *work, class DbUsernameLookup &usernames,
+	const std::string &tableStaticPrefix,
+	const std::string &tableActivePrefix,
+	const std::string &basePath,
+	int64_t sequence,
+	int64_t timestampStart, int64_t timestampEnd,
+	bool augmented,
+	std::string &errStr)
+{
+	fs::path seqPth = fs::path(basePath) / ReplicationSequencePath(sequence);
+	fs::create_directories(seqPth.parent_path());
+
+	fs::path diffPth = seqPth;
+	diffPth += ".osc.gz";
+	fs::path tmpPth = diffPth;
+	tmpPth += ".tmp";
+	{
+		std::filebuf outfi;
+		if(outfi.open(tmpPth.string(), std::ios::out | std::ios::binary) == nullptr)
+		{
+			errStr = "Error opening " + tmpPth.string();
+			return false;
+		}
+		class EncodeGzip gzipEnc(outfi);
+		class OsmChangeXmlEncode xmlEnc(gzipEnc, true);
+
+		GetReplicateDiffStream(c, work, usernames, tableStaticPrefix, tableActivePrefix, 
+			timestampStart, timestampEnd, xmlEnc);
+		xmlEnc.Finish();
+	}
+	fs::rename(tmpPth, diffPth);
+
+	if(augmented)
+	{
+		fs::path adiffPth = seqPth;
+		adiffPth += ".adiff.gz";
+		tmpPth = adiffPth;
+		tmpPth += ".tmp";
+		{
+			std::filebuf outfi;
+			if(outfi.open(tmpPth.string(), std::ios::out | std::ios::binary) == nullptr)
+			{
+				errStr = "Error opening " + tmpPth.string();
+				return false;
+			}
+			class EncodeGzip gzipEnc(outfi);
+			class AugmentedDiffXmlEncode adiffEnc(gzipEnc);
+
+			GetAugmentedDiffStream(c, work, usernames, tableStaticPrefix, tableActivePrefix, 
+				timestampStart, timestampEnd, adiffEnc);
+			adiffEnc.Finish();
+		}
+		fs::rename(tmpPth, adiffPth);
+	}
+
+	string state = EncodeReplicationState(sequence, timestampEnd);
+	fs::path statePth = seqPth;
+	statePth += ".state.txt";
+	return WriteReplicationFile(statePth, state, errStr);
+}
+
+bool WriteReplicationState(const std::string &basePath, int64_t sequence, int64_t timestamp,
+	std::string &errStr)
+{
+	return WriteReplicationFile(fs::path(basePath) / "state.txt", EncodeReplicationState(sequence, timestamp), errStr);
+}
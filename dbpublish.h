@@ -0,0 +1,45 @@
+#ifndef _DB_PUBLISH_H
+#define _DB_PUBLISH_H
+
+#include <pqxx/pqxx> //apt install libpqxx-dev
+#include <string>
+#include "dbusername.h"
+
+///Path of a sequence number in the usual replication layout, e.g. 1234567 gives "001/234/567"
+std::string ReplicationSequencePath(int64_t sequence);
+
+///Contents of a state.txt file
+std::string EncodeReplicationState(int64_t sequence, int64_t timestamp);
+
+///Reads the sequence and timestamp of the last published diff from the meta table.
+///Returns false if nothing has been published.
+bool DbGetReplicationState(pqxx::connection &c, pqxx::transaction_base *work,
+	const std::string &tablePrefix,
+	int64_t &sequenceOut, int64_t &timestampOut);
+
+bool DbSetReplicationState(pqxx::connection &c, pqxx::transaction_base *work,
+	const std::string &tablePrefix,
+	int64_t sequence, int64_t timestamp,
+	std::string &errStr);
+
+///Writes the changes with timestamps after timestampStart, up to and including 
+///timestampEnd, as basePath/AAA/BBB/CCC.osc.gz with its CCC.state.txt. With augmented, 
+///CCC.adiff.gz is also written, with the version before each change. Files are written 
+///under a temporary name and renamed into place. basePath/state.txt is not touched: 
+///it is written with WriteReplicationState once the sequence is committed.
+bool PublishReplicationDiff(pqxx::connection &c, pqxx::transaction_base *work, class DbUsernameLookup &usernames,
+	const std::string &tableStaticPrefix,
+	const std::string &tableActivePrefix,
+	const std::string &basePath,
+	int64_t sequence,
+	int64_t timestampStart, int64_t timestampEnd,
+	bool augmented,
+	std::string &errStr);
+
+///Replaces basePath/state.txt, which tells consumers the latest sequence. Only call this
+///after the sequence has been committed with DbSetReplicationState, so a sequence number
+///is never announced and then published again with different content.
+bool WriteReplicationState(const std::string &basePath, int64_t sequence, int64_t timestamp,
+	std::string &errStr);
+
+#endif //_DB_PUBLISH_H
@@ -1,6 +1,7 @@
 #include "dbquery.h"
 #include "dbdecode.h"
 #include "dbfilters.h"
+#include "dbcommon.h"
 using namespace std;
 
 // ************* Basic query methods ***************
@@ -168,13 +169,11 @@ void GetVisibleObjectsById(pqxx::connection &c, pqxx::transaction_base *work,
 {
 	string nodeTable = c.quote_name(tablePrefix + "visible" +objType+ "s");
 
-	stringstream sqlFrags;
+	std::vector<int64_t> ids;
 	int count = 0;
 	for(; it != objIds.end() && count < step; it++)
 	{
-		if(count >= 1)
-			sqlFrags << " OR ";
-		sqlFrags << nodeTable << ".id = " << *it;
+		ids.push_back(*it);
 		count ++;
 	}
 	if(count == 0) return;
@@ -184,7 +183,7 @@ void GetVisibleObjectsById(pqxx::connection &c, pqxx::transaction_base *work,
 		sql += ", ST_X(geom) as lon, ST_Y(geom) AS lat";
 
 	sql += " FROM "+ nodeTable;
-	sql += " WHERE ("+sqlFrags.str()+")";
+	sql += " WHERE "+DbIdListCondition(nodeTable+".id", ids);
 	sql += ";";
 
 	pqxx::icursorstream cursor( *work, sql, "objcursor", 1000 );	
@@ -213,6 +212,7 @@ void DbGetObjectsByIdVer(pqxx::connection &c, pqxx::transaction_base *work,
 	string objTable = c.quote_name(tablePrefix+liveOrOld+objType+"s");
 
 	stringstream sqlFrags;
+	std::vector<int64_t> ids;
 	int count = 0;
 	if(objType == "relation") //Relations are dumped in one shot
 		step = 0;
@@ -221,6 +221,7 @@ void DbGetObjectsByIdVer(pqxx::connection &c, pqxx::transaction_base *work,
 		if(count >= 1)
 			sqlFrags << " OR ";
 		sqlFrags << "(" << objTable << ".id = " << it->first << " AND " << objTable << ".version = " << it->second << ")";
+		ids.push_back(it->first);
 		count ++;
 	}
 
@@ -228,7 +229,8 @@ void DbGetObjectsByIdVer(pqxx::connection &c, pqxx::transaction_base *work,
 	if(objType == "node")
 		sql += ", ST_X(geom) as lon, ST_Y(geom) AS lat";
 	sql += " FROM "+ objTable;
-	sql += " WHERE "+sqlFrags.str();
+	//The plain ID list is redundant, but lets the planner skip partitions
+	sql += " WHERE "+DbIdListCondition(objTable+".id", ids)+" AND ("+sqlFrags.str()+")";
 	sql += ";";
 
 	pqxx::icursorstream cursor( *work, sql, "objectidvercursor", 1000 );	
@@ -256,15 +258,13 @@ void DbGetObjectsHistoryById(pqxx::connection &c, pqxx::transaction_base *work,
 {
 	string objTable = c.quote_name(tablePrefix+liveOrOld+objType+"s");
 
-	stringstream sqlFrags;
+	std::vector<int64_t> ids;
 	int count = 0;
 	if(objType == "relation") //Relations are dumped in one shot
 		step = 0;
 	for(; it != objIds.end() && (count < step || step == 0); it++)
 	{
-		if(count >= 1)
-			sqlFrags << " OR ";
-		sqlFrags << objTable << ".id = " << *it;
+		ids.push_back(*it);
 		count ++;
 	}
 
@@ -272,7 +272,7 @@ void DbGetObjectsHistoryById(pqxx::connection &c, pqxx::transaction_base *work,
 	if(objType == "node")
 		sql += ", ST_X(geom) as lon, ST_Y(geom) AS lat";
 	sql += " FROM "+ objTable;
-	sql += " WHERE "+sqlFrags.str();
+	sql += " WHERE "+DbIdListCondition(objTable+".id", ids);
 	sql += ";";
 
 	pqxx::icursorstream cursor( *work, sql, "objecthistorycursor", 1000 );	
@@ -375,15 +375,7 @@ void GetVisibleObjectBboxesById(pqxx::connection &c, pqxx::transaction_base *wor
 		return;
 	string objTable = c.quote_name(tablePrefix+"visible"+objType+"s");
 
-	stringstream sqlFrags;
-	int count = 0;
-	for(std::set<int64_t>::const_iterator it=wayIds.begin(); it != wayIds.end(); it++)
-	{
-		if(count >= 1)
-			sqlFrags << " OR ";
-		sqlFrags << objTable << ".id = " << *it;
-		count ++;
-	}
+	std::vector<int64_t> ids(wayIds.begin(), wayIds.end());
 
 	string sql = "SELECT *, ";
 	if(objType == "node")
@@ -399,7 +391,7 @@ void GetVisibleObjectBboxesById(pqxx::connection &c, pqxx::transaction_base *wor
 
 	sql += " FROM "+ objTable;
 
-	sql += " WHERE ("+sqlFrags.str()+")";
+	sql += " WHERE "+DbIdListCondition(objTable+".id", ids);
 	sql += ";";
 
 	pqxx::icursorstream cursor( *work, sql, "waycursor", 1000 );	
@@ -1,5 +1,7 @@
 #include "dbreplicate.h"
 #include "dbdecode.h"
+#include "dbdump.h"
+#include "dbchangelog.h"
 #include <set>
 using namespace std;
 
@@ -101,3 +103,122 @@ void GetReplicateDiffRelations(pqxx::connection &c, pqxx::transaction_base *work
 	}
 }
 
+
+void GetReplicateDiffStream(pqxx::connection &c, pqxx::transaction_base *work, class DbUsernameLookup &usernames,
+	const string &tableStaticPrefix, 
+	const string &tableActivePrefix, 
+	int64_t timestampStart, int64_t timestampEnd,
+	class IOsmChangeBlock &out)
+{
+	string objTypes[] = {"node", "way", "relation"};
+	string prefixes[] = {tableStaticPrefix, tableActivePrefix};
+	string tableTypes[] = {"live", "old"};
+
+	//If the active changelog covers the range, the changed versions are found with one range
+	//scan of it for each table. Static tables are only written on import, so aren't logged.
+	std::vector<std::shared_ptr<class DumpCursorSource> > sources;
+	int64_t logStart = DbChangeLogStart(c, work, tableActivePrefix);
+	bool useLog = logStart >= 0 and timestampStart >= logStart;
+	if(useLog)
+	{
+		string logTable = c.quote_name(tableActivePrefix + "changelog");
+		for(int i=0; i<3; i++)
+			for(int k=0; k<2; k++)
+			{
+				string table = c.quote_name(tableActivePrefix + tableTypes[k] + objTypes[i] + "s");
+				stringstream sql;
+				sql << "SELECT " << table << ".*";
+				if(objTypes[i] == "node")
+					sql << ", ST_X(geom) as lon, ST_Y(geom) AS lat";
+				sql << " FROM " << logTable << " INNER JOIN " << table;
+				sql << " ON " << table << ".id = " << logTable << ".id AND " << table << ".version = " << logTable << ".version";
+				sql << " WHERE " << logTable << ".objtype = " << c.quote(objTypes[i]);
+				sql << " AND " << logTable << ".timestamp > " << timestampStart << " AND " << logTable << ".timestamp <= " << timestampEnd;
+				sql << " ORDER BY " << logTable << ".timestamp;";
+
+				stringstream cursorName;
+				cursorName << objTypes[i] << "diff" << sources.size();
+				sources.push_back(make_shared<class DumpCursorSource>(work, usernames, objTypes[i], sql.str(), cursorName.str()));
+			}
+	}
+
+	//Otherwise each cursor is read in timestamp order with the timestamp index
+	for(int i=0; i<3 and !useLog; i++)
+		for(int j=0; j<2; j++)
+			for(int k=0; k<2; k++)
+			{
+				string table = c.quote_name(prefixes[j] + tableTypes[k] + objTypes[i] + "s");
+				stringstream sql;
+				sql << "SELECT " << table << ".*";
+				if(objTypes[i] == "node")
+					sql << ", ST_X(geom) as lon, ST_Y(geom) AS lat";
+				sql << " FROM " << table;
+				sql << " WHERE timestamp > " << timestampStart << " AND timestamp <= " << timestampEnd;
+				sql << " ORDER BY " << table << ".timestamp;";
+
+				stringstream cursorName;
+				cursorName << objTypes[i] << "diff" << sources.size();
+				sources.push_back(make_shared<class DumpCursorSource>(work, usernames, objTypes[i], sql.str(), cursorName.str()));
+			}
+
+	std::shared_ptr<class OsmData> block(new class OsmData());
+	string blockAction;
+	size_t blockObjects = 0;
+	while(true)
+	{
+		//Earliest object, with ties going to nodes, then ways, then relations
+		int lowest = -1;
+		int64_t lowestTimestamp = 0;
+		for(size_t i=0; i<sources.size(); i++)
+		{
+			const class OsmObject *obj = sources[i]->PeekNext();
+			if(obj == nullptr)
+				continue;
+			if(lowest == -1 or obj->metaData.timestamp < lowestTimestamp)
+			{
+				lowest = i;
+				lowestTimestamp = obj->metaData.timestamp;
+			}
+		}
+		if(lowest == -1)
+			break;
+
+		const class OsmObject *obj = sources[lowest]->PeekNext();
+		string action = "modify";
+		if(!obj->metaData.visible)
+			action = "delete";
+		else if(obj->metaData.version == 1)
+			action = "create";
+
+		if(blockObjects > 0 and (action != blockAction or blockObjects >= 1000))
+		{
+			out.StoreOsmData(blockAction, *block, false);
+			block.reset(new class OsmData());
+			blockObjects = 0;
+		}
+		blockAction = action;
+		sources[lowest]->WriteNext(block);
+		blockObjects ++;
+	}
+
+	if(blockObjects > 0)
+		out.StoreOsmData(blockAction, *block, false);
+}
+
+// **********************************************
+
+OsmChangeToDiffStream::OsmChangeToDiffStream(std::shared_ptr<IDataStreamHandler> encIn):
+	enc(encIn)
+{
+	enc->StoreIsDiff(true);
+}
+
+OsmChangeToDiffStream::~OsmChangeToDiffStream()
+{
+
+}
+
+void OsmChangeToDiffStream::StoreOsmData(const std::string &action, const class OsmData &osmData, bool ifunused)
+{
+	osmData.StreamTo(*enc, false);
+}
@@ -25,5 +25,30 @@ void GetReplicateDiffRelations(pqxx::connection &c, pqxx::transaction_base *work
 	int64_t timestampStart, int64_t timestampEnd,
 	class OsmChange &out);
 
+///Writes the objects with versions in the time range to out, in timestamp order, by
+///merging ordered cursors on the live and old tables of both table sets. Objects are 
+///passed on in small blocks with one action each, so memory use doesn't grow with the
+///size of the diff. Within a block, nodes come before ways and relations. If the active
+///changelog covers the range, the changed versions are found from it instead.
+void GetReplicateDiffStream(pqxx::connection &c, pqxx::transaction_base *work, class DbUsernameLookup &usernames, 
+	const std::string &tableStaticPrefix, 
+	const std::string &tableActivePrefix, 
+	int64_t timestampStart, int64_t timestampEnd,
+	class IOsmChangeBlock &out);
+
+///Passes osmChange blocks on to an encoder as a diff (such as o5c), in which deleted
+///objects are marked as not visible
+class OsmChangeToDiffStream : public IOsmChangeBlock
+{
+public:
+	OsmChangeToDiffStream(std::shared_ptr<IDataStreamHandler> encIn);
+	virtual ~OsmChangeToDiffStream();
+
+	void StoreOsmData(const std::string &action, const class OsmData &osmData, bool ifunused);
+
+protected:
+	std::shared_ptr<IDataStreamHandler> enc;
+};
+
 #endif //_DB_REPLICATE_H
 
@@ -888,31 +888,26 @@ int UpdateWayBboxesById(pqxx::connection &c, pqxx::transaction_base *work,
 	const std::string &tablePrefix, 
 	std::string &errStr)
 {
-	stringstream sqlFrags;
-	int count = 0;
+	std::vector<int64_t> ids;
 	string wayTable = tablePrefix+"liveways";
 	for(std::set<int64_t>::const_iterator it = wayIds.begin(); it != wayIds.end(); it++)
 	{
-		if(count >= 1)
-			sqlFrags << " OR ";
-		sqlFrags << wayTable << ".id = " << *it;
-		count ++;
+		ids.push_back(*it);
 
-		if(count > 100)
+		if(ids.size() > 100)
 		{
-			string sql = "UPDATE "+tablePrefix+"liveways SET bbox=ST_Envelope(ST_Union(ARRAY(SELECT geom FROM "+tablePrefix+"visiblenodes WHERE "+tablePrefix+"visiblenodes.id::bigint = ANY(ARRAY(SELECT jsonb_array_elements("+tablePrefix+"liveways.members))::text[]::bigint[])))) WHERE ("+sqlFrags.str()+");";
+			string sql = "UPDATE "+tablePrefix+"liveways SET bbox=ST_Envelope(ST_Union(ARRAY(SELECT geom FROM "+tablePrefix+"visiblenodes WHERE "+tablePrefix+"visiblenodes.id::bigint = ANY(ARRAY(SELECT jsonb_array_elements("+tablePrefix+"liveways.members))::text[]::bigint[])))) WHERE "+DbIdListCondition(wayTable+".id", ids)+";";
 			//cout << sql << endl;
 
 			work->exec(sql, "UpdateWayBboxesById1");
 
-			sqlFrags.str("");
-			count = 0;
+			ids.clear();
 		}
 	}
 
-	if(count > 0)
+	if(ids.size() > 0)
 	{
-		string sql = "UPDATE "+tablePrefix+"liveways SET bbox=ST_Envelope(ST_Union(ARRAY(SELECT geom FROM "+tablePrefix+"visiblenodes WHERE "+tablePrefix+"visiblenodes.id::bigint = ANY(ARRAY(SELECT jsonb_array_elements("+tablePrefix+"liveways.members))::text[]::bigint[])))) WHERE ("+sqlFrags.str()+");";
+		string sql = "UPDATE "+tablePrefix+"liveways SET bbox=ST_Envelope(ST_Union(ARRAY(SELECT geom FROM "+tablePrefix+"visiblenodes WHERE "+tablePrefix+"visiblenodes.id::bigint = ANY(ARRAY(SELECT jsonb_array_elements("+tablePrefix+"liveways.members))::text[]::bigint[])))) WHERE "+DbIdListCondition(wayTable+".id", ids)+";";
 		//cout << sql << endl;
 
 		work->exec(sql, "UpdateWayBboxesById2");
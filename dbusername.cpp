@@ -48,6 +48,11 @@ DbUsernameLookup::~DbUsernameLookup()
 
 }
 
+void DbUsernameLookup::SetTransaction(pqxx::transaction_base *workIn)
+{
+	this->work = workIn;
+}
+
 std::string DbUsernameLookup::Find(int uid)
 {
 	if(uid == 0)
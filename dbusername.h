@@ -22,6 +22,8 @@ public:
 	virtual ~DbUsernameLookup();
 
 	std::string Find(int uid);
+	//Use a new transaction on the same connection
+	void SetTransaction(pqxx::transaction_base *workIn);
 };
 
 void DbUpsertUsernamePrepare(pqxx::connection &c, pqxx::transaction_base *work, const std::string &tablePrefix);
@@ -1,7 +1,6 @@
 #include <fstream>
 #include <iostream>
 #include "util.h"
-#include "cppGzip/EncodeGzip.h"
 #include "cppo5m/OsmData.h"
 #include "cppo5m/osmxml.h"
 #include "pgmap.h"
@@ -14,54 +13,21 @@ class OutputFileAndEncoder
 {
 public:
 	shared_ptr<IDataStreamHandler> enc;
-	EncodeGzip *gzipEnc;
-	std::filebuf outfi;
-
-	OutputFileAndEncoder()
-	{
-		gzipEnc = nullptr;
-	}
-
-	virtual ~OutputFileAndEncoder()
-	{
-		if(gzipEnc != nullptr)
-			delete gzipEnc;
-		gzipEnc = nullptr;
-		outfi.close();
-	}
 };
 
-shared_ptr<OutputFileAndEncoder> CreateOutEncoder(const::string &extension, fs::path pth, int zoom, int tilex, int tiley)
+shared_ptr<OutputFileAndEncoder> CreateOutEncoder(const::string &extension, fs::path pth, int zoom, int tilex, int tiley, int compressThreads)
 {
 	shared_ptr<OutputFileAndEncoder> out(new OutputFileAndEncoder());
 	string outFina = to_string(tiley)+extension;
 	fs::path outPth = pth / outFina;
 
-	vector<string> outFinaSp = split(outFina, '.');
-	if(outFinaSp.size() < 3)
-	{
-		cerr << "Output file name does not have a recognized extension" << endl;
-		exit(-2);
-	}
-
-	if(outFinaSp[outFinaSp.size()-1] == "gz" && outFinaSp[outFinaSp.size()-2] == "o5m")
+	try
 	{
-		out->outfi.open(outPth.string(), std::ios::out);
-		out->gzipEnc = new class EncodeGzip(out->outfi);
-
-		out->enc.reset(new O5mEncode(*out->gzipEnc));
-	}
-	else if(outFinaSp[outFinaSp.size()-1] == "gz" && outFinaSp[outFinaSp.size()-2] == "osm")
-	{
-		out->outfi.open(outPth.string(), std::ios::out);
-		out->gzipEnc = new class EncodeGzip(out->outfi);
-
-		TagMap empty;
-		out->enc.reset(new OsmXmlEncode(*out->gzipEnc, empty));
+		out->enc = OpenOsmOutputFile(outPth.string(), compressThreads);
 	}
-	else
+	catch (runtime_error &err)
 	{
-		cerr << "Output file name does not have a recognized extension" << endl;
+		cerr << err.what() << endl;
 		exit(-2);
 	}
 	return out;
@@ -78,6 +44,7 @@ int main(int argc, char **argv)
 		("preset", po::value<string>(), "preset area name")
 		("zoom", po::value<int>()->default_value(12), "zoom (e.g. 12)")
 		("extension", po::value<string>()->default_value(".osm.gz"), "output file extension")
+		("compress-threads", po::value<int>()->default_value(1), "number of threads compressing each tile")
 		("out", po::value<string>()->default_value("."), "path to output")
 	;
 	bool skipExisting = true;
@@ -199,7 +166,7 @@ int main(int argc, char **argv)
 			if(skipExisting and fs::exists(outPth))
 				continue;
 
-			shared_ptr<OutputFileAndEncoder> outputFileAndEncoder = CreateOutEncoder(vm["extension"].as<string>(), pth2, zoom, x, y);
+			shared_ptr<OutputFileAndEncoder> outputFileAndEncoder = CreateOutEncoder(vm["extension"].as<string>(), pth2, zoom, x, y, vm["compress-threads"].as<int>());
 
 			vector<double> tileBbox = {tilex2long(x, zoom), tiley2lat(y, zoom), tilex2long(x+1, zoom), tiley2lat(y+1, zoom)};
 
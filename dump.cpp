@@ -1,23 +1,98 @@
 #include <fstream>
 #include <iostream>
+#include <iomanip>
+#include <sstream>
 #include "pgmap.h"
 #include "util.h"
-#include "cppGzip/EncodeGzip.h"
-#include "cppo5m/osmxml.h"
+#include <boost/program_options.hpp>
+namespace po = boost::program_options;
+
+//The extension of a file name, from its first dot
+std::string OutputExtension(const std::string &fina)
+{
+	size_t nameStart = fina.rfind('/');
+	nameStart = nameStart == string::npos ? 0 : nameStart + 1;
+	size_t dot = fina.find('.', nameStart);
+	if(dot == string::npos)
+		return "";
+	return fina.substr(dot);
+}
 
 int main(int argc, char **argv)
-{	
-	std::filebuf outfi;
-	outfi.open("dump.o5m.gz", std::ios::out);
-	EncodeGzip *gzipEnc = new class EncodeGzip(outfi);
+{
+	po::options_description desc("Allowed options");
+	desc.add_options()
+		("help", "produce help message")
+		("workers", po::value<int>(), "number of connections to read on (default is 1)")
+		("fragments", po::value<int>(), "write each type as this many files split by ID, rather than one file")
+		("out", po::value<string>(), "output file, .o5m or .osm with .gz or .zst, or .osm.pbf (default is dump.o5m.gz)")
+		("previous", po::value<string>(), "previous dump (.o5m.gz, in ID order) to update rather than dumping everything")
+		("since", po::value<int64_t>(), "timestamp of the previous dump; objects with versions from then on are read again")
+		("compress-threads", po::value<int>(), "number of threads compressing the output (default is 4)")
+		("verbose", po::value<int>(), "verbosity level (default is 0)")
+	;
+
+	po::variables_map vm;
+	po::store(po::parse_command_line(argc, argv, desc), vm);
+	po::notify(vm);
+
+	if (vm.count("help")) {
+		cout << desc << "\n";
+		return 1;
+	}
 
-	shared_ptr<IDataStreamHandler> enc(new O5mEncode(*gzipEnc));
+	int numWorkers = 1;
+	if (vm.count("workers"))
+		numWorkers = vm["workers"].as<int>();
+	int numFragments = 0;
+	if (vm.count("fragments"))
+		numFragments = vm["fragments"].as<int>();
+	int verbose = 0;
+	if (vm.count("verbose"))
+		verbose = vm["verbose"].as<int>();
+	string outFina = "dump.o5m.gz";
+	if (vm.count("out"))
+		outFina = vm["out"].as<string>();
+	int compressThreads = 4;
+	if (vm.count("compress-threads"))
+		compressThreads = vm["compress-threads"].as<int>();
+
+	string previousFina;
+	if (vm.count("previous"))
+		previousFina = vm["previous"].as<string>();
+	int64_t sinceTimestamp = -1;
+	if (vm.count("since"))
+		sinceTimestamp = vm["since"].as<int64_t>();
+	if (previousFina.size() > 0 and sinceTimestamp < 0)
+	{
+		cout << "--previous also needs --since" << endl;
+		return 1;
+	}
+	if (previousFina.size() > 0 and (previousFina == outFina or numFragments > 0))
+	{
+		cout << "--previous needs a different output file and can't be used with --fragments" << endl;
+		return 1;
+	}
+
+	//Fragments are named after their range, with the same extension
+	string outExt = OutputExtension(outFina);
+	std::shared_ptr<IDataStreamHandler> enc;
+	try
+	{
+		if(numFragments == 0)
+			enc = OpenOsmOutputFile(outFina, compressThreads);
+	}
+	catch (runtime_error &err)
+	{
+		cout << err.what() << endl;
+		return 1;
+	}
 
 	cout << "Reading settings from config.cfg" << endl;
 	std::map<string, string> config;
 	ReadSettingsFile("config.cfg", config);
-	
-	string cstr = GeneratePgConnectionString(config);	
+
+	string cstr = GeneratePgConnectionString(config);
 	class PgMap pgMap(cstr, config["dbtableprefix"], config["dbtablemodifyprefix"], config["dbtablemodifyprefix"], config["dbtabletestprefix"]);
 
 	if (pgMap.Ready()) {
@@ -29,11 +104,50 @@ int main(int argc, char **argv)
 	bool order = true;
 
 	std::shared_ptr<class PgTransaction> transaction = pgMap.GetTransaction("ACCESS SHARE");
-	transaction->Dump(order, true, true, true, enc);
+	class PgMapError errStr;
+	bool ok = true;
+
+	if(numFragments > 0)
+	{
+		//The fragment function is called for one range at a time
+		std::vector<class DumpRange> ranges;
+		std::map<size_t, string> fragmentFinas;
+		ok = transaction->DumpFragments(true, true, true, numWorkers, numFragments, verbose,
+			[outExt, compressThreads, &fragmentFinas](const class DumpRange &range, size_t rangeNum)
+			{
+				stringstream fina;
+				fina << "dump-" << std::setfill('0') << std::setw(4) << rangeNum << "-" << range.objType << outExt;
+				fragmentFinas[rangeNum] = fina.str();
+				return OpenOsmOutputFile(fina.str(), compressThreads);
+			}, ranges, errStr);
+
+		if(ok)
+		{
+			std::vector<string> finas;
+			for(size_t i=0; i<ranges.size(); i++)
+				finas.push_back(fragmentFinas[i]);
+			string manifest;
+			EncodeDumpManifest(ranges, finas, manifest);
+			std::ofstream manifestFile("dump-manifest.json");
+			manifestFile << manifest << endl;
+		}
+	}
+	else
+	{
+		if(previousFina.size() > 0)
+			ok = transaction->DumpIncremental(previousFina, sinceTimestamp, verbose, enc, errStr);
+		else if(numWorkers > 1)
+			ok = transaction->DumpParallel(true, true, true, numWorkers, verbose, enc, errStr);
+		else
+			transaction->Dump(order, true, true, true, enc);
+	}
+
+	if(!ok)
+	{
+		cout << errStr.errStr << endl;
+		return 1;
+	}
 
-	delete gzipEnc;
-	outfi.close();
-	
 	cout << "Add done!" << endl;
 	return 0;
 }
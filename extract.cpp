@@ -1,7 +1,6 @@
 #include <fstream>
 #include <iostream>
 #include "util.h"
-#include "cppGzip/EncodeGzip.h"
 #include "cppo5m/OsmData.h"
 #include "cppo5m/osmxml.h"
 #include "pgmap.h"
@@ -16,7 +15,8 @@ int main(int argc, char **argv)
 		("help", "produce help message")
 		("wkt", po::value<string>(), "WKT polygon file name")
 		("bbox", po::value<string>(), "bbox shape (e.g -1.078,50.788,-1.074,50.790)")
-		("out", po::value<string>(), "Output file name (extension must be .osm.gz or .o5m.gz)")
+		("out", po::value<string>(), "Output file name (extension must be .osm or .o5m with .gz or .zst, or .osm.pbf)")
+		("compress-threads", po::value<int>()->default_value(4), "number of threads compressing the output")
 	;
 
 	po::variables_map vm;
@@ -61,36 +61,14 @@ int main(int argc, char **argv)
 	{
 		outFina = vm["out"].as<string>();
 	}
-	vector<string> outFinaSp = split(outFina, '.');
-	if(outFinaSp.size() < 3)
-	{
-		cerr << "Output file name does not have a recognized extension" << endl;
-		exit(-2);
-	}
-
-
-	std::filebuf outfi;
-	EncodeGzip *gzipEnc = nullptr;
 	shared_ptr<IDataStreamHandler> enc;
-
-	if(outFinaSp[outFinaSp.size()-1] == "gz" && outFinaSp[outFinaSp.size()-2] == "o5m")
+	try
 	{
-		outfi.open(outFina, std::ios::out);
-		gzipEnc = new class EncodeGzip(outfi);
-
-		enc.reset(new O5mEncode(*gzipEnc));
+		enc = OpenOsmOutputFile(outFina, vm["compress-threads"].as<int>());
 	}
-	else if(outFinaSp[outFinaSp.size()-1] == "gz" && outFinaSp[outFinaSp.size()-2] == "osm")
-	{
-		outfi.open(outFina, std::ios::out);
-		gzipEnc = new class EncodeGzip(outfi);
-
-		TagMap empty;
-		enc.reset(new OsmXmlEncode(*gzipEnc, empty));
-	}
-	else
+	catch (runtime_error &err)
 	{
-		cerr << "Output file name does not have a recognized extension" << endl;
+		cerr << err.what() << endl;
 		exit(-2);
 	}
 
@@ -122,7 +100,5 @@ int main(int argc, char **argv)
 		ret = mapQuery->Continue();
 	}
 
-	delete gzipEnc;
-	outfi.close();
 	return 0;
 }
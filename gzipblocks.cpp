@@ -0,0 +1,309 @@
+#include "gzipblocks.h"
+#include <zlib.h>
+#include <stdexcept>
+#include <cstring>
+using namespace std;
+
+//Gzip header with FEXTRA, followed by the 8 byte extra field
+#define GZIP_BLOCK_HEADER_LEN 20
+
+void WriteUint32LE(uint32_t val, char *out)
+{
+	out[0] = val & 0xff;
+	out[1] = (val >> 8) & 0xff;
+	out[2] = (val >> 16) & 0xff;
+	out[3] = (val >> 24) & 0xff;
+}
+
+uint32_t ReadUint32LE(const char *in)
+{
+	const unsigned char *b = (const unsigned char *)in;
+	return b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24);
+}
+
+void EncodeGzipBlock(const char *data, size_t len, int compressionLevel, std::string &out)
+{
+	z_stream strm;
+	memset(&strm, 0x00, sizeof(z_stream));
+	//Raw deflate, since the header is written by hand to include the member size
+	if(deflateInit2(&strm, compressionLevel, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		throw runtime_error("deflateInit2 failed");
+
+	size_t bound = deflateBound(&strm, len);
+	out.resize(GZIP_BLOCK_HEADER_LEN + bound + 8);
+
+	strm.next_in = (Bytef *)data;
+	strm.avail_in = len;
+	strm.next_out = (Bytef *)&out[GZIP_BLOCK_HEADER_LEN];
+	strm.avail_out = bound;
+	int ret = deflate(&strm, Z_FINISH);
+	size_t compressedLen = bound - strm.avail_out;
+	deflateEnd(&strm);
+	if(ret != Z_STREAM_END)
+		throw runtime_error("deflate failed");
+
+	size_t memberLen = GZIP_BLOCK_HEADER_LEN + compressedLen + 8;
+	char *h = &out[0];
+	h[0] = 0x1f; h[1] = (char)0x8b; h[2] = 8; h[3] = 4; //FEXTRA
+	WriteUint32LE(0, &h[4]); //mtime
+	h[8] = 0; h[9] = (char)255; //unknown OS
+	h[10] = 8; h[11] = 0; //XLEN
+	h[12] = 'P'; h[13] = 'M'; h[14] = 4; h[15] = 0;
+	WriteUint32LE(memberLen, &h[16]);
+
+	char *t = &out[GZIP_BLOCK_HEADER_LEN + compressedLen];
+	WriteUint32LE(crc32(crc32(0L, Z_NULL, 0), (const Bytef *)data, len), &t[0]);
+	WriteUint32LE(len & 0xffffffff, &t[4]);
+	out.resize(memberLen);
+}
+
+EncodeGzipBlocks::EncodeGzipBlocks(std::streambuf &outIn, size_t blockSizeIn, int compressionLevelIn,
+		int numThreadsIn, bool splitAtLinesIn):
+	out(outIn),
+	blockSize(blockSizeIn),
+	compressionLevel(compressionLevelIn),
+	numThreads(numThreadsIn),
+	splitAtLines(splitAtLinesIn),
+	memberWritten(false),
+	finished(false)
+{
+	buffer.reserve(blockSize + 1024);
+}
+
+EncodeGzipBlocks::~EncodeGzipBlocks()
+{
+	try
+	{
+		Finish();
+	}
+	catch (std::exception &err) {}
+}
+
+void EncodeGzipBlocks::Finish()
+{
+	if(finished)
+		return;
+	finished = true;
+	WriteBlocks(true);
+	out.pubsync();
+}
+
+int EncodeGzipBlocks::overflow(int c)
+{
+	if(c == EOF)
+		return c;
+	if(finished)
+		throw runtime_error("gzip output already finished");
+	buffer.push_back((char)c);
+	if(buffer.size() >= blockSize)
+		WriteBlocks(false);
+	return c;
+}
+
+std::streamsize EncodeGzipBlocks::xsputn(const char* s, std::streamsize n)
+{
+	if(finished)
+		throw runtime_error("gzip output already finished");
+	buffer.append(s, n);
+	if(buffer.size() >= blockSize)
+		WriteBlocks(false);
+	return n;
+}
+
+int EncodeGzipBlocks::sync()
+{
+	if(!finished)
+		WriteBlocks(true);
+	return out.pubsync();
+}
+
+void EncodeGzipBlocks::WriteBlocks(bool flushAll)
+{
+	size_t start = 0;
+	while(start < buffer.size())
+	{
+		//End each member after a line break, so lines are never split between members
+		size_t end = buffer.size();
+		if(buffer.size() - start >= blockSize)
+		{
+			size_t pos = string::npos;
+			if(splitAtLines)
+				pos = buffer.find('\n', start + blockSize - 1);
+			else
+				pos = start + blockSize - 1;
+			if(pos != string::npos)
+				end = pos + 1;
+			else if(!flushAll)
+				break;
+		}
+		else if(!flushAll)
+			break;
+
+		std::string data = buffer.substr(start, end - start);
+		int level = compressionLevel;
+		pending.push_back(std::async(numThreads > 1 ? std::launch::async : std::launch::deferred, 
+			[data, level]() {
+				string member;
+				EncodeGzipBlock(data.c_str(), data.size(), level, member);
+				return member;
+			}));
+		start = end;
+		memberWritten = true;
+
+		//Let up to numThreads members compress while more data arrives
+		WritePending(numThreads > 1 ? numThreads : 0);
+	}
+	buffer.erase(0, start);
+
+	//An empty file is not valid gzip, so empty input still gets one (empty) member
+	if(flushAll and !memberWritten)
+	{
+		string member;
+		EncodeGzipBlock("", 0, compressionLevel, member);
+		pending.push_back(std::async(std::launch::deferred, [member]() {return member;}));
+		memberWritten = true;
+	}
+	if(flushAll)
+		WritePending(0);
+}
+
+void EncodeGzipBlocks::WritePending(size_t maxPending)
+{
+	while(pending.size() > maxPending)
+	{
+		string member = pending.front().get();
+		pending.pop_front();
+		out.sputn(member.c_str(), member.size());
+	}
+}
+
+// ************************************************
+
+void DecodeGzipBlock(const std::string &member, std::string &out)
+{
+	if(member.size() < 18)
+		throw runtime_error("Gzip member too short");
+	//Room for one more byte, so the output pointer is valid for an empty member
+	size_t len = ReadUint32LE(&member[member.size()-4]);
+	out.resize(len + 1);
+
+	z_stream strm;
+	memset(&strm, 0x00, sizeof(z_stream));
+	if(inflateInit2(&strm, 15+16) != Z_OK)
+		throw runtime_error("inflateInit2 failed");
+	strm.next_in = (Bytef *)member.c_str();
+	strm.avail_in = member.size();
+	strm.next_out = (Bytef *)&out[0];
+	strm.avail_out = out.size();
+	int ret = inflate(&strm, Z_FINISH);
+	inflateEnd(&strm);
+	out.resize(len);
+	if(ret != Z_STREAM_END)
+		throw runtime_error("inflate failed on gzip member");
+}
+
+DecodeGzipBlocks::DecodeGzipBlocks(std::istream &inIn, int numThreadsIn, 
+	std::function<void(std::string &)> transformIn):
+	in(inIn),
+	numThreads(numThreadsIn),
+	transform(transformIn),
+	endOfInput(false)
+{
+	if(numThreads < 1)
+		numThreads = 1;
+}
+
+DecodeGzipBlocks::~DecodeGzipBlocks()
+{
+	//Wait for any outstanding work before the stream goes away
+	while(pending.size() > 0)
+	{
+		pending.front().wait();
+		pending.pop_front();
+	}
+}
+
+bool DecodeGzipBlocks::ReadMember(std::string &member)
+{
+	char header[GZIP_BLOCK_HEADER_LEN];
+	in.read(header, GZIP_BLOCK_HEADER_LEN);
+	if(in.gcount() == 0)
+		return false;
+	if(in.gcount() != GZIP_BLOCK_HEADER_LEN or (unsigned char)header[0] != 0x1f or (unsigned char)header[1] != 0x8b
+		or (header[3] & 4) == 0 or header[12] != 'P' or header[13] != 'M')
+		throw runtime_error("Gzip member is not indexed");
+
+	uint32_t memberLen = ReadUint32LE(&header[16]);
+	if(memberLen < GZIP_BLOCK_HEADER_LEN + 8)
+		throw runtime_error("Bad gzip member length");
+	member.resize(memberLen);
+	memcpy(&member[0], header, GZIP_BLOCK_HEADER_LEN);
+	in.read(&member[GZIP_BLOCK_HEADER_LEN], memberLen - GZIP_BLOCK_HEADER_LEN);
+	if((size_t)in.gcount() != memberLen - GZIP_BLOCK_HEADER_LEN)
+		throw runtime_error("Truncated gzip member");
+	return true;
+}
+
+bool DecodeGzipBlocks::NextBlock(std::string &out)
+{
+	//Keep the workers busy
+	while(!endOfInput and pending.size() < (size_t)numThreads)
+	{
+		std::shared_ptr<std::string> member(new std::string());
+		if(!ReadMember(*member))
+		{
+			endOfInput = true;
+			break;
+		}
+		std::function<void(std::string &)> tr = transform;
+		pending.push_back(std::async(std::launch::async, [member, tr]() {
+			string block;
+			DecodeGzipBlock(*member, block);
+			if(tr) tr(block);
+			return block;}));
+	}
+
+	if(pending.size() == 0)
+		return false;
+	out = pending.front().get();
+	pending.pop_front();
+	return true;
+}
+
+bool DecodeGzipBlocks::IsIndexed(std::istream &in)
+{
+	char header[GZIP_BLOCK_HEADER_LEN];
+	std::streampos pos = in.tellg();
+	in.read(header, GZIP_BLOCK_HEADER_LEN);
+	bool indexed = in.gcount() == GZIP_BLOCK_HEADER_LEN and (unsigned char)header[0] == 0x1f 
+		and (unsigned char)header[1] == 0x8b and (header[3] & 4) != 0 
+		and header[12] == 'P' and header[13] == 'M';
+	in.clear();
+	in.seekg(pos);
+	return indexed;
+}
+
+bool DecodeGzipBlocks::MemberOffsets(std::istream &in, std::vector<uint64_t> &offsetsOut)
+{
+	offsetsOut.clear();
+	uint64_t offset = 0;
+	char header[GZIP_BLOCK_HEADER_LEN];
+	while(true)
+	{
+		in.seekg(offset);
+		in.read(header, GZIP_BLOCK_HEADER_LEN);
+		if(in.gcount() == 0)
+			break;
+		if(in.gcount() != GZIP_BLOCK_HEADER_LEN or (unsigned char)header[0] != 0x1f or (unsigned char)header[1] != 0x8b
+			or (header[3] & 4) == 0 or header[12] != 'P' or header[13] != 'M')
+			return false;
+		uint32_t memberLen = ReadUint32LE(&header[16]);
+		if(memberLen < GZIP_BLOCK_HEADER_LEN + 8)
+			return false;
+		offsetsOut.push_back(offset);
+		offset += memberLen;
+	}
+	in.clear();
+	offsetsOut.push_back(offset);
+	return true;
+}
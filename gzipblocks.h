@@ -0,0 +1,81 @@
+#ifndef _GZIP_BLOCKS_H
+#define _GZIP_BLOCKS_H
+
+#include <streambuf>
+#include <istream>
+#include <string>
+#include <deque>
+#include <vector>
+#include <future>
+#include <functional>
+
+///Writes gzip as a series of independent members, each ending on a line break (unless
+///splitAtLines is false, for binary data). Every member header has an extra field ("PM")
+///holding the member's compressed size, so a reader can find the members without 
+///decompressing. The output is still ordinary gzip as far as zcat is concerned. With 
+///numThreads above one, members are compressed in the background, pigz style.
+class EncodeGzipBlocks : public std::streambuf
+{
+public:
+	EncodeGzipBlocks(std::streambuf &outIn, size_t blockSizeIn = 4*1024*1024, int compressionLevelIn = -1,
+		int numThreadsIn = 1, bool splitAtLinesIn = true);
+	virtual ~EncodeGzipBlocks();
+
+	///Writes the remaining members, throwing if that fails. The destructor does this too,
+	///but cannot report errors.
+	void Finish();
+
+protected:
+	int overflow(int c);
+	std::streamsize xsputn(const char* s, std::streamsize n);
+	int sync();
+
+	void WriteBlocks(bool flushAll);
+	void WritePending(size_t maxPending);
+
+	std::streambuf &out;
+	size_t blockSize;
+	int compressionLevel;
+	int numThreads;
+	bool splitAtLines;
+	std::string buffer;
+	std::deque<std::future<std::string> > pending;
+	bool memberWritten;
+	bool finished;
+};
+
+void EncodeGzipBlock(const char *data, size_t len, int compressionLevel, std::string &out);
+
+///Reads gzip written by EncodeGzipBlocks, decompressing up to numThreads members at a 
+///time. Blocks are returned in file order. The optional transform is run on each 
+///decompressed block in the worker thread.
+class DecodeGzipBlocks
+{
+public:
+	DecodeGzipBlocks(std::istream &inIn, int numThreadsIn, 
+		std::function<void(std::string &)> transformIn = nullptr);
+	virtual ~DecodeGzipBlocks();
+
+	//Returns false when no blocks remain
+	bool NextBlock(std::string &out);
+
+	//Check if a file starts with an indexed member
+	static bool IsIndexed(std::istream &in);
+
+	//Finds the byte offset of each member from the headers alone, followed by the offset of
+	//the end of the last member. Returns false if a member is not indexed.
+	static bool MemberOffsets(std::istream &in, std::vector<uint64_t> &offsetsOut);
+
+protected:
+	bool ReadMember(std::string &member);
+
+	std::istream &in;
+	int numThreads;
+	std::function<void(std::string &)> transform;
+	std::deque<std::future<std::string> > pending;
+	bool endOfInput;
+};
+
+void DecodeGzipBlock(const std::string &member, std::string &out);
+
+#endif //_GZIP_BLOCKS_H
@@ -1,5 +1,6 @@
 #include "cppGzip/DecodeGzip.h"
 #include "cppGzip/EncodeGzip.h"
+#include "gzipblocks.h"
 #include "cppo5m/OsmData.h"
 #include <iostream>
 #include <fstream>
@@ -44,9 +45,9 @@ private:
 	std::filebuf livenodeFile, livewayFile, liverelationFile, oldnodeFile, oldwayFile, oldrelationFile;
 	std::filebuf nodeIdsFile, wayIdsFile, relationIdsFile;
 	std::filebuf wayMembersFile, relationMemNodesFile, relationMemWaysFile, relationMemRelsFile;
-	std::shared_ptr<class EncodeGzip> livenodeFileGzip, livewayFileGzip, liverelationFileGzip, oldnodeFileGzip, oldwayFileGzip, oldrelationFileGzip;
-	std::shared_ptr<class EncodeGzip> nodeIdsFileGzip, wayIdsFileGzip, relationIdsFileGzip;
-	std::shared_ptr<class EncodeGzip> wayMembersFileGzip, relationMemNodesFileGzip, relationMemWaysFileGzip, relationMemRelsFileGzip;
+	std::shared_ptr<class EncodeGzipBlocks> livenodeFileGzip, livewayFileGzip, liverelationFileGzip, oldnodeFileGzip, oldwayFileGzip, oldrelationFileGzip;
+	std::shared_ptr<class EncodeGzipBlocks> nodeIdsFileGzip, wayIdsFileGzip, relationIdsFileGzip;
+	std::shared_ptr<class EncodeGzipBlocks> wayMembersFileGzip, relationMemNodesFileGzip, relationMemWaysFileGzip, relationMemRelsFileGzip;
 
 public:
 	CsvStore(const std::string &outPrefix);
@@ -73,34 +74,34 @@ CsvStore::CsvStore(const std::string &outPrefix)
 	cout << outPrefix+"livenodes.csv.gz" << endl;
 	livenodeFile.open(outPrefix+"livenodes.csv.gz", std::ios::out | std::ios::binary);
 	if(!livenodeFile.is_open()) throw runtime_error("Error opening output");
-	livenodeFileGzip.reset(new class EncodeGzip(livenodeFile));
+	livenodeFileGzip.reset(new class EncodeGzipBlocks(livenodeFile));
 	livewayFile.open(outPrefix+"liveways.csv.gz", std::ios::out | std::ios::binary);
-	livewayFileGzip.reset(new class EncodeGzip(livewayFile));
+	livewayFileGzip.reset(new class EncodeGzipBlocks(livewayFile));
 	liverelationFile.open(outPrefix+"liverelations.csv.gz", std::ios::out | std::ios::binary);
-	liverelationFileGzip.reset(new class EncodeGzip(liverelationFile));
+	liverelationFileGzip.reset(new class EncodeGzipBlocks(liverelationFile));
 
 	oldnodeFile.open(outPrefix+"oldnodes.csv.gz", std::ios::out | std::ios::binary);
-	oldnodeFileGzip.reset(new class EncodeGzip(oldnodeFile));
+	oldnodeFileGzip.reset(new class EncodeGzipBlocks(oldnodeFile));
 	oldwayFile.open(outPrefix+"oldways.csv.gz", std::ios::out | std::ios::binary);
-	oldwayFileGzip.reset(new class EncodeGzip(oldwayFile));
+	oldwayFileGzip.reset(new class EncodeGzipBlocks(oldwayFile));
 	oldrelationFile.open(outPrefix+"oldrelations.csv.gz", std::ios::out | std::ios::binary);
-	oldrelationFileGzip.reset(new class EncodeGzip(oldrelationFile));
+	oldrelationFileGzip.reset(new class EncodeGzipBlocks(oldrelationFile));
 
 	nodeIdsFile.open(outPrefix+"nodeids.csv.gz", std::ios::out | std::ios::binary);
-	nodeIdsFileGzip.reset(new class EncodeGzip(nodeIdsFile));
+	nodeIdsFileGzip.reset(new class EncodeGzipBlocks(nodeIdsFile));
 	wayIdsFile.open(outPrefix+"wayids.csv.gz", std::ios::out | std::ios::binary);
-	wayIdsFileGzip.reset(new class EncodeGzip(wayIdsFile));
+	wayIdsFileGzip.reset(new class EncodeGzipBlocks(wayIdsFile));
 	relationIdsFile.open(outPrefix+"relationids.csv.gz", std::ios::out | std::ios::binary);
-	relationIdsFileGzip.reset(new class EncodeGzip(relationIdsFile));
+	relationIdsFileGzip.reset(new class EncodeGzipBlocks(relationIdsFile));
 
 	wayMembersFile.open(outPrefix+"waymems.csv.gz", std::ios::out | std::ios::binary);
-	wayMembersFileGzip.reset(new class EncodeGzip(wayMembersFile));
+	wayMembersFileGzip.reset(new class EncodeGzipBlocks(wayMembersFile));
 	relationMemNodesFile.open(outPrefix+"relationmems-n.csv.gz", std::ios::out | std::ios::binary);
-	relationMemNodesFileGzip.reset(new class EncodeGzip(relationMemNodesFile));
+	relationMemNodesFileGzip.reset(new class EncodeGzipBlocks(relationMemNodesFile));
 	relationMemWaysFile.open(outPrefix+"relationmems-w.csv.gz", std::ios::out | std::ios::binary);
-	relationMemWaysFileGzip.reset(new class EncodeGzip(relationMemWaysFile));
+	relationMemWaysFileGzip.reset(new class EncodeGzipBlocks(relationMemWaysFile));
 	relationMemRelsFile.open(outPrefix+"relationmems-r.csv.gz", std::ios::out | std::ios::binary);
-	relationMemRelsFileGzip.reset(new class EncodeGzip(relationMemRelsFile));
+	relationMemRelsFileGzip.reset(new class EncodeGzipBlocks(relationMemRelsFile));
 }
 
 CsvStore::~CsvStore()
@@ -138,6 +139,13 @@ CsvStore::~CsvStore()
 
 bool CsvStore::Finish()
 {
+	//Write the last members here, where errors can be thrown, rather than in the destructor
+	std::shared_ptr<class EncodeGzipBlocks> gzips[] = {livenodeFileGzip, livewayFileGzip, liverelationFileGzip, 
+		oldnodeFileGzip, oldwayFileGzip, oldrelationFileGzip, nodeIdsFileGzip, wayIdsFileGzip, relationIdsFileGzip,
+		wayMembersFileGzip, relationMemNodesFileGzip, relationMemWaysFileGzip, relationMemRelsFileGzip};
+	for(size_t i=0; i<sizeof(gzips)/sizeof(gzips[0]); i++)
+		if(gzips[i])
+			gzips[i]->Finish();
 	return false;
 }
 
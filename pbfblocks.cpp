@@ -0,0 +1,201 @@
+#include "pbfblocks.h"
+#include "cppo5m/pbf.h"
+#include "cppo5m/pbf/fileformat.pb.h"
+#include <sstream>
+#include <stdexcept>
+using namespace std;
+
+//The length of the BlobHeader is a 4 byte big endian prefix to each file block
+uint32_t ReadUint32BE(const char *in)
+{
+	const unsigned char *b = (const unsigned char *)in;
+	return ((uint32_t)b[0] << 24) | (b[1] << 16) | (b[2] << 8) | b[3];
+}
+
+void SplitPbfFileBlocks(const std::string &raw, std::string &headerOut, std::string &dataOut)
+{
+	size_t pos = 0;
+	while(pos < raw.size())
+	{
+		if(raw.size() - pos < 4)
+			throw runtime_error("Truncated PBF file block");
+		uint32_t headerLen = ReadUint32BE(&raw[pos]);
+		OSMPBF::BlobHeader blobHeader;
+		if(raw.size() - pos - 4 < headerLen or !blobHeader.ParseFromArray(&raw[pos+4], headerLen))
+			throw runtime_error("Bad PBF blob header");
+		size_t blockLen = 4 + headerLen + blobHeader.datasize();
+		if(raw.size() - pos < blockLen)
+			throw runtime_error("Truncated PBF file block");
+
+		string fileBlock = raw.substr(pos, blockLen);
+		if(blobHeader.type() == "OSMHeader")
+			headerOut = fileBlock;
+		else
+			dataOut += fileBlock;
+		pos += blockLen;
+	}
+}
+
+std::string EncodePbfPrimitiveBlock(const class OsmData &data, const std::vector<double> &bounds)
+{
+	std::stringbuf buf;
+	class PbfEncode enc(buf);
+	if(bounds.size() == 4)
+		enc.StoreBounds(bounds[0], bounds[1], bounds[2], bounds[3]);
+	data.StreamTo(enc);
+	return buf.str();
+}
+
+// **********************************************
+
+PbfBlockEncode::PbfBlockEncode(std::streambuf &outIn, int numThreadsIn, size_t blockSizeIn):
+	out(outIn),
+	numThreads(numThreadsIn),
+	blockSize(blockSizeIn),
+	headerWritten(false),
+	finished(false),
+	block(new class OsmData()),
+	blockObjects(0)
+{
+	if(numThreads < 1)
+		numThreads = 1;
+	if(blockSize < 1)
+		blockSize = 1;
+}
+
+PbfBlockEncode::~PbfBlockEncode()
+{
+	//Write out anything left if the stream was never finished
+	try
+	{
+		Finish();
+	}
+	catch (std::exception &err) {}
+	pending.clear();
+}
+
+bool PbfBlockEncode::Sync()
+{
+	if(blockObjects > 0)
+		SubmitBlock();
+	return false;
+}
+
+bool PbfBlockEncode::Reset()
+{
+	if(blockObjects > 0)
+		SubmitBlock();
+	return false;
+}
+
+bool PbfBlockEncode::Finish()
+{
+	if(finished)
+		return false;
+	if(blockObjects > 0)
+		SubmitBlock();
+	WritePending(0);
+	if(!headerWritten)
+		WriteHeader();
+	out.pubsync();
+	finished = true;
+	return false;
+}
+
+bool PbfBlockEncode::StoreIsDiff(bool isDiff)
+{
+	return false;
+}
+
+bool PbfBlockEncode::StoreBounds(double x1, double y1, double x2, double y2)
+{
+	//The bounds go in the header, so they are only kept if given before any objects
+	if(!headerWritten)
+		bounds = {x1, y1, x2, y2};
+	return false;
+}
+
+bool PbfBlockEncode::StoreNode(int64_t objId, const class MetaData &metaData,
+	const TagMap &tags, double lat, double lon)
+{
+	if(block->ways.size() > 0 or block->relations.size() > 0)
+		SubmitBlock();
+	block->StoreNode(objId, metaData, tags, lat, lon);
+	Stored();
+	return false;
+}
+
+bool PbfBlockEncode::StoreWay(int64_t objId, const class MetaData &metaData,
+	const TagMap &tags, const std::vector<int64_t> &refs)
+{
+	if(block->nodes.size() > 0 or block->relations.size() > 0)
+		SubmitBlock();
+	block->StoreWay(objId, metaData, tags, refs);
+	Stored();
+	return false;
+}
+
+bool PbfBlockEncode::StoreRelation(int64_t objId, const class MetaData &metaData, const TagMap &tags,
+	const std::vector<std::string> &refTypeStrs, const std::vector<int64_t> &refIds,
+	const std::vector<std::string> &refRoles)
+{
+	if(block->nodes.size() > 0 or block->ways.size() > 0)
+		SubmitBlock();
+	block->StoreRelation(objId, metaData, tags, refTypeStrs, refIds, refRoles);
+	Stored();
+	return false;
+}
+
+void PbfBlockEncode::Stored()
+{
+	blockObjects ++;
+	if(blockObjects >= blockSize)
+		SubmitBlock();
+}
+
+void PbfBlockEncode::SubmitBlock()
+{
+	if(finished)
+		throw runtime_error("PBF output already finished");
+
+	std::shared_ptr<class OsmData> full = block;
+	std::vector<double> b = bounds;
+	pending.push_back(std::async(std::launch::async, [full, b]() {
+		return EncodePbfPrimitiveBlock(*full, b);
+	}));
+	block.reset(new class OsmData());
+	blockObjects = 0;
+
+	//Keep the encoding threads busy, but don't let blocks pile up in memory
+	WritePending(numThreads);
+}
+
+void PbfBlockEncode::WriteHeader()
+{
+	//An encoder with no objects gives just the header block
+	class OsmData empty;
+	Write(EncodePbfPrimitiveBlock(empty, bounds));
+}
+
+void PbfBlockEncode::WritePending(size_t maxPending)
+{
+	while(pending.size() > maxPending)
+	{
+		std::string raw = pending.front().get();
+		pending.pop_front();
+		Write(raw);
+	}
+}
+
+void PbfBlockEncode::Write(const std::string &raw)
+{
+	//Each block was encoded as a file of its own, so only the first header is kept
+	string header, data;
+	SplitPbfFileBlocks(raw, header, data);
+	if(!headerWritten and header.size() > 0)
+	{
+		out.sputn(header.data(), header.size());
+		headerWritten = true;
+	}
+	out.sputn(data.data(), data.size());
+}
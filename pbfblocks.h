@@ -0,0 +1,60 @@
+#ifndef _PBF_BLOCKS_H
+#define _PBF_BLOCKS_H
+
+#include <streambuf>
+#include <string>
+#include <deque>
+#include <memory>
+#include <future>
+#include "cppo5m/OsmData.h"
+
+///Writes OSM PBF with up to blockSize objects in each primitive block. Full blocks are
+///encoded by cppo5m's PbfEncode, each on its own thread, while more objects arrive. They
+///are written out in the order they were filled, keeping only the first header block.
+///Each block holds one object type.
+class PbfBlockEncode : public IDataStreamHandler
+{
+public:
+	PbfBlockEncode(std::streambuf &outIn, int numThreadsIn = 4, size_t blockSizeIn = 8000);
+	virtual ~PbfBlockEncode();
+
+	virtual bool Sync();
+	virtual bool Reset();
+	virtual bool Finish();
+
+	virtual bool StoreIsDiff(bool isDiff);
+	virtual bool StoreBounds(double x1, double y1, double x2, double y2);
+	virtual bool StoreNode(int64_t objId, const class MetaData &metaData,
+		const TagMap &tags, double lat, double lon);
+	virtual bool StoreWay(int64_t objId, const class MetaData &metaData,
+		const TagMap &tags, const std::vector<int64_t> &refs);
+	virtual bool StoreRelation(int64_t objId, const class MetaData &metaData, const TagMap &tags,
+		const std::vector<std::string> &refTypeStrs, const std::vector<int64_t> &refIds,
+		const std::vector<std::string> &refRoles);
+
+protected:
+	void Stored();
+	void SubmitBlock();
+	void WriteHeader();
+	void WritePending(size_t maxPending);
+	void Write(const std::string &raw);
+
+	std::streambuf &out;
+	int numThreads;
+	size_t blockSize;
+	bool headerWritten;
+	bool finished;
+	std::vector<double> bounds;
+	std::shared_ptr<class OsmData> block;
+	size_t blockObjects;
+	std::deque<std::future<std::string> > pending;
+};
+
+///Encodes the objects with cppo5m's PbfEncode and returns the complete file it writes,
+///header block included
+std::string EncodePbfPrimitiveBlock(const class OsmData &data, const std::vector<double> &bounds);
+
+///Separates the header file block of a PBF file from its data file blocks
+void SplitPbfFileBlocks(const std::string &raw, std::string &headerOut, std::string &dataOut);
+
+#endif //_PBF_BLOCKS_H
@@ -36,6 +36,7 @@ PgWork& PgWork::operator=(const PgWork &obj)
 // *************************************************
 
 PgCommon::PgCommon(shared_ptr<pqxx::connection> dbconnIn,
+	const string &connectionStringIn,
 	const string &tableStaticPrefixIn, 
 	const string &tableActivePrefixIn,
 	std::shared_ptr<class PgWork> sharedWorkIn,
@@ -45,6 +46,7 @@ PgCommon::PgCommon(shared_ptr<pqxx::connection> dbconnIn,
 	dbUsernameLookup(*dbconnIn.get(), sharedWork->work.get(), tableStaticPrefixIn, tableActivePrefixIn)
 {
 	dbconn = dbconnIn;
+	connectionString = connectionStringIn;
 	tableStaticPrefix = tableStaticPrefixIn;
 	tableActivePrefix = tableActivePrefixIn;
 	this->shareMode = shareMode;
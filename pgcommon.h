@@ -26,6 +26,7 @@ class PgCommon
 {
 protected:
 	std::shared_ptr<pqxx::connection> dbconn;
+	std::string connectionString;
 	std::string tableStaticPrefix;
 	std::string tableActivePrefix;
 	std::string shareMode;
@@ -34,6 +35,7 @@ protected:
 
 public:
 	PgCommon(std::shared_ptr<pqxx::connection> dbconnIn,
+		const std::string &connectionStringIn,
 		const std::string &tableStaticPrefixIn, 
 		const std::string &tableActivePrefixIn,
 		std::shared_ptr<class PgWork> sharedWorkIn,
@@ -2,10 +2,15 @@
 #include "dbquery.h"
 #include "dbids.h"
 #include "dbadmin.h"
+#include "dbapplydiffs.h"
 #include "dbdecode.h"
 #include "dbreplicate.h"
 #include "dbstore.h"
 #include "dbdump.h"
+#include "dbdumpincremental.h"
+#include "dbpublish.h"
+#include "dbchangelog.h"
+#include "dbaugmenteddiff.h"
 #include "dbfilters.h"
 #include "dbchangeset.h"
 #include "dbmeta.h"
@@ -14,6 +19,7 @@
 #include "util.h"
 #include "cppo5m/OsmData.h"
 #include <algorithm>
+#include <fstream>
 using namespace std;
 
 PgMapError::PgMapError()
@@ -537,12 +543,13 @@ void PgMapQuery::Reset()
 
 
 PgTransaction::PgTransaction(shared_ptr<pqxx::connection> dbconnIn,
+	const string &connectionStringIn,
 	const string &tableStaticPrefixIn, 
 	const string &tableActivePrefixIn,
 	std::shared_ptr<class PgWork> sharedWorkIn,
 	const std::string &shareMode):
 
-	PgCommon(dbconnIn, tableStaticPrefixIn, tableActivePrefixIn, sharedWorkIn, shareMode)
+	PgCommon(dbconnIn, connectionStringIn, tableStaticPrefixIn, tableActivePrefixIn, sharedWorkIn, shareMode)
 {
 	string errStr;
 	std::shared_ptr<pqxx::transaction_base> work(this->sharedWork->work);
@@ -881,6 +888,135 @@ void PgTransaction::GetReplicateDiff(int64_t timestampStart, int64_t timestampEn
 		this->tableActivePrefix, true, timestampStart, timestampEnd, out);
 }
 
+/**
+* Write the objects changed in the time range to out in timestamp order, without holding
+* the whole diff in memory.
+*/
+void PgTransaction::GetReplicateDiffStream(int64_t timestampStart, int64_t timestampEnd, 
+	std::shared_ptr<class IOsmChangeBlock> out)
+{
+	if(this->shareMode != "ACCESS SHARE" && this->shareMode != "EXCLUSIVE")
+		throw runtime_error("Database must be locked in ACCESS SHARE or EXCLUSIVE mode");
+
+	std::shared_ptr<pqxx::transaction_base> work(this->sharedWork->work);
+	if(!work)
+		throw runtime_error("Transaction has been deleted");
+
+	::GetReplicateDiffStream(*dbconn, work.get(), this->dbUsernameLookup, 
+		this->tableStaticPrefix, this->tableActivePrefix, timestampStart, timestampEnd, *out);
+}
+
+/**
+* Pass each object version changed in the time range to out, with the version before it.
+*/
+void PgTransaction::GetAugmentedDiff(int64_t timestampStart, int64_t timestampEnd,
+	std::shared_ptr<class IAugmentedDiffHandler> out)
+{
+	if(this->shareMode != "ACCESS SHARE" && this->shareMode != "EXCLUSIVE")
+		throw runtime_error("Database must be locked in ACCESS SHARE or EXCLUSIVE mode");
+
+	std::shared_ptr<pqxx::transaction_base> work(this->sharedWork->work);
+	if(!work)
+		throw runtime_error("Transaction has been deleted");
+
+	GetAugmentedDiffStream(*dbconn, work.get(), this->dbUsernameLookup, 
+		this->tableStaticPrefix, this->tableActivePrefix, timestampStart, timestampEnd, *out);
+}
+
+/**
+* Read the active changelog entries in the time range, in timestamp order. Empty if the
+* changelog has not been created.
+*/
+void PgTransaction::GetChangeLog(int64_t timestampStart, int64_t timestampEnd,
+	std::vector<class ChangeLogEntry> &entriesOut)
+{
+	if(this->shareMode != "ACCESS SHARE" && this->shareMode != "EXCLUSIVE")
+		throw runtime_error("Database must be locked in ACCESS SHARE or EXCLUSIVE mode");
+
+	std::shared_ptr<pqxx::transaction_base> work(this->sharedWork->work);
+	if(!work)
+		throw runtime_error("Transaction has been deleted");
+
+	if(DbChangeLogStart(*dbconn, work.get(), this->tableActivePrefix) < 0)
+		return;
+	DbGetChangeLog(*dbconn, work.get(), this->tableActivePrefix, timestampStart, timestampEnd, entriesOut);
+}
+
+/**
+* Publish replication diffs for each interval since the last published one, as long as
+* the interval ended at least safetyLag seconds ago. The state is kept in the meta table 
+* and is only recorded when this transaction is committed. Can be used with ACCESS SHARE,
+* since only the meta table is written.
+*/
+bool PgTransaction::PublishReplicationDiffs(const std::string &basePath, int64_t interval, int64_t safetyLag,
+	int64_t startTimestamp, int maxFiles, bool augmented, int verbose, 
+	int64_t &lastSequenceOut, int64_t &lastTimestampOut, int &numPublishedOut, class PgMapError &errStr)
+{
+	if(this->shareMode != "ACCESS SHARE" && this->shareMode != "EXCLUSIVE")
+		throw runtime_error("Database must be locked in ACCESS SHARE or EXCLUSIVE mode");
+
+	std::shared_ptr<pqxx::transaction_base> work(this->sharedWork->work);
+	if(!work)
+		throw runtime_error("Transaction has been deleted");
+	numPublishedOut = 0;
+
+	int64_t sequence = 0, timestamp = 0;
+	bool found = DbGetReplicationState(*dbconn, work.get(), this->tableActivePrefix, sequence, timestamp);
+	if(!found)
+	{
+		if(startTimestamp < 0)
+		{
+			errStr.errStr = "Nothing has been published yet, so a start timestamp is needed";
+			return false;
+		}
+		sequence = 0;
+		timestamp = startTimestamp;
+	}
+	lastSequenceOut = sequence;
+	lastTimestampOut = timestamp;
+	if(interval < 1)
+	{
+		errStr.errStr = "Interval must be positive";
+		return false;
+	}
+
+	//The state is only recorded when the transaction commits, so a failure repeats every
+	//sequence in it. Keep maxFiles small.
+	if(maxFiles < 1)
+		maxFiles = 1;
+
+	//Objects are timestamped before they are committed, so recent intervals may not be complete yet
+	int64_t publishUntil = (int64_t)time(nullptr) - safetyLag;
+	string nativeErrStr;
+	while(timestamp + interval <= publishUntil and numPublishedOut < maxFiles)
+	{
+		sequence ++;
+		if(verbose >= 1)
+			cout << "Publishing " << ReplicationSequencePath(sequence) << endl;
+
+		bool ok = PublishReplicationDiff(*dbconn, work.get(), this->dbUsernameLookup, 
+			this->tableStaticPrefix, this->tableActivePrefix, basePath, 
+			sequence, timestamp, timestamp + interval, augmented, nativeErrStr);
+		if(!ok)
+		{
+			errStr.errStr = nativeErrStr;
+			return false;
+		}
+		timestamp += interval;
+		numPublishedOut ++;
+
+		ok = DbSetReplicationState(*dbconn, work.get(), this->tableActivePrefix, sequence, timestamp, nativeErrStr);
+		if(!ok)
+		{
+			errStr.errStr = nativeErrStr;
+			return false;
+		}
+		lastSequenceOut = sequence;
+		lastTimestampOut = timestamp;
+	}
+	return true;
+}
+
 /**
 * Dump live objects. Only current nodes are dumped, not old (non-visible) nodes.
 */
@@ -897,26 +1033,114 @@ void PgTransaction::Dump(bool order, bool nodes, bool ways, bool relations,
 
 	if(nodes)
 	{
-		DumpNodes(*dbconn, work.get(), this->dbUsernameLookup, this->tableActivePrefix, order, enc);
+		DumpNodes(*dbconn, work.get(), this->dbUsernameLookup, this->tableStaticPrefix, this->tableActivePrefix, order, enc);
 
 		enc->Reset();
 	}
 
 	if(ways)
 	{
-		DumpWays(*dbconn, work.get(), this->dbUsernameLookup, this->tableActivePrefix, order, enc);
+		DumpWays(*dbconn, work.get(), this->dbUsernameLookup, this->tableStaticPrefix, this->tableActivePrefix, order, enc);
 
 		enc->Reset();
 	}
 
 	if(relations)
 	{	
-		DumpRelations(*dbconn, work.get(), this->dbUsernameLookup, this->tableActivePrefix, order, enc);
+		DumpRelations(*dbconn, work.get(), this->dbUsernameLookup, this->tableStaticPrefix, this->tableActivePrefix, order, enc);
 	}
 
 	enc->Finish();
 }
 
+/**
+* Dump live objects in ID order, on several connections that share this transaction's snapshot.
+*/
+bool PgTransaction::DumpParallel(bool nodes, bool ways, bool relations, int numWorkers, int verbose,
+	std::shared_ptr<IDataStreamHandler> enc, class PgMapError &errStr)
+{
+	if(this->shareMode != "ACCESS SHARE" && this->shareMode != "EXCLUSIVE")
+		throw runtime_error("Database must be locked in ACCESS SHARE or EXCLUSIVE mode");
+
+	std::shared_ptr<pqxx::transaction_base> work(this->sharedWork->work);
+	if(!work)
+		throw runtime_error("Transaction has been deleted");
+
+	//Several ranges per connection, so a slow range doesn't hold up the others for long
+	std::vector<class DumpRange> ranges;
+	DumpSplitRanges(*dbconn, work.get(), this->tableStaticPrefix, this->tableActivePrefix,
+		nodes, ways, relations, numWorkers * 4, ranges);
+
+	std::string nativeErrStr;
+	bool ok = ::DumpParallel(this->connectionString, *dbconn, work.get(), verbose, 
+		this->tableStaticPrefix, this->tableActivePrefix, numWorkers, ranges, enc, nativeErrStr);
+	errStr.errStr = nativeErrStr;
+	return ok;
+}
+
+/**
+* Dump live objects to a separate encoder for each range of IDs.
+*/
+bool PgTransaction::DumpFragments(bool nodes, bool ways, bool relations, int numWorkers, int numRangesPerType, int verbose,
+	DumpFragmentFunc fragmentFunc, std::vector<class DumpRange> &rangesOut, class PgMapError &errStr)
+{
+	if(this->shareMode != "ACCESS SHARE" && this->shareMode != "EXCLUSIVE")
+		throw runtime_error("Database must be locked in ACCESS SHARE or EXCLUSIVE mode");
+
+	std::shared_ptr<pqxx::transaction_base> work(this->sharedWork->work);
+	if(!work)
+		throw runtime_error("Transaction has been deleted");
+
+	rangesOut.clear();
+	DumpSplitRanges(*dbconn, work.get(), this->tableStaticPrefix, this->tableActivePrefix,
+		nodes, ways, relations, numRangesPerType, rangesOut);
+
+	std::string nativeErrStr;
+	bool ok = DumpParallelFragments(this->connectionString, *dbconn, work.get(), verbose, 
+		this->tableStaticPrefix, this->tableActivePrefix, numWorkers, rangesOut, fragmentFunc, nativeErrStr);
+	errStr.errStr = nativeErrStr;
+	return ok;
+}
+
+/**
+* Dump live objects by merging a previous dump with the objects changed since it was made.
+*/
+bool PgTransaction::DumpIncremental(const std::string &previousDump, int64_t sinceTimestamp, int verbose,
+	std::shared_ptr<IDataStreamHandler> enc, class PgMapError &errStr)
+{
+	if(this->shareMode != "ACCESS SHARE" && this->shareMode != "EXCLUSIVE")
+		throw runtime_error("Database must be locked in ACCESS SHARE or EXCLUSIVE mode");
+
+	std::shared_ptr<pqxx::transaction_base> work(this->sharedWork->work);
+	if(!work)
+		throw runtime_error("Transaction has been deleted");
+
+	std::ifstream test(previousDump, std::ios::binary);
+	if(!test.is_open())
+	{
+		errStr.errStr = "Error opening previous dump " + previousDump;
+		return false;
+	}
+	test.close();
+
+	enc->StoreIsDiff(false);
+	std::shared_ptr<class DumpMergeChanges> merge(new class DumpMergeChanges(*dbconn, work.get(), 
+		this->dbUsernameLookup, this->tableStaticPrefix, this->tableActivePrefix, sinceTimestamp, enc));
+	try
+	{
+		ReadOsmFromFile(previousDump, merge);
+	}
+	catch (runtime_error &err)
+	{
+		errStr.errStr = err.what();
+		return false;
+	}
+
+	if(verbose >= 1)
+		cout << "Kept " << merge->numUnchanged << " objects, wrote " << merge->numChanged << " changed objects" << endl;
+	return true;
+}
+
 int64_t PgTransaction::GetAllocatedId(const string &type)
 {
 	if(this->shareMode != "EXCLUSIVE")
@@ -1486,6 +1710,36 @@ void PgTransaction::XapiQuery(const std::string &objType,
 		enc);
 }
 
+/**
+* Time an XAPI query of one object type, matching tags with @> and ? alone or with the
+* full text match as well, to compare the indices each uses.
+*/
+void PgTransaction::BenchmarkXapiQuery(const std::string &objType,
+	const std::string &tagKey,
+	const std::string &tagValue,
+	const std::vector<double> &bbox, 
+	bool fullText, int repeats,
+	double &secondsOut, int64_t &rowsOut, std::string &planOut)
+{
+	if(this->shareMode != "ACCESS SHARE" && this->shareMode != "EXCLUSIVE")
+		throw runtime_error("Database must be locked in ACCESS SHARE or EXCLUSIVE mode");
+	std::shared_ptr<pqxx::transaction_base> work(this->sharedWork->work);
+	if(!work)
+		throw runtime_error("Transaction has been deleted");
+
+	DbXapiQueryBenchmark(*dbconn, work.get(), 
+		this->tableActivePrefix, 
+		objType,
+		tagKey,
+		tagValue,
+		bbox, 
+		fullText,
+		repeats,
+		secondsOut,
+		rowsOut,
+		planOut);
+}
+
 void PgTransaction::GetMostActiveUsers(int64_t startTimestamp,
 	std::vector<int64_t> &uidOut,
 	std::vector<std::vector<int64_t> > &objectCountOut)
@@ -1523,13 +1777,14 @@ void PgTransaction::Abort()
 // **********************************************
 
 PgAdmin::PgAdmin(shared_ptr<pqxx::connection> dbconnIn,
+		const string &connectionStringIn,
 		const string &tableStaticPrefixIn, 
 		const string &tableModPrefixIn,
 		const string &tableTestPrefixIn,
 		std::shared_ptr<class PgWork> sharedWorkIn,
 		const string &shareModeIn):
 
-	PgCommon(dbconnIn, tableStaticPrefixIn, tableModPrefixIn, sharedWorkIn, shareMode),
+	PgCommon(dbconnIn, connectionStringIn, tableStaticPrefixIn, tableModPrefixIn, sharedWorkIn, shareModeIn),
 	tableModPrefix(tableModPrefixIn),
 	tableTestPrefix(tableTestPrefixIn)
 {
@@ -1614,6 +1869,29 @@ bool PgAdmin::CopyMapData(int verbose, const std::string &filePrefix, class PgMa
 	return ok;
 }
 
+bool PgAdmin::CopyMapDataParallel(int verbose, const std::string &filePrefix, int numWorkers, 
+	bool unloggedStaging, class PgMapError &errStr)
+{
+	//Runs on separate connections, so this does not use (or wait for) the admin transaction
+	std::string nativeErrStr;
+	bool ok = DbCopyDataParallel(this->connectionString, *dbconn, verbose, filePrefix, this->tableStaticPrefix, 
+		numWorkers, unloggedStaging, nativeErrStr);
+	errStr.errStr = nativeErrStr;
+
+	return ok;
+}
+
+bool PgAdmin::CopyMapDataFromClient(int verbose, const std::string &filePrefix, int numWorkers, 
+	int decodeThreads, class PgMapError &errStr)
+{
+	std::string nativeErrStr;
+	bool ok = DbCopyDataFromClient(this->connectionString, verbose, filePrefix, this->tableStaticPrefix, 
+		numWorkers, decodeThreads, nativeErrStr);
+	errStr.errStr = nativeErrStr;
+
+	return ok;
+}
+
 bool PgAdmin::CreateMapIndices(int verbose, class PgMapError &errStr)
 {
 	std::string nativeErrStr;
@@ -1633,15 +1911,62 @@ bool PgAdmin::CreateMapIndices(int verbose, class PgMapError &errStr)
 	return ok;
 }
 
+bool PgAdmin::CreateMapIndicesParallel(int verbose, int numWorkers, const std::string &maintenanceWorkMem, 
+	int parallelMaintenanceWorkers, class PgMapError &errStr)
+{
+	std::string nativeErrStr;
+	std::shared_ptr<pqxx::transaction_base> work(this->sharedWork->work);
+	if(!work)
+		throw runtime_error("Transaction has been deleted");
+
+	bool ok = DbCreateIndicesParallel(this->connectionString, *dbconn, work.get(), verbose, this->tableStaticPrefix, 
+		numWorkers, maintenanceWorkMem, parallelMaintenanceWorkers, nativeErrStr);
+	errStr.errStr = nativeErrStr;
+	if(!ok) return ok;
+	ok = DbCreateIndicesParallel(this->connectionString, *dbconn, work.get(), verbose, this->tableModPrefix, 
+		numWorkers, maintenanceWorkMem, parallelMaintenanceWorkers, nativeErrStr);
+	errStr.errStr = nativeErrStr;
+	if(!ok) return ok;
+	ok = DbCreateIndicesParallel(this->connectionString, *dbconn, work.get(), verbose, this->tableTestPrefix, 
+		numWorkers, maintenanceWorkMem, parallelMaintenanceWorkers, nativeErrStr);
+	errStr.errStr = nativeErrStr;
+
+	return ok;
+}
+
 bool PgAdmin::ApplyDiffs(const std::string &diffPath, int verbose, class PgMapError &errStr)
+{
+	return this->ApplyDiffs(diffPath, 1, 0, 0, false, 1, false, verbose, errStr);
+}
+
+bool PgAdmin::ApplyDiffs(const std::string &diffPath, int batchFiles, int checkpointFiles, int64_t checkpointObjects, 
+	bool resume, int numWorkers, bool twoPhase, int verbose, class PgMapError &errStr)
 {
 	std::string nativeErrStr;
 	std::shared_ptr<pqxx::transaction_base> work(this->sharedWork->work);
 	if(!work)
 		throw runtime_error("Transaction has been deleted");
 
-	bool ok = DbApplyDiffs(*dbconn, work.get(), verbose, this->tableStaticPrefix, 
-		this->tableModPrefix, this->tableTestPrefix, diffPath, this, nativeErrStr);
+	//Worker connections need ROW EXCLUSIVE locks on the mod tables
+	if(numWorkers > 1 and (this->shareMode == "SHARE" or this->shareMode == "SHARE ROW EXCLUSIVE" 
+		or this->shareMode == "EXCLUSIVE" or this->shareMode == "ACCESS EXCLUSIVE"))
+	{
+		errStr.errStr = "Cannot apply diffs in parallel while holding "+this->shareMode+" locks";
+		return false;
+	}
+
+	DiffCheckpointFunc checkpoint = [this](pqxx::transaction_base *&workOut, std::string &nativeErrStr) -> bool
+	{
+		class PgMapError checkpointErr;
+		bool ok = this->Checkpoint(checkpointErr);
+		nativeErrStr = checkpointErr.errStr;
+		workOut = this->sharedWork->work.get();
+		return ok;
+	};
+
+	bool ok = DbApplyDiffs(*dbconn, work.get(), verbose, this->connectionString, this->tableStaticPrefix, 
+		this->tableModPrefix, this->tableTestPrefix, diffPath, batchFiles, 
+		checkpointFiles, checkpointObjects, resume, numWorkers, twoPhase, checkpoint, this, nativeErrStr);
 	errStr.errStr = nativeErrStr;
 	if(!ok) return ok;
 
@@ -1757,6 +2082,21 @@ bool PgAdmin::GenerateUsernameTable(int verbose, class PgMapError &errStr)
 	return true;
 }
 
+bool PgAdmin::GenerateUsernameTableParallel(int verbose, int numWorkers, class PgMapError &errStr)
+{
+	std::string nativeErrStr;
+	std::shared_ptr<pqxx::transaction_base> work(this->sharedWork->work);
+	if(!work)
+		throw runtime_error("Transaction has been deleted");
+
+	bool ok = DbGenerateUsernameTableParallel(this->connectionString, *dbconn, work.get(), verbose, 
+		this->tableStaticPrefix, this->tableModPrefix, this->tableTestPrefix, numWorkers, nativeErrStr);
+	errStr.errStr = nativeErrStr;
+	if(!ok) return ok;
+
+	return true;
+}
+
 bool PgAdmin::UpdateBboxes(int verbose, bool updateStatic, bool updateActive, class PgMapError &errStr)
 {
 	std::string nativeErrStr;
@@ -1831,6 +2171,44 @@ bool PgAdmin::CreateBboxIndices(int verbose, class PgMapError &errStr)
 	return ok;
 }
 
+bool PgAdmin::CreateTagIndices(int verbose, const std::vector<std::string> &popularKeys, class PgMapError &errStr)
+{
+	std::string nativeErrStr;
+	std::shared_ptr<pqxx::transaction_base> work(this->sharedWork->work);
+	if(!work)
+		throw runtime_error("Transaction has been deleted");
+
+	bool ok = DbCreateTagIndices(*dbconn, work.get(), verbose, this->tableStaticPrefix, popularKeys, nativeErrStr);
+	errStr.errStr = nativeErrStr;
+	if(!ok) return ok;
+	ok = DbCreateTagIndices(*dbconn, work.get(), verbose, this->tableModPrefix, popularKeys, nativeErrStr);
+	errStr.errStr = nativeErrStr;
+	if(!ok) return ok;
+	ok = DbCreateTagIndices(*dbconn, work.get(), verbose, this->tableTestPrefix, popularKeys, nativeErrStr);
+	errStr.errStr = nativeErrStr;
+
+	return ok;
+}
+
+bool PgAdmin::DropTagIndices(int verbose, class PgMapError &errStr)
+{
+	std::string nativeErrStr;
+	std::shared_ptr<pqxx::transaction_base> work(this->sharedWork->work);
+	if(!work)
+		throw runtime_error("Transaction has been deleted");
+
+	bool ok = DbDropTagIndices(*dbconn, work.get(), verbose, this->tableStaticPrefix, nativeErrStr);
+	errStr.errStr = nativeErrStr;
+	if(!ok) return ok;
+	ok = DbDropTagIndices(*dbconn, work.get(), verbose, this->tableModPrefix, nativeErrStr);
+	errStr.errStr = nativeErrStr;
+	if(!ok) return ok;
+	ok = DbDropTagIndices(*dbconn, work.get(), verbose, this->tableTestPrefix, nativeErrStr);
+	errStr.errStr = nativeErrStr;
+
+	return ok;
+}
+
 bool PgAdmin::DropBboxIndices(int verbose, class PgMapError &errStr)
 {
 	std::string nativeErrStr;
@@ -1850,6 +2228,73 @@ bool PgAdmin::DropBboxIndices(int verbose, class PgMapError &errStr)
 	return ok;
 }
 
+//The static tables are only written on import, so only the mod and test tables are logged
+bool PgAdmin::CreateChangeLog(int verbose, class PgMapError &errStr)
+{
+	std::string nativeErrStr;
+	std::shared_ptr<pqxx::transaction_base> work(this->sharedWork->work);
+	if(!work)
+		throw runtime_error("Transaction has been deleted");
+
+	bool ok = DbCreateChangeLog(*dbconn, work.get(), verbose, this->tableModPrefix, nativeErrStr);
+	errStr.errStr = nativeErrStr;
+	if(!ok) return ok;
+	ok = DbCreateChangeLog(*dbconn, work.get(), verbose, this->tableTestPrefix, nativeErrStr);
+	errStr.errStr = nativeErrStr;
+
+	return ok;
+}
+
+bool PgAdmin::DropChangeLog(int verbose, class PgMapError &errStr)
+{
+	std::string nativeErrStr;
+	std::shared_ptr<pqxx::transaction_base> work(this->sharedWork->work);
+	if(!work)
+		throw runtime_error("Transaction has been deleted");
+
+	bool ok = DbDropChangeLog(*dbconn, work.get(), verbose, this->tableModPrefix, nativeErrStr);
+	errStr.errStr = nativeErrStr;
+	if(!ok) return ok;
+	ok = DbDropChangeLog(*dbconn, work.get(), verbose, this->tableTestPrefix, nativeErrStr);
+	errStr.errStr = nativeErrStr;
+
+	return ok;
+}
+
+bool PgAdmin::PruneChangeLog(int verbose, int64_t beforeTimestamp, class PgMapError &errStr)
+{
+	std::string nativeErrStr;
+	std::shared_ptr<pqxx::transaction_base> work(this->sharedWork->work);
+	if(!work)
+		throw runtime_error("Transaction has been deleted");
+
+	bool ok = DbPruneChangeLog(*dbconn, work.get(), verbose, this->tableModPrefix, beforeTimestamp, nativeErrStr);
+	errStr.errStr = nativeErrStr;
+	if(!ok) return ok;
+	ok = DbPruneChangeLog(*dbconn, work.get(), verbose, this->tableTestPrefix, beforeTimestamp, nativeErrStr);
+	errStr.errStr = nativeErrStr;
+
+	return ok;
+}
+
+bool PgAdmin::ClusterSpatially(int verbose, int numWorkers, class PgMapError &errStr)
+{
+	std::string nativeErrStr;
+	std::shared_ptr<pqxx::transaction_base> work(this->sharedWork->work);
+	if(!work)
+		throw runtime_error("Transaction has been deleted");
+
+	bool ok = DbClusterSpatially(this->connectionString, *dbconn, work.get(), verbose, 
+		this->tableStaticPrefix, numWorkers, nativeErrStr);
+	errStr.errStr = nativeErrStr;
+	if(!ok) return ok;
+	ok = DbClusterSpatially(this->connectionString, *dbconn, work.get(), verbose, 
+		this->tableModPrefix, numWorkers, nativeErrStr);
+	errStr.errStr = nativeErrStr;
+
+	return ok;
+}
+
 bool PgAdmin::CheckNodesExistForWays(class PgMapError &errStr)
 {
 	std::shared_ptr<pqxx::transaction_base> work(this->sharedWork->work);
@@ -1891,6 +2336,20 @@ bool PgAdmin::CheckObjectIdTables(class PgMapError &errStr)
 	return true;
 }
 
+bool PgAdmin::CheckIntegrityParallel(int verbose, int numWorkers, int maxSamples, 
+	std::vector<class DbIntegrityResult> &results, class PgMapError &errStr)
+{
+	std::string nativeErrStr;
+	std::shared_ptr<pqxx::transaction_base> work(this->sharedWork->work);
+	if(!work)
+		throw runtime_error("Transaction has been deleted");
+
+	bool ok = DbCheckIntegrityParallel(this->connectionString, *dbconn, work.get(), verbose, 
+		this->tableStaticPrefix, this->tableModPrefix, numWorkers, maxSamples, results, nativeErrStr);
+	errStr.errStr = nativeErrStr;
+	return ok;
+}
+
 void PgAdmin::Commit()
 {
 	std::shared_ptr<pqxx::transaction_base> work(this->sharedWork->work);
@@ -1908,6 +2367,37 @@ void PgAdmin::Abort()
 	work->abort();
 }
 
+bool PgAdmin::Checkpoint(class PgMapError &errStr)
+{
+	//Commit the work so far, then carry on in a new transaction of the same kind
+	std::shared_ptr<pqxx::transaction_base> work(this->sharedWork->work);
+	if(!work)
+		throw runtime_error("Transaction has been deleted");
+	bool autocommit = dynamic_cast<pqxx::nontransaction *>(work.get()) != nullptr;
+	work->commit();
+	work.reset();
+
+	if(autocommit)
+		this->sharedWork->work.reset(new pqxx::nontransaction(*dbconn));
+	else
+		this->sharedWork->work.reset(new pqxx::transaction<pqxx::repeatable_read>(*dbconn));
+	work = this->sharedWork->work;
+	this->dbUsernameLookup.SetTransaction(work.get());
+
+	if(this->shareMode.size() > 0)
+	{
+		string nativeErrStr;
+		bool ok = LockMap(work, this->tableStaticPrefix, this->shareMode, nativeErrStr);
+		if(ok)
+			ok = LockMap(work, this->tableModPrefix, this->shareMode, nativeErrStr);
+		if(ok)
+			ok = LockMap(work, this->tableTestPrefix, this->shareMode, nativeErrStr);
+		errStr.errStr = nativeErrStr;
+		if(!ok) return false;
+	}
+	return true;
+}
+
 // **********************************************
 
 PgMap::PgMap(const string &connection, const string &tableStaticPrefixIn, 
@@ -1946,7 +2436,7 @@ std::shared_ptr<class PgTransaction> PgMap::GetTransaction(const std::string &sh
 	if(this->sharedWork)
 		this->sharedWork->work.reset();
 	this->sharedWork.reset(new class PgWork(new pqxx::transaction<pqxx::repeatable_read>(*dbconn)));
-	shared_ptr<class PgTransaction> out(new class PgTransaction(dbconn, tableStaticPrefix, tableActivePrefix, this->sharedWork, shareMode));
+	shared_ptr<class PgTransaction> out(new class PgTransaction(dbconn, connectionString, tableStaticPrefix, tableActivePrefix, this->sharedWork, shareMode));
 	return out;
 }
 
@@ -1956,7 +2446,7 @@ std::shared_ptr<class PgAdmin> PgMap::GetAdmin()
 	if(this->sharedWork)
 		this->sharedWork->work.reset();
 	this->sharedWork.reset(new class PgWork(new pqxx::nontransaction(*dbconn)));
-	shared_ptr<class PgAdmin> out(new class PgAdmin(dbconn, tableStaticPrefix, tableModPrefix, tableTestPrefix, this->sharedWork, ""));
+	shared_ptr<class PgAdmin> out(new class PgAdmin(dbconn, connectionString, tableStaticPrefix, tableModPrefix, tableTestPrefix, this->sharedWork, ""));
 	return out;
 }
 
@@ -1966,7 +2456,7 @@ std::shared_ptr<class PgAdmin> PgMap::GetAdmin(const std::string &shareMode)
 	if(this->sharedWork)
 		this->sharedWork->work.reset();
 	this->sharedWork.reset(new class PgWork(new pqxx::transaction<pqxx::repeatable_read>(*dbconn)));
-	shared_ptr<class PgAdmin> out(new class PgAdmin(dbconn, tableStaticPrefix, tableModPrefix, tableTestPrefix, this->sharedWork, shareMode));
+	shared_ptr<class PgAdmin> out(new class PgAdmin(dbconn, connectionString, tableStaticPrefix, tableModPrefix, tableTestPrefix, this->sharedWork, shareMode));
 	return out;
 }
 
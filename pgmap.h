@@ -11,6 +11,9 @@
 #include "dbusername.h"
 #include "pgcommon.h"
 #include "dbeditactivity.h"
+#include "dbintegrity.h"
+#include "dbchangelog.h"
+#include "dbdumpparallel.h"
 
 class PgMapError
 {
@@ -85,6 +88,7 @@ private:
 
 public:
 	PgTransaction(std::shared_ptr<pqxx::connection> dbconnIn,
+		const std::string &connectionStringIn,
 		const std::string &tableStaticPrefixIn, 
 		const std::string &tableActivePrefixIn,
 		std::shared_ptr<class PgWork> sharedWorkIn,
@@ -119,8 +123,23 @@ public:
 	bool ResetActiveTables(class PgMapError &errStr);
 	void GetReplicateDiff(int64_t timestampStart, int64_t timestampEnd,
 		class OsmChange &out);
+	void GetReplicateDiffStream(int64_t timestampStart, int64_t timestampEnd,
+		std::shared_ptr<class IOsmChangeBlock> out);
+	bool PublishReplicationDiffs(const std::string &basePath, int64_t interval, int64_t safetyLag,
+		int64_t startTimestamp, int maxFiles, bool augmented, int verbose, 
+		int64_t &lastSequenceOut, int64_t &lastTimestampOut, int &numPublishedOut, class PgMapError &errStr);
+	void GetAugmentedDiff(int64_t timestampStart, int64_t timestampEnd,
+		std::shared_ptr<class IAugmentedDiffHandler> out);
+	void GetChangeLog(int64_t timestampStart, int64_t timestampEnd,
+		std::vector<class ChangeLogEntry> &entriesOut);
 	void Dump(bool order, bool nodes, bool ways, bool relations, 
 		std::shared_ptr<IDataStreamHandler> enc);
+	bool DumpParallel(bool nodes, bool ways, bool relations, int numWorkers, int verbose,
+		std::shared_ptr<IDataStreamHandler> enc, class PgMapError &errStr);
+	bool DumpFragments(bool nodes, bool ways, bool relations, int numWorkers, int numRangesPerType, int verbose,
+		DumpFragmentFunc fragmentFunc, std::vector<class DumpRange> &rangesOut, class PgMapError &errStr);
+	bool DumpIncremental(const std::string &previousDump, int64_t sinceTimestamp, int verbose,
+		std::shared_ptr<IDataStreamHandler> enc, class PgMapError &errStr);
 
 	int64_t GetAllocatedId(const std::string &type);
 	int64_t PeekNextAllocatedId(const std::string &type);
@@ -173,6 +192,12 @@ public:
 		const std::string &tagValue,
 		const std::vector<double> &bbox, 
 		std::shared_ptr<IDataStreamHandler> enc);
+	void BenchmarkXapiQuery(const std::string &objType,
+		const std::string &tagKey,
+		const std::string &tagValue,
+		const std::vector<double> &bbox, 
+		bool fullText, int repeats,
+		double &secondsOut, int64_t &rowsOut, std::string &planOut);
 	void GetMostActiveUsers(int64_t startTimestamp,
 		std::vector<int64_t> &uidOut,
 		std::vector<std::vector<int64_t> > &objectCountOut);
@@ -189,6 +214,7 @@ private:
 
 public:
 	PgAdmin(std::shared_ptr<pqxx::connection> dbconnIn,
+		const std::string &connectionStringIn,
 		const std::string &tableStaticPrefixIn, 
 		const std::string &tableModPrefixIn,
 		const std::string &tableTestPrefixIn,
@@ -201,22 +227,40 @@ public:
 	bool CreateMapTables(int verbose, int targetVer, bool latest, class PgMapError &errStr);
 	bool DropMapTables(int verbose, class PgMapError &errStr);
 	bool CopyMapData(int verbose, const std::string &filePrefix, class PgMapError &errStr);
+	bool CopyMapDataParallel(int verbose, const std::string &filePrefix, int numWorkers, 
+		bool unloggedStaging, class PgMapError &errStr);
+	bool CopyMapDataFromClient(int verbose, const std::string &filePrefix, int numWorkers, 
+		int decodeThreads, class PgMapError &errStr);
 	bool CreateMapIndices(int verbose, class PgMapError &errStr);
+	bool CreateMapIndicesParallel(int verbose, int numWorkers, const std::string &maintenanceWorkMem, 
+		int parallelMaintenanceWorkers, class PgMapError &errStr);
 	bool ApplyDiffs(const std::string &diffPath, int verbose, class PgMapError &errStr);
+	bool ApplyDiffs(const std::string &diffPath, int batchFiles, int checkpointFiles, int64_t checkpointObjects, 
+		bool resume, int numWorkers, bool twoPhase, int verbose, class PgMapError &errStr);
 	bool RefreshMapIds(int verbose, class PgMapError &errStr);
 	bool ImportChangesetMetadata(const std::string &fina, int verbose, class PgMapError &errStr);
 	bool RefreshMaxChangesetUid(int verbose, class PgMapError &errStr);
 	bool GenerateUsernameTable(int verbose, class PgMapError &errStr);
+	bool GenerateUsernameTableParallel(int verbose, int numWorkers, class PgMapError &errStr);
 
 	bool UpdateBboxes(int verbose, bool updateStatic, bool updateActive, class PgMapError &errStr);
 	bool CreateBboxIndices(int verbose, class PgMapError &errStr);
 	bool DropBboxIndices(int verbose, class PgMapError &errStr);
+	bool CreateTagIndices(int verbose, const std::vector<std::string> &popularKeys, class PgMapError &errStr);
+	bool DropTagIndices(int verbose, class PgMapError &errStr);
+	bool CreateChangeLog(int verbose, class PgMapError &errStr);
+	bool DropChangeLog(int verbose, class PgMapError &errStr);
+	bool PruneChangeLog(int verbose, int64_t beforeTimestamp, class PgMapError &errStr);
+	bool ClusterSpatially(int verbose, int numWorkers, class PgMapError &errStr);
 
 	bool CheckNodesExistForWays(class PgMapError &errStr);
 	bool CheckObjectIdTables(class PgMapError &errStr);
+	bool CheckIntegrityParallel(int verbose, int numWorkers, int maxSamples, 
+		std::vector<class DbIntegrityResult> &results, class PgMapError &errStr);
 
 	void Commit();
 	void Abort();
+	bool Checkpoint(class PgMapError &errStr);
 };
 
 class PgMap
@@ -19,6 +19,7 @@ using std::string;
 #include "pgmap.h"
 #include "cppo5m/OsmData.h"
 #include "cppo5m/utils.h"
+#include "util.h"
 %}
 
 %exception {
@@ -97,6 +98,8 @@ namespace std {
 namespace std {
 	%template(vectorchangeset) vector<PgChangeset>;
 	%template(vectorsharedptreditactivity) vector<shared_ptr<EditActivity> >;
+	%template(vectorintegrityresult) vector<DbIntegrityResult>;
+	%template(vectorchangelogentry) vector<ChangeLogEntry>;
 };
 
 %shared_ptr(EditActivity)
@@ -113,6 +116,10 @@ namespace std {
 %include "pgmap.h"
 %include "cppo5m/utils.h"
 %include "dbeditactivity.h"
+%include "dbintegrity.h"
+%include "dbchangelog.h"
+
+std::shared_ptr<IDataStreamHandler> OpenOsmOutputFile(const std::string &filename, int numThreads = 1);
 
 /*
 %shared_ptr(PbfDecode)
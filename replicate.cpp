@@ -0,0 +1,122 @@
+#include <iostream>
+#include <thread>
+#include <chrono>
+#include <ctime>
+#include "util.h"
+#include "pgmap.h"
+#include "dbpublish.h"
+#include <boost/program_options.hpp>
+namespace po = boost::program_options;
+
+int main(int argc, char **argv)
+{
+	po::options_description desc("Allowed options");
+	desc.add_options()
+		("help", "produce help message")
+		("out", po::value<string>(), "path to publish replication diffs to (default is replication_path in config)")
+		("interval", po::value<int64_t>(), "seconds covered by each diff (default is 60)")
+		("lag", po::value<int64_t>(), "seconds to wait after an interval ends before publishing it (default is 60)")
+		("start", po::value<int64_t>(), "timestamp the first diff starts at, if nothing has been published yet")
+		("max-files", po::value<int>(), "most diffs to publish in each transaction (default is 1)")
+		("augmented", "also publish augmented diffs (.adiff.gz), with the version before each change")
+		("once", "publish the diffs that are due and exit, rather than running continuously")
+		("verbose", po::value<int>(), "verbosity level (default is 1)")
+	;
+
+	po::variables_map vm;
+	po::store(po::parse_command_line(argc, argv, desc), vm);
+	po::notify(vm);
+
+	if (vm.count("help")) {
+		cout << desc << "\n";
+		return 1;
+	}
+
+	cout << "Reading settings from config.cfg" << endl;
+	std::map<string, string> config;
+	ReadSettingsFile("config.cfg", config);
+
+	string outPath = config["replication_path"];
+	if (vm.count("out"))
+		outPath = vm["out"].as<string>();
+	if(outPath.size() == 0)
+	{
+		cerr << "Output path must be specified" << endl;
+		cout << desc << "\n";
+		return -1;
+	}
+
+	int64_t interval = 60;
+	if (vm.count("interval"))
+		interval = vm["interval"].as<int64_t>();
+	int64_t lag = 60;
+	if (vm.count("lag"))
+		lag = vm["lag"].as<int64_t>();
+	int64_t startTimestamp = -1;
+	if (vm.count("start"))
+		startTimestamp = vm["start"].as<int64_t>();
+	int maxFiles = 1;
+	if (vm.count("max-files"))
+		maxFiles = vm["max-files"].as<int>();
+	bool augmented = vm.count("augmented") > 0;
+	bool once = vm.count("once") > 0;
+	int verbose = 1;
+	if (vm.count("verbose"))
+		verbose = vm["verbose"].as<int>();
+
+	string cstr = GeneratePgConnectionString(config);
+	class PgMap pgMap(cstr, config["dbtableprefix"], config["dbtablemodifyprefix"], config["dbtablemodifyprefix"], config["dbtabletestprefix"]);
+	if (!pgMap.Ready()) {
+		cout << "Can't open database" << endl;
+		return -1;
+	}
+
+	while(true)
+	{
+		//Each pass is one transaction, which records the sequences it published. state.txt is
+		//only replaced after the commit, so an announced sequence is never published again.
+		std::shared_ptr<class PgTransaction> transaction = pgMap.GetTransaction("ACCESS SHARE");
+		class PgMapError errStr;
+		int64_t lastSequence = 0, lastTimestamp = 0;
+		int numPublished = 0;
+		bool ok = transaction->PublishReplicationDiffs(outPath, interval, lag, startTimestamp, maxFiles, augmented, verbose,
+			lastSequence, lastTimestamp, numPublished, errStr);
+		if(!ok)
+		{
+			cout << errStr.errStr << endl;
+			transaction->Abort();
+			return -2;
+		}
+		if(numPublished > 0)
+			transaction->Commit();
+		else
+			transaction->Abort();
+		transaction.reset();
+
+		//Also brings state.txt up to date after a crash between the commit and the rename
+		if(lastSequence > 0)
+		{
+			string stateErrStr;
+			if(!WriteReplicationState(outPath, lastSequence, lastTimestamp, stateErrStr))
+			{
+				cout << stateErrStr << endl;
+				return -2;
+			}
+		}
+
+		if(numPublished >= maxFiles)
+			continue; //Still catching up
+		if(once)
+			break;
+
+		//Sleep until the next interval can be published
+		int64_t wait = lastTimestamp + interval + lag - (int64_t)time(nullptr);
+		if(wait < 1)
+			wait = 1;
+		if(verbose >= 2)
+			cout << "Waiting " << wait << " seconds" << endl;
+		std::this_thread::sleep_for(std::chrono::seconds(wait));
+	}
+
+	return 0;
+}
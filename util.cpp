@@ -3,6 +3,11 @@
 #include <cmath>
 #include "util.h"
 #include "cppo5m/utils.h"
+#include "cppo5m/o5m.h"
+#include "cppo5m/osmxml.h"
+#include "gzipblocks.h"
+#include "zstdstream.h"
+#include "pbfblocks.h"
 using namespace std;
 
 int ReadFileContents(const char *filename, int binaryMode, std::string &contentOut)
@@ -167,6 +172,121 @@ void LoadOsmFromFile(const std::string &filename, shared_ptr<class IDataStreamHa
 	csvStore->Finish();
 }
 
+void ReadOsmFromFile(const std::string &filename, std::shared_ptr<class IDataStreamHandler> handler)
+{
+	vector<string> filenameSplit = split(filename, '.');
+	if(filenameSplit.size() < 2)
+		throw runtime_error("Input file name does not have a recognized extension");
+	size_t filePart = filenameSplit.size()-1;
+
+	shared_ptr<std::filebuf> fb(new std::filebuf());
+	if(fb->open(filename, std::ios::in | std::ios::binary) == nullptr)
+		throw runtime_error("Error opening input file " + filename);
+
+	//An empty database gives an empty dump
+	if(fb->sgetc() == EOF)
+	{
+		handler->Finish();
+		return;
+	}
+
+	shared_ptr<std::streambuf> fb2;
+	if(filenameSplit[filePart] == "gz")
+	{
+		fb2.reset(new class DecodeGzip(*fb.get()));
+		filePart --;
+		if(fb2->sgetc() == EOF)
+		{
+			handler->Finish();
+			return;
+		}
+	}
+	else
+		fb2 = fb;
+
+	if(filenameSplit[filePart] == "o5m")
+		LoadFromO5m(*fb2.get(), handler.get());
+	else if (filenameSplit[filePart] == "osm")
+		LoadFromOsmXml(*fb2.get(), handler.get());
+	else
+		throw runtime_error("File extension not supported");
+
+	handler->Finish();
+}
+
+std::shared_ptr<class IDataStreamHandler> OpenOsmOutputFile(const std::string &filename, int numThreads)
+{
+	vector<string> filenameSplit = split(filename, '.');
+	if(filenameSplit.size() < 2)
+		throw runtime_error("Output file name does not have a recognized extension");
+	size_t filePart = filenameSplit.size()-1;
+
+	string compression;
+	if(filenameSplit[filePart] == "gz" or filenameSplit[filePart] == "zst")
+	{
+		compression = filenameSplit[filePart];
+		filePart --;
+	}
+	string format = filePart > 0 ? filenameSplit[filePart] : "";
+	if(format != "o5m" and format != "osm" and format != "pbf")
+		throw runtime_error("Output file name does not have a recognized extension");
+	if(format == "pbf" and compression.size() > 0)
+		throw runtime_error("PBF is already compressed");
+
+	std::shared_ptr<std::filebuf> outfi(new std::filebuf());
+	if(outfi->open(filename, std::ios::out | std::ios::binary) == nullptr)
+		throw runtime_error("Error opening output file " + filename);
+
+	//Members split at any byte, since the output is binary
+	std::shared_ptr<std::streambuf> compressor;
+	std::shared_ptr<class EncodeGzipBlocks> gzip;
+	std::shared_ptr<class EncodeZstd> zstd;
+	if(compression == "gz")
+	{
+		gzip.reset(new class EncodeGzipBlocks(*outfi, 4*1024*1024, -1, numThreads, false));
+		compressor = gzip;
+	}
+	else if(compression == "zst")
+	{
+		zstd.reset(new class EncodeZstd(*outfi, numThreads));
+		compressor = zstd;
+	}
+	std::streambuf &dest = compressor ? *compressor : *outfi;
+
+	IDataStreamHandler *enc = nullptr;
+	if(format == "pbf")
+		enc = new class PbfBlockEncode(dest, numThreads);
+	else if(format == "o5m")
+		enc = new class O5mEncode(dest);
+	else
+	{
+		TagMap empty;
+		enc = new class OsmXmlEncode(dest, empty);
+	}
+
+	return std::shared_ptr<IDataStreamHandler>(enc,
+		[outfi, compressor, gzip, zstd](IDataStreamHandler *e) mutable
+		{
+			delete e;
+			//A deleter must not throw, so errors ending the compressed output are reported here
+			try
+			{
+				if(gzip)
+					gzip->Finish();
+				if(zstd)
+					zstd->Finish();
+			}
+			catch (std::exception &err)
+			{
+				cerr << "Error finishing compressed output: " << err.what() << endl;
+			}
+			gzip.reset();
+			zstd.reset();
+			compressor.reset();
+			outfi->close();
+		});
+}
+
 // From https://wiki.openstreetmap.org/wiki/Slippy_map_tilenames
 double long2tilex(double lon, int z) 
 { 
@@ -246,6 +246,12 @@ void StrReplaceAll( string &s, const string &search, const string &replace );
 std::string EscapeQuotes(std::string str);
 std::string GeneratePgConnectionString(std::map<std::string, std::string> config);
 void LoadOsmFromFile(const std::string &filename, std::shared_ptr<class IDataStreamHandler> csvStore);
+///Like LoadOsmFromFile, but errors are thrown as runtime_error rather than exiting, and an
+///empty file (or empty gzip stream) is read as containing no objects.
+void ReadOsmFromFile(const std::string &filename, std::shared_ptr<class IDataStreamHandler> handler);
+///Opens an encoder chosen by the file extension: .o5m, .osm, either with .gz or .zst, or
+///.pbf. Compression runs on numThreads threads. The file is closed when the encoder is released.
+std::shared_ptr<class IDataStreamHandler> OpenOsmOutputFile(const std::string &filename, int numThreads = 1);
 
 double long2tilex(double lon, int z);
 double lat2tiley(double lat, int z);
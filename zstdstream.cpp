@@ -0,0 +1,93 @@
+#include "zstdstream.h"
+#include <zstd.h> //apt install libzstd-dev
+#include <stdexcept>
+using namespace std;
+
+EncodeZstd::EncodeZstd(std::streambuf &outIn, int numThreadsIn, int compressionLevelIn):
+	out(outIn),
+	finished(false)
+{
+	cctx = ZSTD_createCCtx();
+	if(cctx == nullptr)
+		throw runtime_error("ZSTD_createCCtx failed");
+	ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, compressionLevelIn);
+	ZSTD_CCtx_setParameter(cctx, ZSTD_c_checksumFlag, 1);
+	//Fails harmlessly if libzstd is single threaded
+	if(numThreadsIn > 1)
+		ZSTD_CCtx_setParameter(cctx, ZSTD_c_nbWorkers, numThreadsIn);
+
+	inSize = ZSTD_CStreamInSize();
+	buffer.reserve(inSize);
+	outBuffer.resize(ZSTD_CStreamOutSize());
+}
+
+EncodeZstd::~EncodeZstd()
+{
+	try
+	{
+		Finish();
+	}
+	catch (std::exception &err) {}
+	ZSTD_freeCCtx(cctx);
+}
+
+void EncodeZstd::Finish()
+{
+	if(finished)
+		return;
+	finished = true;
+	Compress(ZSTD_e_end);
+	out.pubsync();
+}
+
+int EncodeZstd::overflow(int c)
+{
+	if(c == EOF)
+		return c;
+	if(finished)
+		throw runtime_error("zstd frame already finished");
+	buffer.push_back((char)c);
+	if(buffer.size() >= inSize)
+		Compress(ZSTD_e_continue);
+	return c;
+}
+
+std::streamsize EncodeZstd::xsputn(const char* s, std::streamsize n)
+{
+	if(finished)
+		throw runtime_error("zstd frame already finished");
+	buffer.append(s, n);
+	if(buffer.size() >= inSize)
+		Compress(ZSTD_e_continue);
+	return n;
+}
+
+int EncodeZstd::sync()
+{
+	if(!finished)
+		Compress(ZSTD_e_flush);
+	return out.pubsync();
+}
+
+//Passes the buffered input to the compressor and writes whatever it produces
+void EncodeZstd::Compress(int endDirective)
+{
+	ZSTD_EndDirective mode = (ZSTD_EndDirective)endDirective;
+	ZSTD_inBuffer input = {buffer.data(), buffer.size(), 0};
+	bool done = false;
+	while(!done)
+	{
+		ZSTD_outBuffer output = {&outBuffer[0], outBuffer.size(), 0};
+		size_t remaining = ZSTD_compressStream2(cctx, &output, &input, mode);
+		if(ZSTD_isError(remaining))
+			throw runtime_error(string("zstd compression failed: ") + ZSTD_getErrorName(remaining));
+		out.sputn(outBuffer.data(), output.pos);
+
+		if(mode == ZSTD_e_continue)
+			done = input.pos == input.size;
+		else
+			done = remaining == 0;
+	}
+	buffer.clear();
+}
+
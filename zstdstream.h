@@ -0,0 +1,34 @@
+#ifndef _ZSTD_STREAM_H
+#define _ZSTD_STREAM_H
+
+#include <streambuf>
+#include <string>
+
+///Writes a zstd frame. With numThreads above one, libzstd compresses on that many
+///worker threads (if it was built with multithreading support).
+class EncodeZstd : public std::streambuf
+{
+public:
+	EncodeZstd(std::streambuf &outIn, int numThreadsIn = 1, int compressionLevelIn = 3);
+	virtual ~EncodeZstd();
+
+	///Ends the frame, throwing runtime_error if that fails. The destructor does this too,
+	///but cannot report errors.
+	void Finish();
+
+protected:
+	int overflow(int c);
+	std::streamsize xsputn(const char* s, std::streamsize n);
+	int sync();
+
+	void Compress(int endDirective);
+
+	std::streambuf &out;
+	struct ZSTD_CCtx_s *cctx;
+	size_t inSize;
+	std::string buffer;
+	std::string outBuffer;
+	bool finished;
+};
+
+#endif //_ZSTD_STREAM_H